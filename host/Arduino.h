@@ -0,0 +1,146 @@
+#ifndef __HOST_ARDUINO_HDR__
+#define __HOST_ARDUINO_HDR__
+
+/**
+ * Just enough of the Arduino core for the firmware headers to be included
+ * by the host tools.
+ *
+ * The functions are only declared here. Tools that run the firmware itself
+ * include board.h, which defines them on a virtual board.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define HIGH    1
+#define LOW     0
+
+#define INPUT         0
+#define OUTPUT        1
+#define INPUT_PULLUP  2
+
+#define CHANGE        1
+#define FALLING       2
+#define RISING        3
+
+#define F_CPU         16000000L
+
+#define constrain(x, lo, hi) ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// Program memory is just memory here
+#define PROGMEM
+#define pgm_read_byte(p)  (*(const uint8_t*)(p))
+
+void pinMode (uint8_t pin, uint8_t mode);
+int digitalRead (uint8_t pin);
+void digitalWrite (uint8_t pin, uint8_t level);
+unsigned long millis ();
+unsigned long micros ();
+void delay (unsigned long ms);
+void delayMicroseconds (unsigned int us);
+void analogWrite (uint8_t pin, int value);
+void attachInterrupt (uint8_t interrupt, void (*fn) (), int mode);
+
+// The Mega's external interrupts
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : (p) == 3 ? 1 : \
+    (p) == 21 ? 2 : (p) == 20 ? 3 : (p) == 19 ? 4 : (p) == 18 ? 5 : -1)
+
+inline void noInterrupts () {}
+inline void interrupts () {}
+
+/**
+ * The AVR registers the firmware sets its timers up with. Only board.h
+ * gives them any meaning.
+ */
+#define _BV(b)        (1 << (b))
+#define ISR(vector)   extern "C" void vector ()
+
+extern volatile uint8_t TCCR2A, TCCR2B, OCR2A, TIMSK2;
+
+#define WGM21         1
+#define CS20          0
+#define CS21          1
+#define CS22          2
+#define OCIE2A        1
+
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+extern volatile uint16_t TCNT1, OCR1A;
+extern volatile uint8_t TCCR5A, TCCR5B, TIMSK5;
+extern volatile uint16_t TCNT5, OCR5A;
+
+#define COM1A0        6
+#define WGM12         3
+#define CS10          0
+#define CS11          1
+#define CS12          2
+#define FOC1A         7
+#define OCIE1A        1
+#define CS50          0
+#define CS51          1
+#define CS52          2
+#define OCIE5A        1
+
+// Why the board last reset
+extern volatile uint8_t MCUSR;
+
+#define PORF          0
+#define EXTRF         1
+#define BORF          2
+#define WDRF          3
+
+/**
+ * A serial port that hands whatever is written to it to a sink.
+ */
+class HardwareSerial {
+public:
+  void (*sink) (void* ctx, const uint8_t* data, size_t n);
+  int (*source) (void* ctx);    // The next byte received, or -1
+  void* ctx;
+
+  void begin (long baud) {}
+
+  int available () {
+    if (!peeked && source) peeked = source (ctx) + 1;
+    return peeked > 0;
+  }
+  int read () {
+    int c = available () ? peeked - 1 : -1;
+    peeked = 0;
+    return c;
+  }
+
+  size_t write (const uint8_t* data, size_t n) {
+    if (sink) sink (ctx, data, n);
+    return n;
+  }
+  size_t write (uint8_t c) { return write (&c, 1); }
+
+  size_t print (const char* s) { return write ((const uint8_t*)s, strlen (s)); }
+  size_t print (char c) { return write ((uint8_t)c); }
+  size_t print (long n) { return format ("%ld", n); }
+  size_t print (unsigned long n) { return format ("%lu", n); }
+  size_t print (int n) { return format ("%d", n); }
+  size_t print (unsigned int n) { return format ("%u", n); }
+  size_t print (double n) { return format ("%.2f", n); }
+
+  template <class T> size_t println (T v) { return print (v) + print ("\r\n"); }
+  size_t println () { return print ("\r\n"); }
+
+private:
+  int peeked;     // One more than a byte read ahead by available, or 0
+
+  template <class T> size_t format (const char* f, T v) {
+    char s[32];
+    return print ((snprintf (s, sizeof (s), f, v), s));
+  }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif
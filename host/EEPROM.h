@@ -0,0 +1,37 @@
+#ifndef __HOST_EEPROM_HDR__
+#define __HOST_EEPROM_HDR__
+
+/**
+ * The Arduino EEPROM library over a Mega's 4 KB, erased, in memory.
+ */
+
+#include <string.h>
+
+#include "Arduino.h"
+
+#define EEPROM_SIZE   4096
+
+class EEPROMClass {
+public:
+  uint8_t bytes[EEPROM_SIZE];
+
+  EEPROMClass () { memset (bytes, 0xff, sizeof (bytes)); }
+
+  uint8_t read (int address) { return bytes[address]; }
+  void write (int address, uint8_t value) { bytes[address] = value; }
+  void update (int address, uint8_t value) { bytes[address] = value; }
+  uint16_t length () { return EEPROM_SIZE; }
+
+  template <class T> T& get (int address, T& t) {
+    memcpy (&t, bytes + address, sizeof (T));
+    return t;
+  }
+  template <class T> const T& put (int address, const T& t) {
+    memcpy (bytes + address, &t, sizeof (T));
+    return t;
+  }
+};
+
+static EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef __BOARD_HDR__
+#define __BOARD_HDR__
+
+/**
+ * A virtual board for running the unmodified firmware on the host.
+ *
+ * Time only moves when the firmware calls into the core: every call costs
+ * about what it does on the Mega and delays move the clock by their
+ * length. Inputs change at scheduled times and the run ends, through a
+ * longjmp out of whatever the firmware is doing, once the clock passes
+ * board.end.
+ *
+ * Timer2's compare interrupt fires at the rate its registers are set to,
+ * Timer1 toggles OC1A, which is jumpered on to Timer5's T5 clock input,
+ * and pin change handlers attached to the external interrupts fire when
+ * their inputs change. Time spent in them isn't counted. Inputs with
+ * their pull-ups on read high until driven. The vertical VFD answers on
+ * Serial1.
+ */
+
+#include <setjmp.h>
+
+#include <vector>
+
+#include "Arduino.h"
+
+#define BOARD_PINS    70
+
+// What the core's calls cost on a 16 MHz Mega, in microseconds
+#define READ_COST     4
+#define WRITE_COST    5
+#define MILLIS_COST   1
+
+typedef struct {
+  uint64_t time;    // Microseconds
+  uint8_t pin;
+  uint8_t level;
+} Edge;
+
+typedef struct {
+  uint64_t now;               // Microseconds since reset
+  uint64_t end;
+  uint8_t levels[BOARD_PINS];
+  uint8_t modes[BOARD_PINS];
+  int analog[BOARD_PINS];
+  void (*handlers[BOARD_PINS]) ();
+  uint8_t handlerModes[BOARD_PINS];
+  uint64_t nextTick;          // When Timer2 next fires
+  uint64_t nextToggle;        // When Timer1 next toggles OC1A
+  int inInterrupt;
+
+  uint8_t request[8];         // What the drive has heard of a request
+  uint8_t heard;
+  uint8_t reply[8];
+  uint8_t replyLength;
+  uint8_t replied;
+
+  const Edge* inputs;         // Sorted by time
+  size_t inputCount;
+  size_t next;
+
+  jmp_buf done;
+} Board;
+
+Board board;
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+volatile uint8_t TCCR2A, TCCR2B, OCR2A, TIMSK2;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t TCCR5A, TCCR5B, TIMSK5;
+volatile uint16_t TCNT5, OCR5A;
+volatile uint8_t MCUSR;
+
+// OC1A and T5, jumpered together for hardware stepping
+#define OC1A_PIN      11
+#define T5_PIN        47
+
+// Defined by firmware that uses the timers
+extern "C" void TIMER2_COMPA_vect () __attribute__ ((weak));
+extern "C" void TIMER1_COMPA_vect () __attribute__ ((weak));
+extern "C" void TIMER5_COMPA_vect () __attribute__ ((weak));
+
+// The firmware's, for the drive's replies
+uint16_t modbusCrc (const uint8_t* data, uint8_t n);
+
+/**
+ * The drive takes a Modbus request and answers it at once, as a working
+ * one does: a write is echoed and a read of a register comes back 0.
+ */
+void driveTake (void* ctx, const uint8_t* data, size_t n) {
+  for (size_t i = 0; i < n && board.heard < sizeof (board.request); i++)
+    board.request[board.heard++] = data[i];
+  if (board.heard < sizeof (board.request)) return;
+
+  uint8_t* q = board.request;
+  uint8_t* r = board.reply;
+  if (q[1] == 0x03) {
+    // Read holding registers
+    r[0] = q[0];
+    r[1] = q[1];
+    r[2] = 2;
+    r[3] = r[4] = 0;
+    uint16_t crc = modbusCrc (r, 5);
+    r[5] = crc;
+    r[6] = crc >> 8;
+    board.replyLength = 7;
+  } else {
+    memcpy (r, q, 8);
+    board.replyLength = 8;
+  }
+  board.replied = 0;
+  board.heard = 0;
+}
+
+int driveGive (void* ctx) {
+  return board.replied < board.replyLength ? board.reply[board.replied++] :
+    -1;
+}
+
+/**
+ * Resets the board with a schedule of input changes. The run ends at end.
+ */
+void boardReset (const Edge* inputs, size_t n, uint64_t end) {
+  memset (&board, 0, sizeof (board));
+  TCCR2A = TCCR2B = OCR2A = TIMSK2 = 0;
+  TCCR1A = TCCR1B = TCCR1C = TIMSK1 = 0;
+  TCNT1 = OCR1A = 0;
+  TCCR5A = TCCR5B = TIMSK5 = 0;
+  TCNT5 = OCR5A = 0;
+  MCUSR = _BV (PORF);
+  board.inputs = inputs;
+  board.inputCount = n;
+  board.end = end;
+  Serial1.sink = driveTake;
+  Serial1.source = driveGive;
+}
+
+/**
+ * Microseconds between Timer2 compare interrupts, or 0 when they're off.
+ */
+uint64_t timer2Period () {
+  static const int prescale[8] = { 0, 1, 8, 32, 64, 128, 256, 1024 };
+  int p = prescale[TCCR2B & 7];
+
+  if (!TIMER2_COMPA_vect || !(TIMSK2 & _BV (OCIE2A)) || !p) return 0;
+  return (uint64_t)(OCR2A + 1) * p * 1000000 / F_CPU;
+}
+
+/**
+ * Microseconds between Timer1's compare matches in clear on compare mode,
+ * or 0 when it's stopped or nothing sees them.
+ */
+uint64_t timer1Period () {
+  static const int prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  int p = prescale[TCCR1B & 7];
+
+  if (!p || !(TCCR1B & _BV (WGM12))) return 0;
+  if (!(TCCR1A & _BV (COM1A0)) && !(TIMSK1 & _BV (OCIE1A))) return 0;
+  uint64_t period = (uint64_t)(OCR1A + 1) * p * 1000000 / F_CPU;
+  return period ? period : 1;
+}
+
+/**
+ * One compare match on Timer1: OC1A toggles if it's connected, Timer5
+ * counts its rising edges on T5 when it's clocked from there, and the
+ * compare interrupts fire.
+ */
+void timer1Toggle () {
+  uint8_t level = board.levels[OC1A_PIN];
+
+  if (TCCR1A & _BV (COM1A0))
+    board.levels[OC1A_PIN] = board.levels[T5_PIN] = level = !level;
+  board.inInterrupt = 1;
+  if (TIMER1_COMPA_vect && (TIMSK1 & _BV (OCIE1A))) TIMER1_COMPA_vect ();
+  if (level && (TCCR1A & _BV (COM1A0)) && (TCCR5B & 7) == 7) {
+    TCNT5++;
+    if (TIMER5_COMPA_vect && (TIMSK5 & _BV (OCIE5A)) && TCNT5 == OCR5A)
+      TIMER5_COMPA_vect ();
+  }
+  board.inInterrupt = 0;
+}
+
+void setInput (uint8_t pin, uint8_t level) {
+  uint8_t was = board.levels[pin];
+  void (*fn) () = board.handlers[pin];
+  int mode = board.handlerModes[pin];
+
+  board.levels[pin] = level;
+  if (fn && level != was && (mode == CHANGE ||
+        (mode == RISING && level) || (mode == FALLING && !level))) {
+    board.inInterrupt = 1;
+    fn ();
+    board.inInterrupt = 0;
+  }
+}
+
+/**
+ * Moves the clock forward, applying the input changes and firing the
+ * interrupts that came due.
+ */
+void advance (uint64_t us) {
+  board.now += us;
+  if (board.inInterrupt) return;
+
+  uint64_t period = timer2Period ();
+  if (!period) board.nextTick = 0;
+  else if (!board.nextTick) board.nextTick = board.now + period;
+
+  // In the order they came due, so a tick only sees the inputs before it
+  for (;;) {
+    uint64_t toggle = timer1Period ();
+    if (!toggle) board.nextToggle = 0;
+    else if (!board.nextToggle) board.nextToggle = board.now + toggle;
+
+    const Edge* e = board.next < board.inputCount &&
+      board.inputs[board.next].time <= board.now ?
+      &board.inputs[board.next] : 0;
+    uint64_t due = e ? e->time : board.now + 1;
+    int which = e ? 1 : 0;
+
+    if (period && board.nextTick <= board.now && board.nextTick < due) {
+      due = board.nextTick;
+      which = 2;
+    }
+    if (toggle && board.nextToggle <= board.now && board.nextToggle < due)
+      which = 3;
+
+    if (which == 1) {
+      board.next++;
+      if (e->pin < BOARD_PINS) setInput (e->pin, e->level);
+    } else if (which == 2) {
+      board.nextTick += period;
+      board.inInterrupt = 1;
+      TIMER2_COMPA_vect ();
+      board.inInterrupt = 0;
+    } else if (which == 3) {
+      timer1Toggle ();
+      // The interrupt may have changed the period or stopped the timer
+      toggle = timer1Period ();
+      board.nextToggle = toggle ? board.nextToggle + toggle : 0;
+    } else {
+      break;
+    }
+  }
+
+  if (board.now > board.end) longjmp (board.done, 1);
+}
+
+void pinMode (uint8_t pin, uint8_t mode) {
+  if (pin >= BOARD_PINS) return;
+
+  board.modes[pin] = mode;
+
+  // Nothing is wired to a pulled up input until the schedule says so
+  if (mode == INPUT_PULLUP) board.levels[pin] = HIGH;
+}
+
+int digitalRead (uint8_t pin) {
+  advance (READ_COST);
+  return pin < BOARD_PINS ? board.levels[pin] : LOW;
+}
+
+void digitalWrite (uint8_t pin, uint8_t level) {
+  advance (WRITE_COST);
+  if (pin < BOARD_PINS) board.levels[pin] = level != LOW;
+}
+
+void analogWrite (uint8_t pin, int value) {
+  advance (WRITE_COST);
+  if (pin < BOARD_PINS) board.analog[pin] = value;
+}
+
+static const uint8_t interruptPins[6] = { 2, 3, 21, 20, 19, 18 };
+
+void attachInterrupt (uint8_t interrupt, void (*fn) (), int mode) {
+  if (interrupt >= 6) return;
+  board.handlers[interruptPins[interrupt]] = fn;
+  board.handlerModes[interruptPins[interrupt]] = mode;
+}
+
+unsigned long millis () {
+  advance (MILLIS_COST);
+  return board.now / 1000;
+}
+
+unsigned long micros () {
+  advance (MILLIS_COST);
+  return board.now;
+}
+
+void delay (unsigned long ms) {
+  advance ((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds (unsigned int us) {
+  advance (us);
+}
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * Multi-coat schedule benchmark.
+ *
+ * Times a coat on each station with the simulated job, then plays the
+ * stations' coats and drying through the firmware's scheduler, and one
+ * station after another as a single panel job would, and reports how long
+ * each takes and how much of it the carriage is painting.
+ *
+ *   coats [-p set.params] [-n coats] [-s left:right:stain ...]
+ *
+ * Without -s the stations are STATION_BOUNDS and STATION_STAINS.
+ */
+
+#include "sim.h"
+#include "params_io.h"
+#include "schedule.h"
+
+#define MAX_STATIONS  8
+
+typedef struct {
+  double makespan;      // Seconds from the first coat to the last one dry
+  double busy;          // Seconds spent painting
+  int order[MAX_STATIONS * 256];
+  int coats;
+} Run;
+
+void usage () {
+  fprintf (stderr, "usage: coats [-p set.params] [-n coats] "
+      "[-s left:right:stain ...]\n");
+  exit (2);
+}
+
+/**
+ * Lays every coat, taking the stations in nextStation's order if scheduled
+ * and one after another if not.
+ */
+void play (const Params* p, Station* s, int n, const unsigned long* coat,
+    int scheduled, Run* run) {
+  unsigned long now = 0;
+  int at;
+
+  for (int i = 0; i < n; i++) {
+    s[i].coats = 0;
+    s[i].dryAt = 0;
+  }
+  run->busy = 0;
+  run->coats = 0;
+
+  for (;;) {
+    if (scheduled) {
+      at = nextStation (p, s, n, now);
+    } else {
+      // Each station's coats before the next station's
+      for (at = 0; at < n && s[at].coats >= p->coats; at++);
+      if (at == n) at = -1;
+    }
+    if (at < 0) break;
+
+    now += stationWait (&s[at], now);
+    now += coat[at];
+    stationCoated (p, &s[at], now);
+    run->busy += coat[at] * 1e-3;
+    run->order[run->coats++] = at;
+  }
+
+  // Done once the last coat has dried
+  for (int i = 0; i < n; i++)
+    if ((long)(s[i].dryAt - now) > 0) now = s[i].dryAt;
+  run->makespan = now * 1e-3;
+}
+
+void report (const char* name, const Run* run) {
+  printf ("%-10s %8.1fs  painting %5.1f%%  ", name, run->makespan,
+      100.0 * run->busy / run->makespan);
+  for (int i = 0; i < run->coats; i++) printf ("%d", run->order[i]);
+  printf ("\n");
+}
+
+int main (int argc, char** argv) {
+  static Machine m = DEFAULT_MACHINE;
+  static Params p = DEFAULT_PARAMS;
+  static Station s[MAX_STATIONS];
+  int n = 0;
+  int coats = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+
+    if (i + 1 >= argc) usage ();
+
+    if (!strcmp (a, "-p")) {
+      if (readParams (argv[++i], &p, &m)) {
+        perror (argv[i]);
+        return 2;
+      }
+    } else if (!strcmp (a, "-n")) {
+      coats = atoi (argv[++i]);
+      if (coats < 1 || coats > 255) usage ();
+    } else if (!strcmp (a, "-s")) {
+      int stain;
+
+      if (n == MAX_STATIONS) usage ();
+      if (sscanf (argv[++i], "%ld:%ld:%d", &s[n].left, &s[n].right,
+            &stain) != 3 || stain < 0 || stain >= STAINS)
+        usage ();
+      s[n++].stain = stain;
+    } else {
+      usage ();
+    }
+  }
+
+  if (coats) p.coats = coats;
+  if (!n) {
+    stationsBegin (s, 0);
+    n = STATION_COUNT;
+  }
+
+  // Each station's coat is the horizontal pattern over its bounds
+  unsigned long coat[MAX_STATIONS];
+  for (int i = 0; i < n; i++) {
+    Params q = p;
+    SimResult r;
+
+    q.panelLeft = s[i].left;
+    q.panelRight = s[i].right;
+    simulateCoat (&m, &q, &r);
+    coat[i] = (unsigned long)(r.cycleTime * 1e3);
+
+    printf ("station %d: %ld-%ld steps, stain %d, coat %.1fs, dry %ds\n", i,
+        s[i].left, s[i].right, s[i].stain, r.cycleTime,
+        p.dryTime[s[i].stain]);
+  }
+
+  Run serial, scheduled;
+  play (&p, s, n, coat, 0, &serial);
+  play (&p, s, n, coat, 1, &scheduled);
+
+  printf ("%d coats each\n", p.coats);
+  report ("serial", &serial);
+  report ("scheduled", &scheduled);
+  printf ("%.2fx the throughput\n", serial.makespan / scheduled.makespan);
+
+  return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * Stain coverage check.
+ *
+ * Sweeps the guns along the simulated job, or along a captured trajectory,
+ * and reports how even the stain comes out over the panel.
+ *
+ *   coverage [-p set.params] [-t trajectory] [-c cell_mm] [-o heat.ppm]
+ *            [--panel x0,y0,x1,y1] [--max-cov f] [--max-band f]
+ *
+ * Exits with 1 if the coat is less even than the given limits, so a speed
+ * change can be checked for banding from a script.
+ */
+
+#include "coverage.h"
+#include "params_io.h"
+
+void usage () {
+  fprintf (stderr, "usage: coverage [-p set.params] [-t trajectory] "
+      "[-c cell_mm] [-o heat.ppm] [--panel x0,y0,x1,y1] [--max-cov f] "
+      "[--max-band f]\n");
+  exit (2);
+}
+
+int main (int argc, char** argv) {
+  static Machine m = DEFAULT_MACHINE;
+  static Params p = DEFAULT_PARAMS;
+  const char* trajectory = 0;
+  const char* heatmap = 0;
+  double cell = 5.0;
+  double maxCov = HUGE_VAL, maxBand = HUGE_VAL;
+  double panel[4];
+  int panelGiven = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+
+    if (i + 1 >= argc) usage ();
+
+    if (!strcmp (a, "-p")) {
+      if (readParams (argv[++i], &p, &m)) {
+        perror (argv[i]);
+        return 2;
+      }
+    } else if (!strcmp (a, "-t")) {
+      trajectory = argv[++i];
+    } else if (!strcmp (a, "-c")) {
+      cell = atof (argv[++i]);
+    } else if (!strcmp (a, "-o")) {
+      heatmap = argv[++i];
+    } else if (!strcmp (a, "--panel")) {
+      if (sscanf (argv[++i], "%lf,%lf,%lf,%lf", &panel[0], &panel[1],
+            &panel[2], &panel[3]) != 4)
+        usage ();
+      panelGiven = 1;
+    } else if (!strcmp (a, "--max-cov")) {
+      maxCov = atof (argv[++i]);
+    } else if (!strcmp (a, "--max-band")) {
+      maxBand = atof (argv[++i]);
+    } else {
+      usage ();
+    }
+  }
+
+  if (cell <= 0) usage ();
+  if (!panelGiven) defaultPanel (&m, panel);
+
+  Coverage c;
+  coverageInit (&c, &m, cell);
+
+  if (trajectory) {
+    if (readTrajectory (trajectory, coverageSample, &c) < 0) {
+      perror (trajectory);
+      return 2;
+    }
+  } else {
+    SimResult r;
+    simulate (&m, &p, &r, coverageSample, &c);
+    printf ("cycle %.1fs, %d strokes\n", r.cycleTime, r.strokes);
+  }
+  coverageFlush (&c);
+
+  Uniformity u;
+  uniformity (&c, panel[0], panel[1], panel[2], panel[3], &u);
+
+  printf ("panel %.0f,%.0f-%.0f,%.0f mm\n", panel[0], panel[1], panel[2],
+      panel[3]);
+  printf ("mean %.4g  cov %.3f  min %.2f  max %.2f\n", u.mean, u.cov, u.min,
+      u.max);
+  printf ("row banding %.3f  column banding %.3f\n", u.rowBand, u.colBand);
+
+  if (heatmap && writeHeatmap (&c, heatmap, u.mean)) {
+    perror (heatmap);
+    return 2;
+  }
+  coverageFree (&c);
+
+  if (u.mean <= 0 || u.cov > maxCov ||
+      u.rowBand > maxBand || u.colBand > maxBand) {
+    printf ("FAIL\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,333 @@
+#ifndef __COVERAGE_HDR__
+#define __COVERAGE_HDR__
+
+/**
+ * A stain density model.
+ *
+ * Each open gun lays a fan shaped footprint that is swept along the
+ * carriage trajectory into a 2D grid. The footprint is separable so every
+ * deposit is a weighted row kernel added to contiguous rows of the grid.
+ *
+ * Densities are relative: one gun held still for a second deposits one
+ * unit over its footprint.
+ */
+
+#include <stdlib.h>
+#include "sim.h"
+
+typedef struct {
+  int cols;
+  int rows;
+  int stride;           // Floats per row, padded for vector loads
+  double cell;          // Millimetres per cell
+  float* data;
+  float* kernel;        // Scratch for the column weights of one deposit
+  float* weights;       // Scratch for the row weights of one deposit
+  const Machine* m;
+
+  // Samples are merged until the carriage moves half a cell
+  int open;
+  Sample first;
+  double sx, sy, dt;
+} Coverage;
+
+typedef struct {
+  double mean;
+  double cov;           // Standard deviation over the mean
+  double min;           // Minimum over the mean
+  double max;           // Maximum over the mean
+  double rowBand;       // Largest row average off the mean, over the mean
+  double colBand;       // Largest column average off the mean, over the mean
+} Uniformity;
+
+void coverageInit (Coverage* c, const Machine* m, double cell) {
+  c->m = m;
+  c->cell = cell;
+  c->cols = (int)ceil (m->width / m->stepsPerMm / cell) + 1;
+  c->rows = (int)ceil (m->height / m->countsPerMm / cell) + 1;
+  c->stride = (c->cols + 7) & ~7;
+  c->data = (float*)calloc ((size_t)c->stride * c->rows, sizeof (float));
+  c->kernel = (float*)calloc (c->stride, sizeof (float));
+  c->weights = (float*)calloc (c->rows, sizeof (float));
+  c->open = 0;
+}
+
+void coverageFree (Coverage* c) {
+  free (c->data);
+  free (c->kernel);
+  free (c->weights);
+}
+
+/**
+ * Adds w * k[i] to row[i]. Kept free of aliasing and branches so the
+ * compiler turns it into vector adds.
+ */
+static inline void accumulateRow (float* __restrict row,
+    const float* __restrict k, float w, int n) {
+  for (int i = 0; i < n; i++) row[i] += w * k[i];
+}
+
+/**
+ * Fills k with the footprint density over the cells [lo, hi] for a
+ * footprint centred on u, extent mm long. Tapered at both ends by taper.
+ *
+ * @return the number of cells written
+ */
+int footprint (double u, double extent, double taper, double cell,
+    int lo, int hi, float* k) {
+  double half = extent / 2;
+  double flat = half * (1 - taper);
+  double norm = 1.0 / (extent * (1 - taper / 2));
+
+  for (int i = lo; i <= hi; i++) {
+    double d = fabs (i * cell - u);
+    double w = d <= flat ? 1.0 : d >= half ? 0.0 : (half - d) / (half - flat);
+    k[i - lo] = (float)(w * norm * cell);
+  }
+
+  return hi - lo + 1;
+}
+
+/**
+ * Deposits dt seconds of one gun centred on (x, y) in millimetres.
+ */
+void depositGun (Coverage* c, double x, double y, int axis, double dt) {
+  const Machine* m = c->m;
+  double w = axis == HORIZONTAL ? m->sprayDepth : m->fanWidth;
+  double h = axis == HORIZONTAL ? m->fanWidth : m->sprayDepth;
+  double tw = axis == HORIZONTAL ? 0 : m->taper;
+  double th = axis == HORIZONTAL ? m->taper : 0;
+  int c0 = (int)floor ((x - w / 2) / c->cell);
+  int c1 = (int)ceil ((x + w / 2) / c->cell);
+  int r0 = (int)floor ((y - h / 2) / c->cell);
+  int r1 = (int)ceil ((y + h / 2) / c->cell);
+
+  if (c0 < 0) c0 = 0;
+  if (r0 < 0) r0 = 0;
+  if (c1 >= c->cols) c1 = c->cols - 1;
+  if (r1 >= c->rows) r1 = c->rows - 1;
+  if (c1 < c0 || r1 < r0) return;
+
+  int n = footprint (x, w, tw, c->cell, c0, c1, c->kernel);
+  footprint (y, h, th, c->cell, r0, r1, c->weights);
+
+  for (int r = r0; r <= r1; r++) {
+    accumulateRow (c->data + (size_t)r * c->stride + c0, c->kernel,
+        (float)dt * c->weights[r - r0], n);
+  }
+}
+
+/**
+ * Deposits every open gun of a carriage state held for dt seconds. The
+ * guns sit gunSpacing apart across the stroke.
+ */
+void deposit (Coverage* c, double x, double y, int sprays, int axis,
+    double dt) {
+  double half = c->m->gunSpacing / 2;
+
+  if (axis == HORIZONTAL) {
+    if (sprays & SPRAY_TOP) depositGun (c, x, y + half, axis, dt);
+    if (sprays & SPRAY_BOTTOM) depositGun (c, x, y - half, axis, dt);
+  } else {
+    if (sprays & SPRAY_TOP) depositGun (c, x - half, y, axis, dt);
+    if (sprays & SPRAY_BOTTOM) depositGun (c, x + half, y, axis, dt);
+  }
+}
+
+/**
+ * Deposits the samples merged so far at their time weighted position.
+ */
+void coverageFlush (Coverage* c) {
+  if (c->open && c->dt > 0)
+    deposit (c, c->sx / c->dt, c->sy / c->dt, c->first.sprays,
+        c->first.axis, c->dt);
+  c->open = 0;
+}
+
+/**
+ * A SampleFn for simulate() and trace readers.
+ */
+void coverageSample (void* ctx, const Sample* s, double dt) {
+  Coverage* c = (Coverage*)ctx;
+  double x = s->x / c->m->stepsPerMm;
+  double y = s->y / c->m->countsPerMm;
+
+  if (c->open) {
+    double dx = x - c->first.x, dy = y - c->first.y;
+    if (s->sprays != c->first.sprays || s->axis != c->first.axis ||
+        dx * dx + dy * dy > c->cell * c->cell / 4)
+      coverageFlush (c);
+  }
+
+  if (!s->sprays) return;
+
+  if (!c->open) {
+    c->first = *s;
+    c->first.x = x;
+    c->first.y = y;
+    c->sx = c->sy = c->dt = 0;
+    c->open = 1;
+  }
+
+  c->sx += x * dt;
+  c->sy += y * dt;
+  c->dt += dt;
+}
+
+/**
+ * Measures how even the stain is over a panel, given in millimetres.
+ */
+void uniformity (const Coverage* c, double x0, double y0, double x1,
+    double y1, Uniformity* u) {
+  int c0 = (int)ceil (x0 / c->cell), c1 = (int)floor (x1 / c->cell);
+  int r0 = (int)ceil (y0 / c->cell), r1 = (int)floor (y1 / c->cell);
+  double sum = 0, sq = 0, lo = HUGE_VAL, hi = 0;
+  long n;
+
+  if (c0 < 0) c0 = 0;
+  if (r0 < 0) r0 = 0;
+  if (c1 >= c->cols) c1 = c->cols - 1;
+  if (r1 >= c->rows) r1 = c->rows - 1;
+
+  memset (u, 0, sizeof (*u));
+  if (c1 < c0 || r1 < r0) return;
+  n = (long)(c1 - c0 + 1) * (r1 - r0 + 1);
+
+  double* colSum = (double*)calloc (c1 - c0 + 1, sizeof (double));
+  double* rowSum = (double*)calloc (r1 - r0 + 1, sizeof (double));
+
+  for (int r = r0; r <= r1; r++) {
+    const float* row = c->data + (size_t)r * c->stride;
+    for (int i = c0; i <= c1; i++) {
+      double d = row[i];
+      sum += d;
+      sq += d * d;
+      if (d < lo) lo = d;
+      if (d > hi) hi = d;
+      rowSum[r - r0] += d;
+      colSum[i - c0] += d;
+    }
+  }
+
+  u->mean = sum / n;
+  if (u->mean <= 0) {
+    free (colSum);
+    free (rowSum);
+    return;
+  }
+
+  double var = sq / n - u->mean * u->mean;
+  u->cov = sqrt (var > 0 ? var : 0) / u->mean;
+  u->min = lo / u->mean;
+  u->max = hi / u->mean;
+
+  for (int r = 0; r <= r1 - r0; r++) {
+    double band = fabs (rowSum[r] / (c1 - c0 + 1) - u->mean) / u->mean;
+    if (band > u->rowBand) u->rowBand = band;
+  }
+  for (int i = 0; i <= c1 - c0; i++) {
+    double band = fabs (colSum[i] / (r1 - r0 + 1) - u->mean) / u->mean;
+    if (band > u->colBand) u->colBand = band;
+  }
+
+  free (colSum);
+  free (rowSum);
+}
+
+/**
+ * The panel assumed when none is given: the bed less the margin the outer
+ * guns can't reach with the far gun still on the wood.
+ */
+void defaultPanel (const Machine* m, double* panel) {
+  double margin = (m->gunSpacing + m->fanWidth) / 2;
+
+  panel[0] = margin;
+  panel[1] = margin;
+  panel[2] = m->width / m->stepsPerMm - margin;
+  panel[3] = m->height / m->countsPerMm - margin;
+}
+
+/**
+ * Simulates a parameter set and measures the coat it lays on a panel.
+ */
+void measureCoverage (const Machine* m, const Params* p, double cell,
+    const double* panel, Uniformity* u) {
+  Coverage c;
+  SimResult r;
+
+  coverageInit (&c, m, cell);
+  simulate (m, p, &r, coverageSample, &c);
+  coverageFlush (&c);
+  uniformity (&c, panel[0], panel[1], panel[2], panel[3], u);
+  coverageFree (&c);
+}
+
+/**
+ * Writes the grid as a binary PPM, bottom row last, scaled so the mean is
+ * the middle of the colour map.
+ *
+ * @return 0 on success, -1 if the file can't be written
+ */
+int writeHeatmap (const Coverage* c, const char* path, double mean) {
+  static const unsigned char stops[5][3] = {
+    { 0, 0, 0 }, { 0, 0, 255 }, { 0, 255, 0 }, { 255, 255, 0 },
+    { 255, 0, 0 },
+  };
+  FILE* f = fopen (path, "wb");
+
+  if (!f) return -1;
+  fprintf (f, "P6\n%d %d\n255\n", c->cols, c->rows);
+
+  for (int r = c->rows - 1; r >= 0; r--) {
+    const float* row = c->data + (size_t)r * c->stride;
+    for (int i = 0; i < c->cols; i++) {
+      double v = mean > 0 ? row[i] / (2 * mean) : 0;
+      if (v > 1) v = 1;
+      double pos = v * 4;
+      int s = pos >= 4 ? 3 : (int)pos;
+      double frac = pos - s;
+      unsigned char px[3];
+      for (int k = 0; k < 3; k++)
+        px[k] = (unsigned char)(stops[s][k] +
+            frac * (stops[s + 1][k] - stops[s][k]));
+      fwrite (px, 1, 3, f);
+    }
+  }
+
+  fclose (f);
+  return 0;
+}
+
+/**
+ * Reads a trajectory written as "t x y sprays axis" lines, t in seconds,
+ * x in steps and y in encoder counts, and feeds it to fn. Each line holds
+ * until the next one.
+ *
+ * @return the number of samples read or -1 if the file can't be read
+ */
+long readTrajectory (const char* path, SampleFn fn, void* ctx) {
+  FILE* f = fopen (path, "r");
+  char line[256];
+  Sample s, next;
+  int have = 0;
+  long n = 0;
+
+  if (!f) return -1;
+
+  while (fgets (line, sizeof (line), f)) {
+    if (line[0] == '#') continue;
+    next.axis = HORIZONTAL;
+    if (sscanf (line, "%lf %lf %lf %d %d", &next.t, &next.x, &next.y,
+          &next.sprays, &next.axis) < 4)
+      continue;
+    if (have && next.t > s.t) fn (ctx, &s, next.t - s.t);
+    s = next;
+    have = 1;
+    n++;
+  }
+
+  fclose (f);
+  return n;
+}
+
+#endif
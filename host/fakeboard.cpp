@@ -0,0 +1,158 @@
+/**
+ * Stands in for WoodStain boards on pseudo-terminals.
+ *
+ * Creates a pty per board, prints the device names and replays a capture
+ * to each, text or binary, paced by its timestamps. Each board starts at a
+ * different point of the capture and the capture loops.
+ *
+ *   fakeboard [-n boards] [-x speedup] capture
+ */
+
+#define _XOPEN_SOURCE 600
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "Arduino.h"
+#include "messages.h"
+
+typedef struct {
+  int fd;
+  size_t at;          // Offset of the next frame
+  double due;         // When it's due, in seconds of the wall clock
+  uint32_t last;      // Timestamp of the frame before it
+} Fake;
+
+const char* data;
+size_t size;
+int binary;
+double speedup = 1;
+
+double now () {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Finds the frame at an offset: its length and its timestamp, if it has
+ * one.
+ */
+size_t frame (size_t at, uint32_t* time, int* timed) {
+  *timed = 0;
+
+  if (binary) {
+    TraceRecord r;
+    if (at + sizeof (r) > size) return size - at;
+    memcpy (&r, data + at, sizeof (r));
+    if (r.kind != TRACE_BOOT) {
+      *time = r.time;
+      *timed = 1;
+    }
+    return sizeof (r);
+  }
+
+  const char* s = data + at;
+  const char* eol = (const char*)memchr (s, '\n', size - at);
+  size_t n = eol ? eol - s + 1 : size - at;
+  *timed = parseNumber (&s, data + at + n, time);
+  return n;
+}
+
+/**
+ * Sends a board's next frame and works out when the one after is due.
+ */
+void send (Fake* f) {
+  uint32_t time;
+  int timed;
+  size_t n = frame (f->at, &time, &timed);
+
+  // A board nobody reads just drops its output, like a real one
+  if (write (f->fd, data + f->at, n) < 0) {}
+
+  f->at += n;
+  if (f->at >= size) f->at = 0;
+
+  n = frame (f->at, &time, &timed);
+  if (!timed) return;
+  if (time >= f->last) f->due += (time - f->last) / 1000.0 / speedup;
+  f->last = time;
+}
+
+int main (int argc, char** argv) {
+  int boards = 1;
+  int i = 1;
+
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (!strcmp (argv[i], "-n")) boards = atoi (argv[i + 1]);
+    else if (!strcmp (argv[i], "-x")) speedup = atof (argv[i + 1]);
+  }
+  if (i != argc - 1 || boards < 1 || speedup <= 0) {
+    fprintf (stderr, "usage: fakeboard [-n boards] [-x speedup] capture\n");
+    return 2;
+  }
+
+  int fd = open (argv[i], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat (fd, &st) || !st.st_size) {
+    perror (argv[i]);
+    return 1;
+  }
+  size = st.st_size;
+  data = (const char*)mmap (0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  uint32_t magic = TRACE_MAGIC;
+  binary = size >= 4 && !memcmp (data, &magic, 4);
+
+  std::vector<Fake> fakes (boards);
+  double start = now ();
+  for (int b = 0; b < boards; b++) {
+    Fake* f = &fakes[b];
+    struct termios t;
+
+    f->fd = posix_openpt (O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (f->fd < 0 || grantpt (f->fd) || unlockpt (f->fd)) {
+      perror ("posix_openpt");
+      return 1;
+    }
+
+    // No echo or line editing on the board's side
+    int slave = open (ptsname (f->fd), O_RDWR | O_NOCTTY);
+    if (slave >= 0 && !tcgetattr (slave, &t)) {
+      cfmakeraw (&t);
+      tcsetattr (slave, TCSANOW, &t);
+    }
+    if (slave >= 0) close (slave);
+
+    printf ("%s\n", ptsname (f->fd));
+
+    // Spread the boards over the capture, starting on a frame boundary
+    uint32_t time;
+    int timed;
+    size_t at = size / boards * b;
+    if (binary) at -= at % sizeof (TraceRecord);
+    else while (at && at < size && data[at - 1] != '\n') at++;
+    f->at = at < size ? at : 0;
+    f->due = start;
+    frame (f->at, &time, &timed);
+    f->last = timed ? time : 0;
+  }
+  fflush (stdout);
+
+  for (;;) {
+    Fake* next = &fakes[0];
+    for (int b = 1; b < boards; b++)
+      if (fakes[b].due < next->due) next = &fakes[b];
+
+    double wait = next->due - now ();
+    if (wait > 0) usleep ((useconds_t)(wait * 1e6));
+    send (next);
+  }
+}
@@ -0,0 +1,209 @@
+/**
+ * Checks the fixed-point arithmetic in src/fixed.h, and the shaper's ramp
+ * and speed plans built on it, against double:
+ *
+ *   fixedtest
+ *
+ * Prints the worst error of each and exits with 1 if any is out of its
+ * bound.
+ */
+
+#include <math.h>
+
+#include "Arduino.h"
+#include "params.h"
+#include "shaper.h"
+
+typedef struct {
+  const char* name;
+  double bound;
+  double worst;
+  double at;            // The first operand of the worst case
+  long checked;
+} Check;
+
+int failed;
+
+double real (q16 a) {
+  return a / 65536.0;
+}
+
+/**
+ * A random q16 up to 2 to the scale either way.
+ */
+q16 randomQ16 (int scale) {
+  double x = (rand () / (double)RAND_MAX * 2 - 1) * ldexp (1.0, scale);
+  return (q16)(x * 65536);
+}
+
+void check (Check* c, double error, double at) {
+  c->checked++;
+  if (error > c->worst) {
+    c->worst = error;
+    c->at = at;
+  }
+}
+
+void report (const Check* c) {
+  int ok = c->worst <= c->bound;
+
+  printf ("%-24s %8ld checked, worst %.3g at %.6g, bound %.3g %s\n",
+      c->name, c->checked, c->worst, c->at, c->bound, ok ? "ok" : "FAILED");
+  if (!ok) failed = 1;
+}
+
+/**
+ * Products and quotients are good to one 65536th, and saturate.
+ */
+void arithmetic () {
+  Check mul = { "q16Mul", 1 / 65536.0 };
+  Check mulQ8 = { "q16MulQ8", 1 / 65536.0 };
+  Check mulInt = { "q16MulInt", 1 / 65536.0 };
+  Check div = { "q16Div", 1 / 65536.0 };
+  Check saturate = { "q16Mul/q16Div saturate", 0 };
+
+  srand (1);
+  for (int i = 0; i < 1000000; i++) {
+    q16 a = randomQ16 (rand () % 16), b = randomQ16 (rand () % 16);
+    double x = real (a), y = real (b);
+
+    if (fabs (x * y) < 32767)
+      check (&mul, fabs (real (q16Mul (a, b)) - x * y), x);
+    else if (fabs (x * y) >= 32768)
+      check (&saturate, q16Mul (a, b) != (x * y > 0 ? Q16_MAX : Q16_MIN), x);
+
+    if (b && fabs (x / y) < 32767)
+      check (&div, fabs (real (q16Div (a, b)) - x / y), x);
+    else if (b && fabs (x / y) >= 32768)
+      check (&saturate, q16Div (a, b) != (x / y > 0 ? Q16_MAX : Q16_MIN), x);
+
+    // The same with the other side 16 bits, as a q8 and as an integer
+    int16_t c = (int16_t)(rand () % 65536 - 32768);
+    double z = c / 256.0;
+
+    if (fabs (x * z) < 32767)
+      check (&mulQ8, fabs (real (q16MulQ8 (a, c)) - x * z), x);
+    else if (fabs (x * z) >= 32768)
+      check (&saturate, q16MulQ8 (a, c) != (x * z > 0 ? Q16_MAX : Q16_MIN), x);
+
+    if (fabs (x * c) < 32767)
+      check (&mulInt, fabs (real (q16MulInt (a, c)) - x * c), x);
+    else if (fabs (x * c) >= 32768)
+      check (&saturate, q16MulInt (a, c) != (x * c > 0 ? Q16_MAX : Q16_MIN),
+          x);
+  }
+
+  report (&mul);
+  report (&mulQ8);
+  report (&mulInt);
+  report (&div);
+  report (&saturate);
+}
+
+/**
+ * The root is good to a 65536th under 1 and to 15 bits relative above,
+ * as many as 32 bits hold. e to the a is good to a few 65536ths over the
+ * range the shaper's damping takes it, which is all below 0.
+ */
+void functions () {
+  Check root = { "q16Sqrt", 1 / 65536.0 };
+  Check relative = { "q16Sqrt relative", 1 / 32768.0 };
+  Check exponent = { "q16Exp", 5 / 65536.0 };
+
+  for (q16 a = 1; a > 0 && a < 0x7fff0000; a += a / 1000 + 1) {
+    double x = real (a), e = fabs (real (q16Sqrt (a)) - sqrt (x));
+
+    if (x < 1) check (&root, e, x);
+    else check (&relative, e / sqrt (x), x);
+  }
+
+  for (q16 a = -4 * Q16_ONE; a <= 0; a += 7) {
+    double x = real (a);
+    check (&exponent, fabs (real (q16Exp (a)) - exp (x)), x);
+  }
+
+  report (&root);
+  report (&relative);
+  report (&exponent);
+}
+
+/**
+ * The plan's ramp takes as long as the double one over the same distance,
+ * and a counted move's plan covers its count.
+ */
+void ramps () {
+  Check time = { "rampPlan ramp time", 0.01 };
+  Check distance = { "rampPlan distance", 0.005 };
+
+  for (int min = 20; min <= 300; min += 10) {
+    for (int max = min + 50; max <= 1500; max += 150) {
+      for (int ramp = 100; ramp <= 3000; ramp += 290) {
+        Profile p = { min, max, ramp };
+        double slow = 500000.0 / max, fast = 500000.0 / min;
+        double accel = (fast * fast - slow * slow) / (2.0 * ramp);
+        long steps = 4L * ramp + 1000;
+        Ramp r;
+
+        rampPlan (&r, &p, LIMIT);
+        check (&time, fabs (r.ramped * 1e-6 / ((fast - slow) / accel) - 1),
+            min);
+
+        // The speed integrated over the plan, at the middle of each 10
+        // microseconds
+        rampPlan (&r, &p, steps);
+        double covered = 0;
+        for (long t = 5; t < r.stopped; t += 10)
+          covered += real (rampSpeed (&r, t)) * 1e-5;
+        check (&distance, fabs (covered / steps - 1), min);
+      }
+    }
+  }
+
+  report (&time);
+  report (&distance);
+}
+
+/**
+ * The shaped speed's lines come out as shapedSpeed has it to a thousandth,
+ * step by step through a move, for both shapers over a spread of ringing.
+ * A slope's rounding adds up over a second long line.
+ */
+void shaped () {
+  Check speed = { "shapedPlan speed", 1e-3 };
+  Params params = DEFAULT_PARAMS;
+
+  for (int shaper = SHAPER_ZV; shaper <= SHAPER_ZVD; shaper++) {
+    for (int frequency = 50; frequency <= 400; frequency += 70) {
+      for (int min = 30; min <= 300; min += 45) {
+        Profile p = { min, min + 600, 1500 };
+        Shaper s;
+        Ramp r;
+        Shaped plan;
+
+        params.shaper = shaper;
+        params.shaperFrequency = frequency;
+        params.shaperDamping = 20 + frequency / 5;
+        shaperPlan (&params, &s);
+        rampPlan (&r, &p, 6000);
+        shapedPlan (&plan, &s, &r);
+
+        for (long t = 0; t < r.stopped + s.delay[s.count - 1] + 1000;
+            t += 2 * shapedDelay (&plan, t)) {
+          double exact = real (shapedSpeed (&s, &r, t));
+          check (&speed, fabs (real (shapedAt (&plan, t)) - exact) / exact,
+              min);
+        }
+      }
+    }
+  }
+
+  report (&speed);
+}
+
+int main () {
+  arithmetic ();
+  functions ();
+  ramps ();
+  shaped ();
+  return failed;
+}
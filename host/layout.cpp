@@ -0,0 +1,122 @@
+/**
+ * Sparse bed benchmark.
+ *
+ * Times the parts laid out on the bed painted as one panel, the horizontal
+ * pattern over the rectangle that holds them all, and as sparse paints
+ * them, row by row over the parts only (see src/layout.h). It reports each
+ * one's cycle time and how long the guns are open, which is what the stain
+ * use goes by:
+ *
+ *   layout [-p set.params] [-r left:right:bottom:top ...]
+ *
+ * Without -r the parts are PART_BOUNDS.
+ */
+
+#include "sim.h"
+#include "params_io.h"
+
+#define MAX_PARTS     32
+
+typedef struct {
+  double gunTime;       // Seconds of each gun open, added up
+} Use;
+
+void usage () {
+  fprintf (stderr, "usage: layout [-p set.params] "
+      "[-r left:right:bottom:top ...]\n");
+  exit (2);
+}
+
+void useSample (void* ctx, const Sample* s, double dt) {
+  Use* use = (Use*)ctx;
+
+  if (s->sprays & SPRAY_TOP) use->gunTime += dt;
+  if (s->sprays & SPRAY_BOTTOM) use->gunTime += dt;
+}
+
+void report (const char* name, const SimResult* r, const Use* use) {
+  printf ("%-10s %8.1fs %9.1fs %9.1fs %6d\n", name, r->cycleTime,
+      r->sprayTime, use->gunTime, r->strokes);
+}
+
+int main (int argc, char** argv) {
+  static Machine m = DEFAULT_MACHINE;
+  static Params p = DEFAULT_PARAMS;
+  static Part parts[MAX_PARTS];
+  int n = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+
+    if (i + 1 >= argc) usage ();
+
+    if (!strcmp (a, "-p")) {
+      if (readParams (argv[++i], &p, &m)) {
+        perror (argv[i]);
+        return 2;
+      }
+    } else if (!strcmp (a, "-r")) {
+      Part* part = &parts[n];
+
+      if (n == MAX_PARTS) usage ();
+      if (sscanf (argv[++i], "%ld:%ld:%ld:%ld", &part->left, &part->right,
+            &part->bottom, &part->top) != 4 ||
+          part->left >= part->right || part->bottom >= part->top)
+        usage ();
+      n++;
+    } else {
+      usage ();
+    }
+  }
+
+  if (!n) {
+    partsBegin (parts);
+    n = PART_COUNT;
+  }
+
+  // The panel that holds them all
+  Params whole = p;
+  double area = 0;
+  for (int i = 0; i < n; i++) {
+    if (!i || parts[i].left < whole.panelLeft) whole.panelLeft = parts[i].left;
+    if (!i || parts[i].right > whole.panelRight)
+      whole.panelRight = parts[i].right;
+    if (!i || parts[i].bottom < whole.panelBottom)
+      whole.panelBottom = parts[i].bottom;
+    if (!i || parts[i].top > whole.panelTop) whole.panelTop = parts[i].top;
+    area += (double)(parts[i].right - parts[i].left) *
+      (parts[i].top - parts[i].bottom);
+
+    printf ("part %d: %ld-%ld steps, %ld-%ld counts\n", i, parts[i].left,
+        parts[i].right, parts[i].bottom, parts[i].top);
+  }
+
+  double span = (double)(whole.panelRight - whole.panelLeft) *
+    (whole.panelTop - whole.panelBottom);
+  printf ("the parts are %.0f%% of the %ld-%ld by %ld-%ld they span\n",
+      100.0 * area / span, whole.panelLeft, whole.panelRight,
+      whole.panelBottom, whole.panelTop);
+
+  SimResult full, sparse;
+  Use fullUse = { 0 }, sparseUse = { 0 };
+  Sim sim;
+
+  // One panel, as a coat is, from the bottom and left limits
+  simInit (&sim, &m, &whole, &full, useSample, &fullUse);
+  simGoUntil (&sim, DOWN, LIMIT);
+  simGoUntil (&sim, LEFT, LIMIT);
+  simDoStrokes (&sim, UP);
+  full.cycleTime = sim.s.t;
+
+  simulateLayout (&m, &p, parts, n, &sparse, useSample, &sparseUse);
+
+  printf ("%-10s %9s %10s %10s %6s\n", "", "cycle", "guns open",
+      "gun time", "rows");
+  report ("one panel", &full, &fullUse);
+  report ("sparse", &sparse, &sparseUse);
+  printf ("%.2fx the time, %.2fx the stain\n",
+      sparse.cycleTime / full.cycleTime,
+      sparseUse.gunTime / fullUse.gunTime);
+
+  return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef __MESSAGES_HDR__
+#define __MESSAGES_HDR__
+
+/**
+ * Maps the controller's timestamped text debug output onto the binary
+ * trace records, so both can be analyzed the same way.
+ */
+
+#include "trace.h"
+
+/**
+ * Parses a decimal number, advancing s.
+ */
+static inline int parseNumber (const char** s, const char* end,
+    uint32_t* out) {
+  const char* c = *s;
+  uint32_t n = 0;
+
+  if (c >= end || *c < '0' || *c > '9') return 0;
+  while (c < end && *c >= '0' && *c <= '9') n = n * 10 + (*c++ - '0');
+  *out = n;
+  *s = c;
+  return 1;
+}
+
+static inline int startsWith (const char* s, const char* end,
+    const char* prefix, size_t n) {
+  return (size_t)(end - s) >= n && !memcmp (s, prefix, n);
+}
+
+/**
+ * Debug messages and the trace records they stand for.
+ */
+typedef struct {
+  const char* text;
+  size_t length;
+  uint8_t kind;
+  uint8_t arg;
+} Message;
+
+#define MESSAGE(t, k, a) { t, sizeof (t) - 1, k, a }
+
+const Message messages[] = {
+  MESSAGE ("Turning on both sprays", TRACE_STROKE, 0),
+  MESSAGE ("Turning on the top spray", TRACE_STROKE, 0),
+  MESSAGE ("Turning on the bottom spray", TRACE_STROKE, 0),
+  MESSAGE ("Done spraying", TRACE_STROKE_END, 0),
+  MESSAGE ("Going ", TRACE_MOVE, 0),
+  MESSAGE ("Waiting for", TRACE_WAIT, WAIT_LIMIT),
+  MESSAGE ("Holding off the motor relays", TRACE_WAIT, WAIT_SWITCH),
+  MESSAGE ("Stopping", TRACE_FAULT, 0),
+  MESSAGE ("Starting a job", TRACE_JOB, 1),
+  MESSAGE ("Job done", TRACE_JOB, 0),
+  MESSAGE ("Done initializing", TRACE_BOOT, 0),
+  MESSAGE ("Limit ", TRACE_LIMIT, 0),
+};
+
+/**
+ * Parses one "<millis> <message>" line, without its newline, in place.
+ *
+ * @return 1 if the line stands for a trace record, written to e
+ */
+int parseLine (const char* s, const char* eol, TraceRecord* e) {
+  uint32_t time;
+  const char* c = s;
+
+  if (!parseNumber (&c, eol, &time) || c >= eol || *c != ' ') return 0;
+  c++;
+
+  for (size_t i = 0; i < sizeof (messages) / sizeof (messages[0]); i++) {
+    const Message* m = &messages[i];
+    if (!startsWith (c, eol, m->text, m->length)) continue;
+
+    e->time = time;
+    e->kind = m->kind;
+    e->arg = m->arg;
+    e->value = 0;
+
+    if (m->kind == TRACE_LIMIT) {
+      // "Limit <pin> bounced <n> times"
+      const char* d = c + m->length;
+      uint32_t pin, n;
+      if (!parseNumber (&d, eol, &pin) ||
+          !startsWith (d, eol, " bounced ", 9))
+        return 0;
+      d += 9;
+      if (!parseNumber (&d, eol, &n)) return 0;
+      e->arg = pin;
+      e->value = n;
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
+
+#endif
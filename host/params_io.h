@@ -0,0 +1,178 @@
+#ifndef __PARAMS_IO_HDR__
+#define __PARAMS_IO_HDR__
+
+/**
+ * Reading and writing parameter sets as "key = value" text files, and
+ * writing them as a tuned.h the firmware can be built with.
+ */
+
+#include <stdlib.h>
+#include "sim.h"
+
+typedef struct {
+  const char* key;
+  int* i;
+  long* l;
+  double* d;
+} ParamField;
+
+// The most fields paramFields lists, the size of the arrays it fills
+#define PARAM_FIELDS  64
+
+/**
+ * Lists the fields of a parameter block and a machine. Either may be null.
+ *
+ * @return the number of fields written to out, which holds PARAM_FIELDS
+ */
+int paramFields (Params* p, Machine* m, ParamField* out) {
+  int n = 0;
+
+  // A field past the end would overrun the caller's array, so raise
+  // PARAM_FIELDS instead
+#define FIELD(k, fi, fl, fd)  { if (n == PARAM_FIELDS) { \
+                                  fprintf (stderr, "More than %d parameter " \
+                                      "fields at %s\n", PARAM_FIELDS, k); \
+                                  exit (1); \
+                                } \
+                                out[n].key = k; out[n].i = fi; out[n].l = fl; \
+                                out[n].d = fd; n++; }
+#define INT_FIELD(k, f)     FIELD (k, &(f), 0, 0)
+#define LONG_FIELD(k, f)    FIELD (k, 0, &(f), 0)
+#define DOUBLE_FIELD(k, f)  FIELD (k, 0, 0, &(f))
+  if (p) {
+    INT_FIELD ("horizontal.min", p->horizontal.min);
+    INT_FIELD ("horizontal.max", p->horizontal.max);
+    INT_FIELD ("horizontal.stepsToStart", p->horizontal.stepsToStart);
+    INT_FIELD ("horizontalStrokeGap", p->horizontalStrokeGap);
+    INT_FIELD ("verticalStrokeGap", p->verticalStrokeGap);
+    INT_FIELD ("sprayMin", p->sprayMin);
+    INT_FIELD ("sprayMax", p->sprayMax);
+    INT_FIELD ("motorRest", p->motorRest);
+    INT_FIELD ("verticalFrequency", p->verticalFrequency);
+    INT_FIELD ("verticalRamp", p->verticalRamp);
+    INT_FIELD ("pidKp", p->pidKp);
+    INT_FIELD ("pidKi", p->pidKi);
+    INT_FIELD ("pidKd", p->pidKd);
+    INT_FIELD ("blend", p->blend);
+    INT_FIELD ("gunSettle", p->gunSettle);
+    LONG_FIELD ("panelLeft", p->panelLeft);
+    LONG_FIELD ("panelRight", p->panelRight);
+    LONG_FIELD ("panelBottom", p->panelBottom);
+    LONG_FIELD ("panelTop", p->panelTop);
+    INT_FIELD ("fanSteps", p->fanSteps);
+    INT_FIELD ("fanCounts", p->fanCounts);
+    INT_FIELD ("gunSteps", p->gunSteps);
+    INT_FIELD ("gunCounts", p->gunCounts);
+    INT_FIELD ("overlap", p->overlap);
+    INT_FIELD ("coats", p->coats);
+    for (int i = 0; i < STAINS; i++) {
+      static char keys[STAINS][16];
+      sprintf (keys[i], "dryTime.%d", i);
+      INT_FIELD (keys[i], p->dryTime[i]);
+    }
+    INT_FIELD ("shaper", p->shaper);
+    INT_FIELD ("shaperFrequency", p->shaperFrequency);
+    INT_FIELD ("shaperDamping", p->shaperDamping);
+  }
+  if (m) {
+    DOUBLE_FIELD ("machine.stepsPerMm", m->stepsPerMm);
+    DOUBLE_FIELD ("machine.countsPerMm", m->countsPerMm);
+    DOUBLE_FIELD ("machine.vfdSpeed", m->vfdSpeed);
+    DOUBLE_FIELD ("machine.stepOverhead", m->stepOverhead);
+    DOUBLE_FIELD ("machine.fanWidth", m->fanWidth);
+    DOUBLE_FIELD ("machine.maxSpeed", m->maxSpeed);
+    DOUBLE_FIELD ("machine.gunSpacing", m->gunSpacing);
+    DOUBLE_FIELD ("machine.sprayDepth", m->sprayDepth);
+    DOUBLE_FIELD ("machine.taper", m->taper);
+    DOUBLE_FIELD ("machine.resonance", m->resonance);
+    DOUBLE_FIELD ("machine.damping", m->damping);
+  }
+#undef FIELD
+#undef INT_FIELD
+#undef LONG_FIELD
+#undef DOUBLE_FIELD
+
+  return n;
+}
+
+/**
+ * Reads "key = value" lines into a parameter block and/or a machine.
+ * Blank lines and lines starting with # are skipped, as are unknown keys
+ * so one file can hold both.
+ *
+ * The machine extent is read as machine.width and machine.height.
+ *
+ * @return 0 on success, -1 if the file can't be read
+ */
+int readParams (const char* path, Params* p, Machine* m) {
+  FILE* f = fopen (path, "r");
+  char line[256], key[128];
+  double value;
+  ParamField fields[PARAM_FIELDS];
+  int n = paramFields (p, m, fields);
+
+  if (!f) return -1;
+
+  while (fgets (line, sizeof (line), f)) {
+    if (line[0] == '#') continue;
+    if (sscanf (line, " %127[^= ] = %lf", key, &value) != 2) continue;
+
+    if (m && !strcmp (key, "machine.width")) m->width = (long)value;
+    if (m && !strcmp (key, "machine.height")) m->height = (long)value;
+
+    for (int i = 0; i < n; i++) {
+      if (strcmp (key, fields[i].key)) continue;
+      if (fields[i].i) *fields[i].i = (int)value;
+      else if (fields[i].l) *fields[i].l = (long)value;
+      else *fields[i].d = value;
+    }
+  }
+
+  fclose (f);
+  return 0;
+}
+
+/**
+ * Writes a parameter block as "key = value" lines.
+ */
+void writeParams (FILE* f, Params* p) {
+  ParamField fields[PARAM_FIELDS];
+  int n = paramFields (p, 0, fields);
+
+  for (int i = 0; i < n; i++)
+    if (fields[i].i) fprintf (f, "%s = %d\n", fields[i].key, *fields[i].i);
+    else fprintf (f, "%s = %ld\n", fields[i].key, *fields[i].l);
+}
+
+/**
+ * Writes a parameter block as a tuned.h for src/params.h.
+ */
+void writeHeader (FILE* f, const Params* p, const char* comment) {
+  fprintf (f, "#ifndef __TUNED_HDR__\n#define __TUNED_HDR__\n\n");
+  fprintf (f, "// %s\n", comment);
+  fprintf (f, "#define TUNED_PARAMS { \\\n");
+  fprintf (f, "  { %d, %d, %d }, \\\n", p->horizontal.min, p->horizontal.max,
+      p->horizontal.stepsToStart);
+  fprintf (f, "  %d, \\\n  %d, \\\n", p->horizontalStrokeGap,
+      p->verticalStrokeGap);
+  fprintf (f, "  %d, \\\n  %d, \\\n", p->sprayMin, p->sprayMax);
+  fprintf (f, "  %d, \\\n", p->motorRest);
+  fprintf (f, "  %d, \\\n  %d, \\\n", p->verticalFrequency,
+      p->verticalRamp);
+  fprintf (f, "  %d, \\\n  %d, \\\n  %d, \\\n", p->pidKp, p->pidKi,
+      p->pidKd);
+  fprintf (f, "  %d, \\\n  %d, \\\n", p->blend, p->gunSettle);
+  fprintf (f, "  %ld, \\\n  %ld, \\\n  %ld, \\\n  %ld, \\\n",
+      p->panelLeft, p->panelRight, p->panelBottom, p->panelTop);
+  fprintf (f, "  %d, \\\n  %d, \\\n", p->fanSteps, p->fanCounts);
+  fprintf (f, "  %d, \\\n  %d, \\\n", p->gunSteps, p->gunCounts);
+  fprintf (f, "  %d, \\\n  %d, \\\n", p->overlap, p->coats);
+  fprintf (f, "  {");
+  for (int i = 0; i < STAINS; i++)
+    fprintf (f, "%s %d", i ? "," : "", p->dryTime[i]);
+  fprintf (f, " }, \\\n");
+  fprintf (f, "  %d, \\\n  %d, \\\n  %d }\n\n#endif\n", p->shaper,
+      p->shaperFrequency, p->shaperDamping);
+}
+
+#endif
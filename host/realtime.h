@@ -0,0 +1,87 @@
+#ifndef __REALTIME_HDR__
+#define __REALTIME_HDR__
+
+/**
+ * The Arduino core on the host's own clock, for tools that run firmware
+ * modules against real devices. Serial goes to stdout and Serial1 can be
+ * attached to a serial port or pty with serialOpen. There are no pins.
+ */
+
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+volatile uint8_t MCUSR;
+
+unsigned long micros () {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+unsigned long millis () {
+  return micros () / 1000;
+}
+
+void delay (unsigned long ms) {
+  usleep (ms * 1000);
+}
+
+void delayMicroseconds (unsigned int us) {
+  usleep (us);
+}
+
+void pinMode (uint8_t pin, uint8_t mode) {}
+int digitalRead (uint8_t pin) { return LOW; }
+void digitalWrite (uint8_t pin, uint8_t level) {}
+
+void fdWrite (void* ctx, const uint8_t* data, size_t n) {
+  if (write ((int)(intptr_t)ctx, data, n) < 0) perror ("write");
+}
+
+int fdRead (void* ctx) {
+  uint8_t c;
+  return read ((int)(intptr_t)ctx, &c, 1) == 1 ? c : -1;
+}
+
+speed_t toSpeed (long rate) {
+  switch (rate) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    default: return B0;
+  }
+}
+
+/**
+ * Opens a serial device raw and non-blocking behind a port.
+ *
+ * @return whether it could be opened
+ */
+int serialOpen (HardwareSerial* port, const char* path, long baud) {
+  struct termios t;
+  int fd = open (path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+  if (fd < 0) return 0;
+  if (!tcgetattr (fd, &t)) {
+    cfmakeraw (&t);
+    cfsetispeed (&t, toSpeed (baud));
+    cfsetospeed (&t, toSpeed (baud));
+    t.c_cflag |= CLOCAL | CREAD;
+    tcsetattr (fd, TCSANOW, &t);
+  }
+
+  port->sink = fdWrite;
+  port->source = fdRead;
+  port->ctx = (void*)(intptr_t)fd;
+  return 1;
+}
+
+#endif
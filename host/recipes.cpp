@@ -0,0 +1,109 @@
+/**
+ * Recipe table writer.
+ *
+ * Takes a parameter set for each product and writes the recipe table the
+ * firmware reads from its EEPROM (see src/recipes.h) as an Intel HEX file,
+ * to upload without touching the program:
+ *
+ *   recipes [-s selected] -o table.eep first.params second.params ...
+ *   avrdude -p m2560 -c wiring -P port -U eeprom:w:table.eep:i
+ *
+ * Recipes are numbered from 1 in the order given, -s picks the one loaded
+ * at power on.
+ */
+
+#include "realtime.h"
+#include "params_io.h"
+#include "recipes.h"
+
+// debug.h's Stop turns the machine off, there's none here
+void turnOffAll () {}
+
+static_assert (sizeof (RecipeTable) == 4 && sizeof (Recipe) == 32,
+    "The recipe table isn't laid out as on the Mega");
+
+void usage () {
+  fprintf (stderr, "usage: recipes [-s selected] -o table.eep "
+      "set.params ...\n");
+  exit (2);
+}
+
+/**
+ * Writes bytes as Intel HEX data records from address, and the end record.
+ */
+void writeHex (FILE* f, const uint8_t* bytes, int n, int address) {
+  for (int i = 0; i < n; i += 16) {
+    int length = n - i < 16 ? n - i : 16;
+    int at = address + i;
+    uint8_t sum = length + (at >> 8) + at;
+
+    fprintf (f, ":%02X%04X00", length, at);
+    for (int j = 0; j < length; j++) {
+      fprintf (f, "%02X", bytes[i + j]);
+      sum += bytes[i + j];
+    }
+    fprintf (f, "%02X\n", (uint8_t)-sum);
+  }
+  fprintf (f, ":00000001FF\n");
+}
+
+int main (int argc, char** argv) {
+  const char* out = 0;
+  int selected = 1;
+  int count = 0;
+  static uint8_t image[EEPROM_SIZE];
+  RecipeTable table;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+
+    if (a[0] != '-') {
+      static Params p = DEFAULT_PARAMS;
+      Params q = p;
+      Recipe r;
+
+      if (count == RECIPES) {
+        fprintf (stderr, "The table holds %d recipes\n", RECIPES);
+        return 2;
+      }
+      if (readParams (a, &q, 0)) {
+        perror (a);
+        return 2;
+      }
+      recipeFrom (&r, &q);
+      memcpy (image + sizeof (table) + count * sizeof (r), &r, sizeof (r));
+
+      printf ("%2d %-24s gaps %d/%d, both guns %d-%d, panel %ld,%ld-%ld,%ld\n",
+          ++count, a, q.horizontalStrokeGap, q.verticalStrokeGap,
+          q.sprayMin, q.sprayMax, q.panelLeft, q.panelBottom, q.panelRight,
+          q.panelTop);
+    } else if (i + 1 >= argc) {
+      usage ();
+    } else if (!strcmp (a, "-o")) {
+      out = argv[++i];
+    } else if (!strcmp (a, "-s")) {
+      selected = atoi (argv[++i]);
+    } else {
+      usage ();
+    }
+  }
+
+  if (!out || !count) usage ();
+  if (selected < 1 || selected > count) usage ();
+
+  table.magic = RECIPE_MAGIC;
+  table.count = count;
+  table.selected = selected - 1;
+  memcpy (image, &table, sizeof (table));
+
+  FILE* f = fopen (out, "w");
+  if (!f) {
+    perror (out);
+    return 1;
+  }
+  writeHex (f, image, sizeof (table) + count * sizeof (Recipe),
+      RECIPE_ADDRESS);
+  fclose (f);
+
+  return 0;
+}
@@ -0,0 +1,258 @@
+/**
+ * Replays a record mode capture through the current firmware.
+ *
+ * Takes the input changes captured from a board built with __record__,
+ * feeds them at their recorded times to WoodStain.ino running on a virtual
+ * board and compares what it does with what the board did: job times and
+ * the outputs it changed.
+ *
+ *   replay [-s boot] [-o trace] capture
+ *
+ * A capture may hold several boots; -s picks one, the first by default.
+ * -o writes the replayed trace, which host/tracestat reads like any other.
+ * Exits with 1 when the outputs diverge from the capture.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "board.h"
+
+#include "WoodStain.ino"
+
+typedef std::vector<TraceRecord> Trace;
+
+typedef struct {
+  uint32_t time;
+  uint8_t pin;
+  uint8_t level;
+} Change;
+
+/**
+ * What a trace says the firmware did.
+ */
+typedef struct {
+  std::vector<uint32_t> jobs;     // Job durations in milliseconds
+  std::vector<Change> outputs;
+  uint32_t last;
+} Run;
+
+void collect (void* ctx, const uint8_t* data, size_t n) {
+  std::vector<uint8_t>* out = (std::vector<uint8_t>*)ctx;
+  out->insert (out->end (), data, data + n);
+}
+
+/**
+ * Splits a capture into its boots.
+ */
+std::vector<Trace> readCapture (const char* path) {
+  std::vector<Trace> boots;
+  struct stat st;
+  int fd = open (path, O_RDONLY);
+
+  if (fd < 0 || fstat (fd, &st)) {
+    perror (path);
+    exit (1);
+  }
+  size_t size = st.st_size - st.st_size % sizeof (TraceRecord);
+  const TraceRecord* r = (const TraceRecord*)mmap (0, size ? size : 1,
+      PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  for (size_t i = 0; i < size / sizeof (TraceRecord); i++) {
+    if (r[i].kind == TRACE_BOOT && r[i].time == TRACE_MAGIC) {
+      if (r[i].arg != TRACE_VERSION)
+        fprintf (stderr, "Boot %zu is trace version %d, not %d\n",
+            boots.size (), r[i].arg, TRACE_VERSION);
+      boots.push_back (Trace ());
+    } else if (!boots.empty () && r[i].kind != TRACE_FLIGHT &&
+        !(r[i].kind & TRACE_DUMPED)) {
+      // Leaving out the flight recorder's dump from before the reset
+      boots.back ().push_back (r[i]);
+    }
+  }
+
+  return boots;
+}
+
+Run summarize (const Trace& t) {
+  Run run;
+  uint32_t start = 0;
+  int running = 0;
+
+  run.last = 0;
+  for (size_t i = 0; i < t.size (); i++) {
+    const TraceRecord* e = &t[i];
+    run.last = std::max (run.last, e->time);
+
+    if (e->kind == TRACE_JOB && e->arg) {
+      start = e->time;
+      running = 1;
+    } else if (e->kind == TRACE_JOB && running) {
+      run.jobs.push_back (e->time - start);
+      running = 0;
+    } else if (e->kind == TRACE_OUTPUT) {
+      Change c = { e->time, e->arg, (uint8_t)e->value };
+      run.outputs.push_back (c);
+    }
+  }
+
+  return run;
+}
+
+/**
+ * Runs the firmware against the inputs of a capture until the capture
+ * runs out.
+ */
+Trace replay (const Trace& capture) {
+  std::vector<Edge> inputs;
+  std::vector<uint8_t> out;
+  uint8_t seen[BOARD_PINS] = { 0 };
+  uint32_t last = 0;
+
+  for (size_t i = 0; i < capture.size (); i++) {
+    const TraceRecord* e = &capture[i];
+    last = std::max (last, e->time);
+    if (e->kind != TRACE_INPUT || e->arg >= BOARD_PINS) continue;
+
+    // A pin was at its first recorded level since the reset
+    Edge edge = { seen[e->arg]++ ? (uint64_t)e->time * 1000 : 0, e->arg,
+      (uint8_t)(e->value != LOW) };
+    inputs.push_back (edge);
+  }
+  std::stable_sort (inputs.begin (), inputs.end (),
+      [] (const Edge& a, const Edge& b) { return a.time < b.time; });
+
+  // Records are to the millisecond, run to the end of the last one
+  boardReset (inputs.data (), inputs.size (), ((uint64_t)last + 1) * 1000);
+  Serial.sink = collect;
+  Serial.ctx = &out;
+
+  if (!setjmp (board.done)) {
+    setup ();
+    for (;;) loop ();
+  }
+
+  // Skip the boot record the firmware wrote, like readCapture does
+  Trace t;
+  size_t n = out.size () / sizeof (TraceRecord);
+  for (size_t i = 0; i < n; i++) {
+    TraceRecord r;
+    memcpy (&r, &out[i * sizeof (r)], sizeof (r));
+    if (r.kind != TRACE_BOOT) t.push_back (r);
+  }
+  return t;
+}
+
+void writeTrace (const char* path, const Trace& t) {
+  TraceRecord boot = { TRACE_MAGIC, TRACE_BOOT, TRACE_VERSION, 0 };
+  FILE* f = fopen (path, "wb");
+
+  if (!f) {
+    perror (path);
+    exit (1);
+  }
+  fwrite (&boot, sizeof (boot), 1, f);
+  fwrite (t.data (), sizeof (TraceRecord), t.size (), f);
+  fclose (f);
+}
+
+/**
+ * Compares job times and outputs.
+ *
+ * @return whether the outputs match
+ */
+int compare (const Run& a, const Run& b) {
+  size_t jobs = std::max (a.jobs.size (), b.jobs.size ());
+  double total[2] = { 0, 0 };
+
+  printf ("%-5s %10s %10s %9s\n", "job", "capture", "replay", "diff");
+  for (size_t i = 0; i < jobs; i++) {
+    printf ("%-5zu", i + 1);
+    if (i < a.jobs.size ()) printf (" %9.2fs", a.jobs[i] / 1000.0);
+    else printf (" %10s", "-");
+    if (i < b.jobs.size ()) printf (" %9.2fs", b.jobs[i] / 1000.0);
+    else printf (" %10s", "-");
+    if (i < a.jobs.size () && i < b.jobs.size ()) {
+      total[0] += a.jobs[i] / 1000.0;
+      total[1] += b.jobs[i] / 1000.0;
+      printf (" %+8.2fs", ((double)b.jobs[i] - a.jobs[i]) / 1000.0);
+    }
+    printf ("\n");
+  }
+  if (total[0] > 0)
+    printf ("%-5s %9.2fs %9.2fs %+8.2fs (%+.1f%%)\n", "total", total[0],
+        total[1], total[1] - total[0], 100 * (total[1] / total[0] - 1));
+
+  size_t n = std::min (a.outputs.size (), b.outputs.size ());
+  size_t same = 0;
+  double sum = 0, most = 0;
+  for (; same < n; same++) {
+    const Change* x = &a.outputs[same];
+    const Change* y = &b.outputs[same];
+    if (x->pin != y->pin || x->level != y->level) break;
+
+    double d = (double)y->time - x->time;
+    sum += d;
+    if (fabs (d) > fabs (most)) most = d;
+  }
+
+  printf ("\n%zu of %zu output changes match", same, a.outputs.size ());
+  if (same) printf (", off by %+.1f ms on average, %+.0f ms at most",
+      sum / same, most);
+  printf ("\n");
+
+  if (same < a.outputs.size () || same < b.outputs.size ()) {
+    printf ("First difference at change %zu:\n", same + 1);
+    if (same < a.outputs.size ())
+      printf ("  capture pin %d -> %d at %.3fs\n", a.outputs[same].pin,
+          a.outputs[same].level, a.outputs[same].time / 1000.0);
+    if (same < b.outputs.size ())
+      printf ("  replay  pin %d -> %d at %.3fs\n", b.outputs[same].pin,
+          b.outputs[same].level, b.outputs[same].time / 1000.0);
+    return 0;
+  }
+
+  return 1;
+}
+
+int main (int argc, char** argv) {
+  const char* output = 0;
+  size_t boot = 0;
+  int i = 1;
+
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (!strcmp (argv[i], "-s")) boot = atoi (argv[i + 1]);
+    else if (!strcmp (argv[i], "-o")) output = argv[i + 1];
+  }
+  if (i != argc - 1) {
+    fprintf (stderr, "usage: replay [-s boot] [-o trace] capture\n");
+    return 2;
+  }
+
+  std::vector<Trace> boots = readCapture (argv[i]);
+  if (boot >= boots.size ()) {
+    fprintf (stderr, "%s has %zu boots\n", argv[i], boots.size ());
+    return 2;
+  }
+
+  const Trace& capture = boots[boot];
+  Trace replayed = replay (capture);
+  if (output) writeTrace (output, replayed);
+
+  Run a = summarize (capture);
+  Run b = summarize (replayed);
+  printf ("capture: %zu jobs, %zu output changes over %.1fs\n",
+      a.jobs.size (), a.outputs.size (), a.last / 1000.0);
+  printf ("replay:  %zu jobs, %zu output changes over %.1fs\n\n",
+      b.jobs.size (), b.outputs.size (), b.last / 1000.0);
+
+  return compare (a, b) ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+/**
+ * Carriage ringing model, for tuning the input shaper.
+ *
+ * Runs a stroke from limit to limit and a transition on the simulated
+ * stepper and puts the steps through the gun mount, modelled as a damped
+ * spring on the carriage ringing at machine.resonance Hz with a damping
+ * ratio of machine.damping. It reports how far the guns swing about the
+ * carriage once it's at speed, which shows as streaks, and once it has
+ * stopped, which has to settle before the next stroke:
+ *
+ *   ringing [-p set.params] [--ramp lo:hi:step] [--frequency lo:hi:step]
+ *
+ * Each ramp, in stepsToStart, is run unshaped and with ZV and ZVD at each
+ * shaper frequency, in tenths of a Hz, params.shaperFrequency by default.
+ * Set the machine's resonance off from the shaper's to see how much that
+ * costs.
+ */
+
+#include "sim.h"
+#include "params_io.h"
+
+typedef struct {
+  double omega;         // The mount's, in radians a second
+  double zeta;
+  double stepsPerMm;
+  double e;             // The guns less the carriage, in steps
+  double de;
+  double speed;         // The carriage's, in steps a second
+  double top;           // Its cruise
+  double cruise;        // The most e swung at the cruise
+  double residual;      // and once stopped
+  int started;
+  int pending;          // An interval waiting for the next one's position
+  Sample last;
+  double lastDt;
+} Mount;
+
+typedef struct {
+  int lo;
+  int hi;
+  int step;
+} Range;
+
+void usage () {
+  fprintf (stderr, "usage: ringing [-p set.params] [--ramp lo:hi:step] "
+      "[--frequency lo:hi:step]\n");
+  exit (2);
+}
+
+/**
+ * Runs the mount through dt seconds with the carriage at speed.
+ */
+void mountRun (Mount* m, double speed, double dt) {
+  double h = 1e-5;
+  int n = (int)ceil (dt / h);
+
+  // The carriage's change of speed is a kick to the guns
+  m->de -= speed - m->speed;
+  m->speed = speed;
+  if (speed > 0) m->started = 1;
+
+  h = dt / n;
+  for (int i = 0; i < n; i++) {
+    m->de -= (m->omega * m->omega * m->e + 2 * m->zeta * m->omega * m->de) * h;
+    m->e += m->de * h;
+
+    double swing = fabs (m->e) / m->stepsPerMm;
+    if (speed >= 0.999 * m->top && swing > m->cruise)
+      m->cruise = swing;
+    if (speed == 0 && m->started && swing > m->residual)
+      m->residual = swing;
+  }
+}
+
+/**
+ * Takes the carriage's position, and runs the interval before it at the
+ * speed that got it there.
+ */
+void mountSample (void* ctx, const Sample* s, double dt) {
+  Mount* m = (Mount*)ctx;
+
+  if (m->pending && m->lastDt > 0)
+    mountRun (m, fabs (s->x - m->last.x) / m->lastDt, m->lastDt);
+  m->last = *s;
+  m->lastDt = dt;
+  m->pending = 1;
+}
+
+void mountFlush (Mount* m) {
+  if (m->pending && m->lastDt > 0) mountRun (m, 0, m->lastDt);
+  m->pending = 0;
+}
+
+/**
+ * Runs a move on a fresh mount.
+ */
+void measure (const Machine* machine, const Params* p, int direction,
+    int steps, Mount* m, double* time) {
+  Sim sim;
+  SimResult r;
+
+  memset (m, 0, sizeof (*m));
+  m->omega = 2 * M_PI * machine->resonance;
+  m->zeta = machine->damping;
+  m->stepsPerMm = machine->stepsPerMm;
+  m->top = 1.0 / (2e-6 * p->horizontal.min + machine->stepOverhead * 1e-6);
+
+  simInit (&sim, machine, p, &r, mountSample, m);
+  sim.s.x = direction == RIGHT ? 0 : machine->width;
+  sim.travel = machine->width;
+
+  double start = sim.s.t;
+  simGoUntil (&sim, direction, steps);
+  *time = sim.s.t - start;
+
+  // The rest before the next move is when the residual shows
+  simWait (&sim, 1.0);
+  mountFlush (m);
+}
+
+int parseRange (const char* s, Range* r) {
+  return sscanf (s, "%d:%d:%d", &r->lo, &r->hi, &r->step) == 3 &&
+    r->step > 0 && r->lo <= r->hi ? 0 : -1;
+}
+
+int main (int argc, char** argv) {
+  static Machine m = DEFAULT_MACHINE;
+  static Params p = DEFAULT_PARAMS;
+  Range ramp = { 0, 0, 1 }, frequency = { 0, 0, 1 };
+  int rampGiven = 0, frequencyGiven = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+
+    if (i + 1 >= argc) usage ();
+
+    if (!strcmp (a, "-p")) {
+      if (readParams (argv[++i], &p, &m)) {
+        perror (argv[i]);
+        return 2;
+      }
+    } else if (!strcmp (a, "--ramp")) {
+      if (parseRange (argv[++i], &ramp)) usage ();
+      rampGiven = 1;
+    } else if (!strcmp (a, "--frequency")) {
+      if (parseRange (argv[++i], &frequency)) usage ();
+      frequencyGiven = 1;
+    } else {
+      usage ();
+    }
+  }
+
+  if (!rampGiven) ramp.lo = ramp.hi = p.horizontal.stepsToStart;
+  if (!frequencyGiven) frequency.lo = frequency.hi = p.shaperFrequency;
+
+  printf ("mount at %.1f Hz, damping %.3f\n", m.resonance, m.damping);
+  printf ("%6s %-4s %6s %9s %9s %9s %9s %9s\n", "ramp", "", "Hz",
+      "stroke s", "cruise mm", "stop mm", "move s", "stop mm");
+
+  for (int r = ramp.lo; r <= ramp.hi; r += ramp.step) {
+    static const char* names[] = { "off", "ZV", "ZVD" };
+
+    for (int shaper = SHAPER_OFF; shaper <= SHAPER_ZVD; shaper++) {
+      for (int f = frequency.lo; f <= frequency.hi; f += frequency.step) {
+        Params q = p;
+        Mount stroke, move;
+        double strokeTime, moveTime;
+
+        q.horizontal.stepsToStart = r;
+        q.shaper = shaper;
+        q.shaperFrequency = f;
+
+        measure (&m, &q, RIGHT, LIMIT, &stroke, &strokeTime);
+        measure (&m, &q, LEFT, q.horizontalStrokeGap, &move, &moveTime);
+
+        printf ("%6d %-4s %6.1f %9.2f %9.3f %9.3f %9.2f %9.3f\n", r,
+            names[shaper], shaper ? f / 10.0 : 0.0, strokeTime,
+            stroke.cruise, stroke.residual, moveTime, move.residual);
+
+        if (shaper == SHAPER_OFF) break;
+      }
+    }
+  }
+
+  return 0;
+}
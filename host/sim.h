@@ -0,0 +1,642 @@
+#ifndef __SIM_HDR__
+#define __SIM_HDR__
+
+/**
+ * A time model of the WoodStain job.
+ *
+ * The functions here mirror goUntil, stroke, transition and doStrokes step
+ * for step, including every debounce and rest delay, so the cycle time of a
+ * parameter set can be computed without running the machine. A blended
+ * stroke's tail is moved in one piece when the guns close and its time
+ * overlapped with the transition's.
+ */
+
+#include <math.h>
+#include "Arduino.h"
+#include "params.h"
+#include "overtravel.h"
+#include "spacing.h"
+#include "segments.h"
+#include "shaper.h"
+#include "layout.h"
+
+/**
+ * The physical machine the job is simulated on.
+ */
+typedef struct {
+  long width;           // Steps between the left and right limit switches
+  long height;          // Encoder counts between the bottom and top limits
+  double stepsPerMm;
+  double countsPerMm;
+  double vfdSpeed;      // Encoder counts per second at VFD_MAX_FREQUENCY
+  double stepOverhead;  // Microseconds a step adds to its delays, 0 if timed
+  double fanWidth;      // Millimetres one gun covers across its stroke
+  double maxSpeed;      // Fastest mm/s that still lays a full wet coat
+  double gunSpacing;    // Millimetres between the top and bottom guns
+  double sprayDepth;    // Millimetres of the fan along the stroke
+  double taper;         // Fraction of the fan width that tapers off
+  double resonance;     // Hz the carriage and gun mount ring at
+  double damping;       // and the ringing's damping ratio
+} Machine;
+
+#define DEFAULT_MACHINE { 40000, 40000, 20.0, 20.0, 4000.0, 0.0, \
+  200.0, 500.0, 300.0, 30.0, 0.3, 15.0, 0.05 }
+
+/**
+ * The state of the carriage over one interval of simulated time.
+ * x is in steps from the left limit and y in counts from the bottom limit.
+ * axis is the stroke axis the gun holder is turned for.
+ */
+typedef struct {
+  double t;
+  double x;
+  double y;
+  int sprays;
+  int axis;
+} Sample;
+
+#define SPRAY_TOP     1
+#define SPRAY_BOTTOM  2
+
+/**
+ * Called for every interval the carriage spends in a state, dt in seconds.
+ */
+typedef void (*SampleFn) (void* ctx, const Sample* s, double dt);
+
+typedef struct {
+  double cycleTime;     // Seconds for the whole job
+  double sprayTime;     // Seconds with at least one gun open
+  double cruiseSpeed;   // mm/s of the horizontal strokes once ramped up
+  double rampLength;    // mm of each horizontal stroke spent ramping
+  int strokes;
+} SimResult;
+
+typedef struct {
+  const Machine* m;
+  const Params* p;
+  Sample s;
+  SimResult* r;
+  SampleFn fn;
+  void* ctx;
+  int strokeCount[2];
+  int lastVertical;     // The last vertical direction, or -1
+  double relayOpened;   // When its relay opened
+  long travel;          // Steps of the last horizontal run from limit to limit
+  int blending;         // A blended stroke's move is running
+  int braked;           // and it has started slowing into its limit
+  double tail;          // Seconds of it left to run beside the transition
+  int gunAxis;          // The strokes the gun holder is turned for
+  double gunSettled;    // When it stops swinging
+  int planned;          // The stroke under way opens its guns over window
+  Window window;
+  int zone;             // The guns it opens
+  int cruising;         // Not speeding up or slowing down
+  int sprayMin;         // The pattern's first and last strokes with both
+  int sprayMax;         // guns
+  int sprays;           // A toolpath stroke's guns, or 0 to zone them
+  const Layout* layout; // A sparse bed's rows
+  const Part* parts;
+  int partCount;
+  int onRow;            // The row under way opens its guns over its parts
+  long row;             // Where it is
+} Sim;
+
+/**
+ * Advances the simulation by dt seconds without moving.
+ */
+void simWait (Sim* sim, double dt) {
+  if (sim->fn) sim->fn (sim->ctx, &sim->s, dt);
+  if (sim->s.sprays) sim->r->sprayTime += dt;
+  sim->s.t += dt;
+}
+
+/**
+ * Moves by dx/dy over dt seconds.
+ */
+void simMove (Sim* sim, double dx, double dy, double dt) {
+  if (sim->planned) {
+    long at = (long)(sim->s.axis == HORIZONTAL ? sim->s.x : sim->s.y);
+    sim->s.sprays = sim->cruising && inWindow (&sim->window, at) ?
+      sim->zone : 0;
+  } else if (sim->onRow) {
+    sim->s.sprays = rowSprays (sim->p, sim->layout, sim->parts,
+        sim->partCount, sim->row, (long)sim->s.x);
+  }
+
+  if (sim->fn) sim->fn (sim->ctx, &sim->s, dt);
+  if (sim->s.sprays) sim->r->sprayTime += dt;
+  sim->s.t += dt;
+  sim->s.x += dx;
+  sim->s.y += dy;
+}
+
+int simAtLimit (Sim* sim, int direction) {
+  switch (direction) {
+    case LEFT:  return sim->s.x <= 0;
+    case RIGHT: return sim->s.x >= sim->m->width;
+    case DOWN:  return sim->s.y <= 0;
+    default:    return sim->s.y >= sim->m->height;
+  }
+}
+
+/**
+ * goUntil for the stepper, shaped: each step as long as the shaped speed
+ * says at its start, by the plan's clock. Blended, once it starts slowing
+ * into its limit the rest of the run is left in sim->tail.
+ */
+void simShaped (Sim* sim, int direction, long steps) {
+  double sign = direction == LEFT ? -1.0 : 1.0;
+  double overhead = sim->m->stepOverhead * 1e-6;
+  long room = (long)(direction == LEFT ? sim->s.x : sim->m->width - sim->s.x);
+  int fromEnd = steps == LIMIT && room >= sim->m->width;
+  long left = steps != LIMIT && steps + 1 < room ? steps + 1 : room;
+  long t = 0;               // Microseconds into the plan
+  Shaper shaper;
+  Ramp ramp;
+  Shaped shaped;
+
+  shaperPlan (sim->p, &shaper);
+  rampPlan (&ramp, &sim->p->horizontal, steps != LIMIT ? steps + 1L :
+      fromEnd && sim->travel ? sim->travel : LIMIT);
+  shapedPlan (&shaped, &shaper, &ramp);
+  sim->cruising = 1;
+
+  for (long i = 0; i < left; i++) {
+    long delay = shapedDelay (&shaped, t);
+
+    if (t >= ramp.slowing && sim->blending) {
+      // The guns close here and the rest runs beside the transition
+      double rest = 0;
+
+      for (long j = i; j < left; j++) {
+        delay = shapedDelay (&shaped, t);
+        rest += 2e-6 * delay + overhead;
+        t += 2 * delay;
+      }
+      simMove (sim, sign * (left - i), 0, 0);
+      if (fromEnd) sim->travel = room;
+      sim->braked = 1;
+      sim->tail += rest + DEBOUNCE_TIME * 1e-3;
+      return;
+    }
+
+    simMove (sim, sign, 0, 2e-6 * delay + overhead);
+    t += 2 * delay;
+  }
+  if (fromEnd) sim->travel = room;
+
+  if (!sim->p->blend) simWait (sim, sim->p->motorRest * 1e-3);
+  simWait (sim, DEBOUNCE_TIME * 1e-3);
+}
+
+/**
+ * goUntil for the stepper: ramp from max to min delay over stepsToStart
+ * steps then cruise until the limit or the step count. Blended, a run from
+ * limit to limit slows down again over the last stepsToStart steps once
+ * the distance is known.
+ */
+void simHorizontal (Sim* sim, int direction, long steps) {
+  const Profile* p = &sim->p->horizontal;
+  double sign = direction == LEFT ? -1.0 : 1.0;
+  double decrement = (double)(p->max - p->min) / (double)p->stepsToStart;
+  double delay = p->max;
+  double overhead = sim->m->stepOverhead * 1e-6;
+  long room = (long)(direction == LEFT ? sim->s.x : sim->m->width - sim->s.x);
+  long ramp = p->stepsToStart < room ? p->stepsToStart : room;
+  int fromEnd = steps == LIMIT && room >= sim->m->width;
+  // A row's guns open and close along it, so it goes a step at a time
+  int stepwise = sim->fn || sim->onRow;
+
+  if (sim->p->shaper) {
+    simShaped (sim, direction, steps);
+    return;
+  }
+
+  // The window starts past the ramp
+  sim->cruising = 1;
+
+  if (steps != LIMIT && steps + 1 < ramp) ramp = steps + 1;
+
+  if (stepwise) {
+    for (long i = 0; i < ramp; i++) {
+      simMove (sim, sign, 0, 2e-6 * delay + overhead);
+      delay = delay - decrement >= p->min ? delay - decrement : p->min;
+    }
+  } else if (ramp > 0) {
+    // The delays fall linearly so the ramp is an arithmetic series
+    double sum = ramp * delay - decrement * ramp * (ramp - 1) / 2.0;
+    simMove (sim, sign * ramp, 0, 2e-6 * sum + overhead * ramp);
+    delay -= decrement * ramp;
+    if (delay < p->min) delay = p->min;
+  }
+  long stepsSoFar = ramp;
+
+  double period = 2e-6 * delay + overhead;
+  long left = (long)(direction == LEFT ? sim->s.x : sim->m->width - sim->s.x);
+  if (steps != LIMIT && steps + 1 - stepsSoFar < left)
+    left = steps + 1 - stepsSoFar;
+
+  long brake = 0;
+  if (sim->p->blend && fromEnd && sim->travel) {
+    long cruise = sim->travel - p->stepsToStart - stepsSoFar;
+    brake = left - (cruise > 0 ? cruise : 0);
+    if (brake < 0) brake = 0;
+    left -= brake;
+  }
+
+  if (stepwise) {
+    for (long i = 0; i < left; i++) simMove (sim, sign, 0, period);
+  } else if (left > 0) {
+    simMove (sim, sign * left, 0, period * left);
+  }
+
+  double braking = 0;
+  for (long i = 0; i < brake; i++) {
+    if (delay + decrement <= p->max) delay += decrement;
+    braking += 2e-6 * delay + overhead;
+  }
+  if (fromEnd) sim->travel = room;
+
+  if (brake && sim->blending) {
+    // The guns close here and the rest runs beside the transition
+    simMove (sim, sign * brake, 0, 0);
+    sim->braked = 1;
+    sim->tail += braking + DEBOUNCE_TIME * 1e-3;
+    return;
+  }
+  simMove (sim, sign * brake, 0, braking);
+
+  if (!sim->p->blend) simWait (sim, sim->p->motorRest * 1e-3);
+  simWait (sim, DEBOUNCE_TIME * 1e-3);
+}
+
+/**
+ * Moves vertically at constant acceleration for dt seconds starting at
+ * speed v. Sampled every millisecond if anyone is listening.
+ */
+void simRamp (Sim* sim, double sign, double v, double accel, double dt) {
+  int n = sim->fn ? (int)ceil (dt / 1e-3) : 1;
+  double piece = dt / n;
+
+  sim->cruising = accel == 0;
+
+  for (int i = 0; i < n; i++) {
+    simMove (sim, 0, sign * (v * piece + 0.5 * accel * piece * piece), piece);
+    v += accel * piece;
+  }
+}
+
+/**
+ * goUntilVertical: runs to a limit at full speed, or brakes onto an
+ * encoder count under the position loop, then waits for the encoder to
+ * stop.
+ */
+void simVertical (Sim* sim, int direction, long steps) {
+  const Machine* m = sim->m;
+  double sign = direction == DOWN ? -1.0 : 1.0;
+  // Rounding can leave the carriage a hair past a limit
+  double room = fmax (0.0, direction == DOWN ? sim->s.y : m->height - sim->s.y);
+  double target = steps == LIMIT || steps > room ? room : fmax (0.0, steps);
+  // The loop's top speed is verticalFrequency's share of the analog full
+  // scale (pidTopSpeed), and the drive's ramp time is from a stop to its
+  // max frequency
+  double scale = (double)sim->p->verticalFrequency / VFD_MAX_FREQUENCY;
+  double speed = m->vfdSpeed * scale;
+  double ramp = sim->p->verticalRamp * 0.1 * scale;
+  double accel = speed / ramp;
+  double rampDistance = speed * speed / (2 * accel);
+
+  // The interlock holds a reversal off until the other relay has been
+  // open for the dead time
+  if (sim->lastVertical >= 0 && sim->lastVertical != direction)
+    simWait (sim, fmax (0.0,
+          sim->relayOpened + MOTOR_DEAD_TIME * 1e-3 - sim->s.t));
+
+  if (steps != LIMIT) {
+    // The position loop brakes along the drive's ramp onto the count
+    if (target <= 2 * rampDistance) {
+      double t = sqrt (target / accel);
+      simRamp (sim, sign, 0, accel, t);
+      simRamp (sim, sign, accel * t, -accel, t);
+    } else {
+      simRamp (sim, sign, 0, accel, ramp);
+      simRamp (sim, sign, speed, 0, (target - 2 * rampDistance) / speed);
+      simRamp (sim, sign, speed, -accel, ramp);
+    }
+    if (target == room) sim->s.y = direction == DOWN ? 0 : m->height;
+  } else {
+    if (target <= rampDistance) {
+      double t = sqrt (2 * target / accel);
+      simRamp (sim, sign, 0, accel, t);
+    } else {
+      simRamp (sim, sign, 0, accel, ramp);
+      simRamp (sim, sign, speed, 0, (target - rampDistance) / speed);
+    }
+    sim->s.y = direction == DOWN ? 0 : m->height;
+
+    if (sim->blending) {
+      // The guns close at the limit, the rest runs beside the transition
+      sim->lastVertical = direction;
+      sim->relayOpened = sim->s.t + DEBOUNCE_TIME * 1e-3;
+      sim->braked = 1;
+      sim->tail += DEBOUNCE_TIME * 1e-3 + (double)PID_SETTLE / PID_RATE;
+      return;
+    }
+
+    // The relay is held through the debounce, pinned against the limit
+    simWait (sim, DEBOUNCE_TIME * 1e-3);
+  }
+
+  sim->lastVertical = direction;
+  sim->relayOpened = sim->s.t;
+
+  // The encoder has to stop counting before the move is over
+  simWait (sim, (double)PID_SETTLE / PID_RATE);
+}
+
+void simGoUntil (Sim* sim, int direction, long steps) {
+  if (direction == UP || direction == DOWN)
+    simVertical (sim, direction, steps);
+  else
+    simHorizontal (sim, direction, steps);
+}
+
+/**
+ * gunRotate: turns the holder, which settles while the carriage moves on.
+ */
+void simGunRotate (Sim* sim, int axis) {
+  if (axis == sim->gunAxis) return;
+
+  sim->gunAxis = axis;
+  sim->gunSettled = sim->s.t + sim->p->gunSettle * 1e-3;
+}
+
+/**
+ * stroke: wait for the start limit, open the zoned guns and run to the
+ * opposite limit. Blended, it returns once the guns close and leaves what
+ * is left of the move in sim->tail.
+ */
+void simStroke (Sim* sim, int axis) {
+  int* count = &sim->strokeCount[axis];
+  int direction;
+
+  simWait (sim, DEBOUNCE_TIME * 1e-3);
+
+  simGunRotate (sim, axis);
+  if (sim->gunSettled > sim->s.t) simWait (sim, sim->gunSettled - sim->s.t);
+
+  if (axis == VERTICAL)
+    direction = simAtLimit (sim, DOWN) ? UP : DOWN;
+  else
+    direction = simAtLimit (sim, LEFT) ? RIGHT : LEFT;
+
+  if (sim->sprays)
+    sim->zone = sim->sprays;
+  else if (*count >= sim->sprayMin && *count <= sim->sprayMax)
+    sim->zone = SPRAY_TOP | SPRAY_BOTTOM;
+  else if (*count < sim->sprayMin)
+    sim->zone = SPRAY_TOP;
+  else
+    sim->zone = SPRAY_BOTTOM;
+
+  sim->planned = planStroke (sim->p, axis, direction,
+      (long)(axis == HORIZONTAL ? sim->s.x : sim->s.y), &sim->window);
+  sim->s.sprays = sim->planned ? 0 : sim->zone;
+
+  sim->blending = sim->p->blend;
+  sim->braked = 0;
+  sim->tail = 0;
+  simGoUntil (sim, direction, LIMIT);
+  sim->blending = 0;
+  sim->planned = 0;
+  if (!sim->braked) simWait (sim, DEBOUNCE_TIME * 1e-3);
+
+  sim->s.sprays = 0;
+  (*count)++;
+  sim->r->strokes++;
+}
+
+void simDoStrokes (Sim* sim, int direction) {
+  int vertical = direction == UP || direction == DOWN;
+  int axis = vertical ? HORIZONTAL : VERTICAL;
+  Spacing spacing;
+  int spaced = (direction == UP || direction == RIGHT) &&
+    planSpacing (sim->p, vertical ? VERTICAL : HORIZONTAL, &spacing);
+  int gap = spaced ? spacing.gap :
+    vertical ? sim->p->verticalStrokeGap : sim->p->horizontalStrokeGap;
+
+  sim->s.axis = axis;
+  sim->strokeCount[axis] = 0;
+  sim->sprayMin = spaced ? spacing.sprayMin : sim->p->sprayMin;
+  sim->sprayMax = spaced ? spacing.sprayMax : sim->p->sprayMax;
+
+  if (spaced) simGoUntil (sim, direction, spacing.first);
+
+  for (int done = 0; !simAtLimit (sim, direction); done++) {
+    simStroke (sim, axis);
+
+    // No transition after the last one
+    if (spaced && done == spacing.count - 1) {
+      simWait (sim, sim->tail);
+      sim->tail = 0;
+      break;
+    }
+
+    double start = sim->s.t;
+    simGoUntil (sim, direction, gap);
+
+    // Blended, the stroke may still be slowing down
+    if (sim->tail > sim->s.t - start)
+      simWait (sim, sim->tail - (sim->s.t - start));
+    sim->tail = 0;
+  }
+}
+
+/**
+ * Starts a simulation with the carriage in the middle of the machine.
+ */
+void simInit (Sim* sim, const Machine* m, const Params* p, SimResult* r,
+    SampleFn fn, void* ctx) {
+  memset (r, 0, sizeof (*r));
+  sim->m = m;
+  sim->p = p;
+  sim->r = r;
+  sim->fn = fn;
+  sim->ctx = ctx;
+  sim->s.t = 0;
+  sim->s.x = m->width / 2;
+  sim->s.y = m->height / 2;
+  sim->s.sprays = 0;
+  sim->s.axis = HORIZONTAL;
+  sim->strokeCount[VERTICAL] = sim->strokeCount[HORIZONTAL] = 0;
+  sim->lastVertical = -1;
+  sim->relayOpened = 0;
+  sim->travel = 0;
+  sim->blending = sim->braked = 0;
+  sim->tail = 0;
+  sim->gunAxis = HORIZONTAL;
+  sim->gunSettled = 0;
+  sim->planned = 0;
+  sim->zone = 0;
+  sim->cruising = 0;
+  sim->sprays = 0;
+  sim->layout = 0;
+  sim->parts = 0;
+  sim->partCount = 0;
+  sim->onRow = 0;
+  sim->row = 0;
+}
+
+/**
+ * Runs the full job from the commented out loop(): reset, horizontal
+ * strokes up the panel, reset, vertical strokes across it.
+ *
+ * @param fn is called for every simulated interval if not null
+ */
+void simulate (const Machine* m, const Params* p, SimResult* r,
+    SampleFn fn, void* ctx) {
+  Sim sim;
+
+  simInit (&sim, m, p, r, fn, ctx);
+
+  simGoUntil (&sim, DOWN, LIMIT);
+  simGoUntil (&sim, LEFT, LIMIT);
+  simDoStrokes (&sim, UP);
+
+  simGunRotate (&sim, VERTICAL);
+  simGoUntil (&sim, LEFT, LIMIT);
+  simGoUntil (&sim, UP, LIMIT);
+  simDoStrokes (&sim, RIGHT);
+
+  const Profile* hp = &p->horizontal;
+  double period = 2e-6 * hp->min + m->stepOverhead * 1e-6;
+  r->cruiseSpeed = 1.0 / (period * m->stepsPerMm);
+  r->rampLength = hp->stepsToStart / m->stepsPerMm;
+  r->cycleTime = sim.s.t;
+}
+
+/**
+ * Runs one of coat's coats: from the top of the machine, where the last
+ * one ended, reset and horizontal strokes up the panel.
+ */
+void simulateCoat (const Machine* m, const Params* p, SimResult* r) {
+  Sim sim;
+
+  simInit (&sim, m, p, r, 0, 0);
+  sim.s.y = m->height;
+
+  simGoUntil (&sim, DOWN, LIMIT);
+  simGoUntil (&sim, LEFT, LIMIT);
+  simDoStrokes (&sim, UP);
+
+  r->cycleTime = sim.s.t;
+}
+
+/**
+ * Runs a toolpath as runPath does, each stroke's window standing in for
+ * the panel's bounds.
+ *
+ * @param fn is called for every simulated interval if not null
+ */
+void simulatePath (const Machine* m, const Params* p, const uint8_t* path,
+    SimResult* r, SampleFn fn, void* ctx) {
+  Sim sim;
+  Params q = *p;
+  SegmentReader reader;
+  Segment segment;
+
+  simInit (&sim, m, &q, r, fn, ctx);
+
+  simGoUntil (&sim, DOWN, LIMIT);
+  simGoUntil (&sim, LEFT, LIMIT);
+
+  segmentsBegin (&reader, path);
+  while (segmentNext (&reader, &segment)) {
+    if (segment.op == SEGMENT_MOVE) {
+      simGoUntil (&sim, segment.axis == VERTICAL ?
+          (segment.distance < 0 ? DOWN : UP) :
+          (segment.distance < 0 ? LEFT : RIGHT),
+          segment.sprays & SEGMENT_LIMIT ? LIMIT : labs (segment.distance));
+      continue;
+    }
+
+    if (segment.axis == HORIZONTAL) {
+      q.panelLeft = segment.from;
+      q.panelRight = segment.to;
+    } else {
+      q.panelBottom = segment.from;
+      q.panelTop = segment.to;
+    }
+    sim.sprays = segment.sprays;
+    sim.s.axis = segment.axis;
+    simStroke (&sim, segment.axis);
+    simWait (&sim, sim.tail);
+    sim.tail = 0;
+  }
+
+  r->cycleTime = sim.s.t;
+}
+
+/**
+ * Runs sparse's rows over n parts. The move up to a row and the one across
+ * to its start run at the same time, so the longer of the two counts.
+ *
+ * @param fn is called for every simulated interval if not null, but not
+ *        for the moves across
+ */
+void simulateLayout (const Machine* m, const Params* p, const Part* parts,
+    int n, SimResult* r, SampleFn fn, void* ctx) {
+  Sim sim;
+  Layout layout;
+  Row row;
+
+  simInit (&sim, m, p, r, fn, ctx);
+  planLayout (p, parts, n, &layout);
+  sim.layout = &layout;
+  sim.parts = parts;
+  sim.partCount = n;
+
+  simGoUntil (&sim, DOWN, LIMIT);
+  simGoUntil (&sim, LEFT, LIMIT);
+
+  for (int i = 0; i < layout.count; i++) {
+    long y = layout.first + (long)i * layout.gap;
+    long start, end;
+
+    if (!planRow (p, &layout, parts, n, y, &row)) continue;
+
+    int direction = rowRun (p, &row, (long)sim.s.x, &start, &end);
+    long rise = y - (long)sim.s.y;
+    long across = labs (start - (long)sim.s.x);
+
+    double t = sim.s.t;
+    if (rise > 0) simGoUntil (&sim, UP, rise);
+    double up = sim.s.t - t;
+
+    if (across) {
+      SampleFn f = sim.fn;
+
+      sim.fn = 0;
+      t = sim.s.t;
+      simGoUntil (&sim, start < sim.s.x ? LEFT : RIGHT, across - 1);
+      double over = sim.s.t - t - up;
+      sim.s.t = t;
+      sim.fn = f;
+      if (over > 0) simWait (&sim, over);
+    }
+
+    long length = labs (end - (long)sim.s.x);
+
+    sim.row = y;
+    sim.onRow = 1;
+    sim.s.axis = HORIZONTAL;
+    if (length > 0) simGoUntil (&sim, direction, length - 1);
+    sim.onRow = 0;
+    sim.s.sprays = 0;
+    r->strokes++;
+  }
+
+  r->cycleTime = sim.s.t;
+}
+
+#endif
@@ -0,0 +1,365 @@
+/**
+ * Parameter sweep for the WoodStain job.
+ *
+ * Runs the simulated job over a grid of profiles, stroke gaps and rests on
+ * every core and writes the fastest set that still meets the coverage
+ * limits as a loadable parameter set.
+ *
+ *   sweep [-j threads] [-p base.params] [-o name] [--overlap f]
+ *         [--uniform f] [--cov f] [--<axis> lo:hi:step ...]
+ *
+ * Axes are min, max, ramp, hgap, vgap and rest. An axis that isn't given
+ * stays at the base value. -o writes name.h (a tuned.h) and name.params.
+ *
+ * With --cov the fastest candidates are run through the coverage model in
+ * order and the first whose stain varies by less than f wins.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include "coverage.h"
+#include "params_io.h"
+
+#define AXES  6
+
+typedef struct {
+  const char* name;
+  int lo;
+  int hi;
+  int step;
+} Range;
+
+/**
+ * The coverage the fastest set still has to meet.
+ */
+typedef struct {
+  double overlap;   // Minimum overlap between neighbouring strokes
+  double uniform;   // Minimum fraction of a stroke painted at cruise speed
+  double cov;       // Maximum variation of the modelled stain
+} Limits;
+
+typedef struct {
+  long begin;
+  long end;
+} Chunk;
+
+typedef struct {
+  std::mutex lock;
+  std::deque<Chunk> tasks;
+} WorkQueue;
+
+typedef struct {
+  long index;
+  double cycleTime;
+  Params p;
+  SimResult r;
+} Best;
+
+// The fastest sets each worker has found, fastest first
+#define CANDIDATES  32
+
+typedef struct {
+  int n;
+  Best best[CANDIDATES];
+} Ranking;
+
+const Machine* machine;
+const Params* base;
+Limits limits = { 0.2, 0.9, HUGE_VAL };
+Range axes[AXES] = {
+  { "min", 0, 0, 1 },
+  { "max", 0, 0, 1 },
+  { "ramp", 0, 0, 1 },
+  { "hgap", 0, 0, 1 },
+  { "vgap", 0, 0, 1 },
+  { "rest", 0, 0, 1 },
+};
+
+std::vector<WorkQueue> queues;
+std::atomic<long> remaining;
+
+#define GRAIN 64
+
+int axisCount (const Range* r) {
+  return (r->hi - r->lo) / r->step + 1;
+}
+
+/**
+ * Decodes a grid index into a parameter block.
+ */
+void paramsAt (long index, Params* p) {
+  int* fields[AXES] = { &p->horizontal.min, &p->horizontal.max,
+    &p->horizontal.stepsToStart, &p->horizontalStrokeGap,
+    &p->verticalStrokeGap, &p->motorRest };
+
+  *p = *base;
+  for (int i = 0; i < AXES; i++) {
+    int n = axisCount (&axes[i]);
+    *fields[i] = axes[i].lo + (int)(index % n) * axes[i].step;
+    index /= n;
+  }
+}
+
+/**
+ * Whether a simulated run lays an even enough coat.
+ */
+int covers (const Params* p, const SimResult* r) {
+  const Machine* m = machine;
+  double maxGap = m->fanWidth * (1.0 - limits.overlap);
+
+  if (p->horizontal.min > p->horizontal.max) return 0;
+  if (p->verticalStrokeGap / m->countsPerMm > maxGap) return 0;
+  if (p->horizontalStrokeGap / m->stepsPerMm > maxGap) return 0;
+  if (r->cruiseSpeed > m->maxSpeed) return 0;
+  if (1.0 - r->rampLength * m->stepsPerMm / m->width < limits.uniform)
+    return 0;
+
+  return 1;
+}
+
+int faster (const Best& a, const Best& b) {
+  return a.cycleTime < b.cycleTime ||
+    (a.cycleTime == b.cycleTime && a.index < b.index);
+}
+
+void evaluate (long index, Ranking* ranking) {
+  Best b;
+
+  paramsAt (index, &b.p);
+  if (b.p.horizontal.min > b.p.horizontal.max) return;
+
+  simulate (machine, &b.p, &b.r, 0, 0);
+  if (!covers (&b.p, &b.r)) return;
+
+  b.index = index;
+  b.cycleTime = b.r.cycleTime;
+
+  int i = ranking->n;
+  if (i == CANDIDATES) {
+    if (!faster (b, ranking->best[--i])) return;
+  } else {
+    ranking->n++;
+  }
+  for (; i > 0 && faster (b, ranking->best[i - 1]); i--)
+    ranking->best[i] = ranking->best[i - 1];
+  ranking->best[i] = b;
+}
+
+/**
+ * Takes a chunk from the back of our own queue or, failing that, steals
+ * one from the front of another worker's.
+ */
+int takeChunk (int self, Chunk* c) {
+  int n = queues.size ();
+
+  for (int i = 0; i < n; i++) {
+    WorkQueue* q = &queues[(self + i) % n];
+    std::lock_guard<std::mutex> guard (q->lock);
+
+    if (q->tasks.empty ()) continue;
+    if (i == 0) {
+      *c = q->tasks.back ();
+      q->tasks.pop_back ();
+    } else {
+      *c = q->tasks.front ();
+      q->tasks.pop_front ();
+    }
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Runs chunks until the whole grid is done. Large chunks are split in half
+ * and the upper half left on our queue for others to steal.
+ */
+void worker (int self, Ranking* ranking) {
+  Chunk c;
+
+  while (remaining.load () > 0) {
+    if (!takeChunk (self, &c)) {
+      std::this_thread::yield ();
+      continue;
+    }
+
+    while (c.end - c.begin > GRAIN) {
+      long mid = c.begin + (c.end - c.begin) / 2;
+      Chunk upper = { mid, c.end };
+      {
+        std::lock_guard<std::mutex> guard (queues[self].lock);
+        queues[self].tasks.push_back (upper);
+      }
+      c.end = mid;
+    }
+
+    for (long i = c.begin; i < c.end; i++) evaluate (i, ranking);
+    remaining -= c.end - c.begin;
+  }
+}
+
+int parseRange (const char* arg, Range* r) {
+  int n = sscanf (arg, "%d:%d:%d", &r->lo, &r->hi, &r->step);
+
+  if (n == 1) {
+    r->hi = r->lo;
+    r->step = 1;
+  } else if (n == 2) {
+    r->step = 1;
+  } else if (n != 3) {
+    return -1;
+  }
+
+  return r->step > 0 && r->hi >= r->lo ? 0 : -1;
+}
+
+void usage () {
+  fprintf (stderr, "usage: sweep [-j threads] [-p base.params] [-o name] "
+      "[--overlap f] [--uniform f] [--cov f] "
+      "[--min|--max|--ramp|--hgap|--vgap|--rest lo:hi:step]\n");
+  exit (2);
+}
+
+int main (int argc, char** argv) {
+  static Machine m = DEFAULT_MACHINE;
+  static Params p = DEFAULT_PARAMS;
+  const char* out = 0;
+  int threads = std::thread::hardware_concurrency ();
+  int given[AXES] = { 0 };
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    int found = 0;
+
+    if (i + 1 >= argc) usage ();
+
+    if (!strcmp (a, "-j")) {
+      threads = atoi (argv[++i]);
+    } else if (!strcmp (a, "-p")) {
+      if (readParams (argv[++i], &p, &m)) {
+        perror (argv[i]);
+        return 1;
+      }
+    } else if (!strcmp (a, "-o")) {
+      out = argv[++i];
+    } else if (!strcmp (a, "--overlap")) {
+      limits.overlap = atof (argv[++i]);
+    } else if (!strcmp (a, "--uniform")) {
+      limits.uniform = atof (argv[++i]);
+    } else if (!strcmp (a, "--cov")) {
+      limits.cov = atof (argv[++i]);
+    } else {
+      for (int j = 0; j < AXES; j++) {
+        if (a[0] != '-' || a[1] != '-' || strcmp (a + 2, axes[j].name))
+          continue;
+        if (parseRange (argv[++i], &axes[j])) usage ();
+        given[j] = found = 1;
+      }
+      if (!found) usage ();
+    }
+  }
+
+  // Axes that weren't given stay at the base value
+  int fixed[AXES] = { p.horizontal.min, p.horizontal.max,
+    p.horizontal.stepsToStart, p.horizontalStrokeGap, p.verticalStrokeGap,
+    p.motorRest };
+  long total = 1;
+  for (int j = 0; j < AXES; j++) {
+    if (!given[j]) axes[j].lo = axes[j].hi = fixed[j];
+    total *= axisCount (&axes[j]);
+  }
+
+  if (threads < 1) threads = 1;
+  machine = &m;
+  base = &p;
+  remaining = total;
+
+  std::vector<WorkQueue> q (threads);
+  queues.swap (q);
+  std::vector<Ranking> rankings (threads);
+  for (int t = 0; t < threads; t++) {
+    Chunk c = { total * t / threads, total * (t + 1) / threads };
+    if (c.end > c.begin) queues[t].tasks.push_back (c);
+    rankings[t].n = 0;
+  }
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now ();
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++)
+    pool.push_back (std::thread (worker, t, &rankings[t]));
+  for (int t = 0; t < threads; t++) pool[t].join ();
+  double elapsed = std::chrono::duration<double> (
+      std::chrono::steady_clock::now () - start).count ();
+
+  std::vector<Best> candidates;
+  for (int t = 0; t < threads; t++)
+    candidates.insert (candidates.end (), rankings[t].best,
+        rankings[t].best + rankings[t].n);
+  std::sort (candidates.begin (), candidates.end (), faster);
+
+  fprintf (stderr, "%ld sets on %d threads in %.2fs\n", total, threads,
+      elapsed);
+
+  Best* winner = 0;
+  double panel[4];
+  defaultPanel (&m, panel);
+  for (size_t i = 0; i < candidates.size () && !winner; i++) {
+    Uniformity u;
+
+    if (limits.cov == HUGE_VAL) {
+      winner = &candidates[i];
+      break;
+    }
+
+    measureCoverage (&m, &candidates[i].p, 10.0, panel, &u);
+    fprintf (stderr, "%.1fs: cov %.3f\n", candidates[i].cycleTime, u.cov);
+    if (u.mean > 0 && u.cov <= limits.cov) winner = &candidates[i];
+  }
+
+  if (!winner) {
+    fprintf (stderr, "No set meets the coverage limits\n");
+    return 1;
+  }
+
+  SimResult baseline;
+  simulate (&m, &p, &baseline, 0, 0);
+  printf ("cycle %.1fs (base %.1fs), %d strokes, cruise %.0f mm/s\n",
+      winner->cycleTime, baseline.cycleTime, winner->r.strokes,
+      winner->r.cruiseSpeed);
+  writeParams (stdout, &winner->p);
+
+  if (out) {
+    char path[512], comment[128];
+    FILE* f;
+
+    snprintf (comment, sizeof (comment),
+        "Written by host/sweep: %.1fs cycle, %d strokes",
+        winner->cycleTime, winner->r.strokes);
+
+    snprintf (path, sizeof (path), "%s.h", out);
+    if (!(f = fopen (path, "w"))) {
+      perror (path);
+      return 1;
+    }
+    writeHeader (f, &winner->p, comment);
+    fclose (f);
+
+    snprintf (path, sizeof (path), "%s.params", out);
+    if (!(f = fopen (path, "w"))) {
+      perror (path);
+      return 1;
+    }
+    fprintf (f, "# %s\n", comment);
+    writeParams (f, &winner->p);
+    fclose (f);
+  }
+
+  return 0;
+}
@@ -0,0 +1,349 @@
+/**
+ * Telemetry aggregator for a room full of WoodStain controllers.
+ *
+ * Reads the serial output of every board through one epoll loop, parses
+ * it in place in a fixed buffer per board and keeps rolling metrics:
+ * panels per hour, stroke time percentiles and fault counts.
+ *
+ *   telemetryd [-b baud] [-i seconds] [-o status] device...
+ *
+ * Boards may send the text debug output or binary trace records; each is
+ * detected from the first bytes seen. Devices that go away are reopened.
+ * host/fakeboard stands in for boards on pseudo-terminals.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "Arduino.h"
+#include "messages.h"
+
+#define BOARDS        64
+#define BUFFER        4096
+#define STROKE_WINDOW 256   // Strokes kept for the percentiles
+#define JOB_WINDOW    512   // Finished jobs kept for the hourly rate
+#define REOPEN        5     // Seconds between attempts to reopen a device
+
+#define TEXT      0
+#define BINARY    1
+#define UNKNOWN   2
+
+typedef struct {
+  const char* path;
+  int fd;
+  int format;
+  size_t used;
+  char buffer[BUFFER];
+
+  int open;                   // A stroke is in progress
+  uint32_t strokeStart;
+  uint32_t strokes[STROKE_WINDOW];
+  long strokeCount;
+  time_t jobs[JOB_WINDOW];
+  long jobCount;
+  long faults;
+  long boots;
+  long bytes;
+  time_t seen;
+  time_t tried;
+} Board;
+
+Board boards[BOARDS];
+int boardCount;
+int epoll;
+speed_t baud = B9600;
+time_t started;
+
+/**
+ * Opens a board's device raw and non-blocking and adds it to the loop.
+ */
+void openBoard (Board* b) {
+  struct termios t;
+  struct epoll_event ev;
+
+  b->tried = time (0);
+  b->fd = open (b->path, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+  if (b->fd < 0) return;
+
+  if (!tcgetattr (b->fd, &t)) {
+    cfmakeraw (&t);
+    cfsetispeed (&t, baud);
+    cfsetospeed (&t, baud);
+    t.c_cflag |= CLOCAL | CREAD;
+    t.c_cc[VMIN] = 0;
+    t.c_cc[VTIME] = 0;
+    tcsetattr (b->fd, TCSANOW, &t);
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = b;
+  epoll_ctl (epoll, EPOLL_CTL_ADD, b->fd, &ev);
+
+  b->format = UNKNOWN;
+  b->used = 0;
+  b->open = 0;
+}
+
+void closeBoard (Board* b) {
+  epoll_ctl (epoll, EPOLL_CTL_DEL, b->fd, 0);
+  close (b->fd);
+  b->fd = -1;
+}
+
+/**
+ * Updates a board's metrics with one event.
+ */
+void record (Board* b, const TraceRecord* e) {
+  switch (e->kind) {
+    case TRACE_BOOT:
+      b->boots++;
+      b->open = 0;
+      break;
+    case TRACE_STROKE:
+      b->open = 1;
+      b->strokeStart = e->time;
+      break;
+    case TRACE_STROKE_END:
+      if (b->open && e->time >= b->strokeStart)
+        b->strokes[b->strokeCount++ % STROKE_WINDOW] =
+          e->time - b->strokeStart;
+      b->open = 0;
+      break;
+    case TRACE_JOB:
+      if (!e->arg) b->jobs[b->jobCount++ % JOB_WINDOW] = time (0);
+      break;
+    case TRACE_FAULT:
+      b->faults++;
+      break;
+  }
+}
+
+/**
+ * Parses every complete frame in a board's buffer in place and moves the
+ * partial one left over to the front.
+ */
+void parse (Board* b) {
+  char* s = b->buffer;
+  char* end = b->buffer + b->used;
+
+  if (b->format == UNKNOWN) {
+    uint32_t magic = TRACE_MAGIC;
+    size_t n = std::min (b->used, sizeof (magic));
+    if (memcmp (s, &magic, n)) b->format = TEXT;
+    else if (n == sizeof (magic)) b->format = BINARY;
+    else return;
+  }
+
+  if (b->format == BINARY) {
+    TraceRecord e;
+    while (end - s >= (long)sizeof (e)) {
+      memcpy (&e, s, sizeof (e));
+      if ((e.kind & ~TRACE_DUMPED) >= TRACE_KINDS || (e.kind == TRACE_BOOT &&
+            e.time != TRACE_MAGIC)) {
+        // Lost a byte somewhere, slide until the records line up again
+        s++;
+        continue;
+      }
+      // The flight recorder's dump is from before the reset
+      if (e.kind != TRACE_FLIGHT && !(e.kind & TRACE_DUMPED)) record (b, &e);
+      s += sizeof (e);
+    }
+  } else {
+    char* eol;
+    while ((eol = (char*)memchr (s, '\n', end - s))) {
+      TraceRecord e;
+      char* line = eol > s && eol[-1] == '\r' ? eol - 1 : eol;
+      if (parseLine (s, line, &e)) record (b, &e);
+      s = eol + 1;
+    }
+    // A full buffer with no newline is noise
+    if (s == b->buffer && b->used == BUFFER) s = end;
+  }
+
+  b->used = end - s;
+  memmove (b->buffer, s, b->used);
+}
+
+void readBoard (Board* b) {
+  for (;;) {
+    ssize_t n = read (b->fd, b->buffer + b->used, BUFFER - b->used);
+
+    if (n > 0) {
+      b->used += n;
+      b->bytes += n;
+      b->seen = time (0);
+      parse (b);
+    } else if (n < 0 && errno == EAGAIN) {
+      return;
+    } else {
+      // EOF or the board went away
+      closeBoard (b);
+      return;
+    }
+  }
+}
+
+/**
+ * Writes one line per board: jobs per hour over the last hour, stroke
+ * time percentiles over the last STROKE_WINDOW strokes and faults.
+ */
+void report (FILE* f) {
+  static uint32_t scratch[STROKE_WINDOW];
+  time_t now = time (0);
+  double window = std::min (3600.0, std::max (1.0, (double)(now - started)));
+
+  fprintf (f, "%-24s %6s %8s %8s %8s %6s %5s %s\n", "device", "jobs/h",
+      "p50", "p90", "p99", "faults", "boots", "state");
+
+  for (int i = 0; i < boardCount; i++) {
+    Board* b = &boards[i];
+    long jobs = 0;
+    for (long j = 0; j < std::min (b->jobCount, (long)JOB_WINDOW); j++)
+      if (now - b->jobs[j] < 3600) jobs++;
+
+    double p[3] = { 0, 0, 0 };
+    long n = std::min (b->strokeCount, (long)STROKE_WINDOW);
+    if (n) {
+      static const double q[3] = { 0.5, 0.9, 0.99 };
+      memcpy (scratch, b->strokes, n * sizeof (uint32_t));
+      for (int k = 0; k < 3; k++) {
+        long at = (long)(q[k] * (n - 1));
+        std::nth_element (scratch, scratch + at, scratch + n);
+        p[k] = scratch[at] / 1000.0;
+      }
+    }
+
+    const char* state = b->fd < 0 ? "closed" :
+      !b->seen ? "waiting" : now - b->seen > 60 ? "quiet" : "up";
+    fprintf (f, "%-24s %6.1f %7.2fs %7.2fs %7.2fs %6ld %5ld %s\n", b->path,
+        jobs * 3600.0 / window, p[0], p[1], p[2], b->faults, b->boots, state);
+  }
+}
+
+void writeStatus (const char* path) {
+  char tmp[512];
+  FILE* f;
+
+  if (!path) {
+    report (stdout);
+    fflush (stdout);
+    return;
+  }
+
+  snprintf (tmp, sizeof (tmp), "%s.tmp", path);
+  if (!(f = fopen (tmp, "w"))) {
+    perror (tmp);
+    return;
+  }
+  report (f);
+  fclose (f);
+  rename (tmp, path);
+}
+
+speed_t toSpeed (long rate) {
+  switch (rate) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    default: return B0;
+  }
+}
+
+void usage () {
+  fprintf (stderr, "usage: telemetryd [-b baud] [-i seconds] [-o status] "
+      "device...\n");
+  exit (2);
+}
+
+int main (int argc, char** argv) {
+  const char* status = 0;
+  int interval = 10;
+  int i = 1;
+
+  for (; i < argc && argv[i][0] == '-'; i += 2) {
+    if (i + 1 >= argc) usage ();
+    if (!strcmp (argv[i], "-b")) {
+      if ((baud = toSpeed (atol (argv[i + 1]))) == B0) usage ();
+    } else if (!strcmp (argv[i], "-i")) {
+      interval = atoi (argv[i + 1]);
+    } else if (!strcmp (argv[i], "-o")) {
+      status = argv[i + 1];
+    } else {
+      usage ();
+    }
+  }
+  if (i >= argc || interval < 1) usage ();
+  if (argc - i > BOARDS) {
+    fprintf (stderr, "At most %d devices\n", BOARDS);
+    return 2;
+  }
+
+  epoll = epoll_create1 (0);
+  started = time (0);
+
+  for (; i < argc; i++) {
+    Board* b = &boards[boardCount++];
+    b->path = argv[i];
+    openBoard (b);
+    if (b->fd < 0) perror (b->path);
+  }
+
+  // Signals and the report timer come through the same loop
+  sigset_t mask;
+  sigemptyset (&mask);
+  sigaddset (&mask, SIGINT);
+  sigaddset (&mask, SIGTERM);
+  sigprocmask (SIG_BLOCK, &mask, 0);
+  int sfd = signalfd (-1, &mask, SFD_NONBLOCK);
+
+  int tfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK);
+  struct itimerspec every = { { interval, 0 }, { interval, 0 } };
+  timerfd_settime (tfd, 0, &every, 0);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &sfd;
+  epoll_ctl (epoll, EPOLL_CTL_ADD, sfd, &ev);
+  ev.data.ptr = &tfd;
+  epoll_ctl (epoll, EPOLL_CTL_ADD, tfd, &ev);
+
+  struct epoll_event events[BOARDS + 2];
+  for (;;) {
+    int n = epoll_wait (epoll, events, BOARDS + 2, -1);
+    if (n < 0 && errno == EINTR) continue;
+
+    for (int k = 0; k < n; k++) {
+      void* ptr = events[k].data.ptr;
+
+      if (ptr == &sfd) {
+        writeStatus (status);
+        return 0;
+      } else if (ptr == &tfd) {
+        uint64_t ticks;
+        if (read (tfd, &ticks, sizeof (ticks)) < 0) continue;
+
+        time_t now = time (0);
+        for (int j = 0; j < boardCount; j++)
+          if (boards[j].fd < 0 && now - boards[j].tried >= REOPEN)
+            openBoard (&boards[j]);
+        writeStatus (status);
+      } else {
+        Board* b = (Board*)ptr;
+        if (events[k].events & EPOLLIN) readBoard (b);
+        else if (b->fd >= 0) closeBoard (b);
+      }
+    }
+  }
+}
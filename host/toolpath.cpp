@@ -0,0 +1,392 @@
+/**
+ * Toolpath compiler.
+ *
+ * Plans the strokes for a set of panel outlines and writes them as the
+ * segment stream the firmware runs with TOOLPATH defined (see
+ * src/segments.h), so the controller has nothing to work out or parse.
+ *
+ *   toolpath [-p set.params] [-o name] [--vertical] panels
+ *
+ * The panels are a list of rectangles, "left bottom right top" a line in
+ * millimetres from the bottom left limits, or an SVG whose rect, polygon
+ * and polyline elements are taken in millimetres with their bounding
+ * boxes for outlines. Each panel gets horizontal strokes spaced to the fan
+ * and overlap as spacing.h spaces them, with its own window and guns, and
+ * with --vertical a second pass of vertical strokes. The strokes of all the
+ * panels are run in one climb up the machine, and one sweep across it.
+ *
+ * -o writes name.h, to build as src/toolpath.h, and name.bin.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "sim.h"
+#include "params_io.h"
+
+typedef struct {
+  double x0, y0, x1, y1;    // mm
+} Outline;
+
+typedef struct {
+  int axis;
+  long at;                  // Where across the strokes it runs
+  long from;                // Its window along them
+  long to;
+  int sprays;
+} PlannedStroke;
+
+void usage () {
+  fprintf (stderr, "usage: toolpath [-p set.params] [-o name] [--vertical] "
+      "panels\n");
+  exit (2);
+}
+
+/**
+ * Returns the value of an attribute in a tag, or null.
+ */
+const char* attribute (const char* tag, const char* end, const char* name,
+    char* value, size_t size) {
+  size_t n = strlen (name);
+
+  for (const char* a = tag; (a = strstr (a, name)) && a < end; a += n) {
+    if (a[-1] != ' ' && a[-1] != '\t' && a[-1] != '\n') continue;
+    if (a[n] != '=' || (a[n + 1] != '"' && a[n + 1] != '\'')) continue;
+
+    const char* v = a + n + 2;
+    const char* q = strchr (v, a[n + 1]);
+    if (!q || q > end || (size_t)(q - v) >= size) return 0;
+    memcpy (value, v, q - v);
+    value[q - v] = 0;
+    return value;
+  }
+
+  return 0;
+}
+
+/**
+ * Reads an SVG's outlines, flipped so y goes up from the bottom limit.
+ */
+void readSvg (const char* text, double height, std::vector<Outline>& out) {
+  static char value[65536];
+
+  for (const char* t = text; (t = strchr (t, '<')); t++) {
+    const char* end = strchr (t, '>');
+    if (!end) break;
+
+    Outline o;
+    if (!strncmp (t, "<rect", 5)) {
+      double x = 0, y = 0, w = 0, h = 0;
+
+      if (attribute (t, end, "x", value, sizeof (value))) x = atof (value);
+      if (attribute (t, end, "y", value, sizeof (value))) y = atof (value);
+      if (attribute (t, end, "width", value, sizeof (value)))
+        w = atof (value);
+      if (attribute (t, end, "height", value, sizeof (value)))
+        h = atof (value);
+      o.x0 = x;
+      o.x1 = x + w;
+      o.y0 = height - (y + h);
+      o.y1 = height - y;
+    } else if (!strncmp (t, "<polygon", 8) || !strncmp (t, "<polyline", 9)) {
+      double x, y;
+      int n = 0, used;
+
+      if (!attribute (t, end, "points", value, sizeof (value))) continue;
+      o.x0 = o.y0 = HUGE_VAL;
+      o.x1 = o.y1 = -HUGE_VAL;
+      for (const char* p = value;
+          sscanf (p, " %lf%*[ ,]%lf%n", &x, &y, &used) == 2; p += used, n++) {
+        o.x0 = fmin (o.x0, x);
+        o.x1 = fmax (o.x1, x);
+        o.y0 = fmin (o.y0, height - y);
+        o.y1 = fmax (o.y1, height - y);
+        while (p[used] == ',' || p[used] == ' ') used++;
+      }
+      if (!n) continue;
+    } else {
+      continue;
+    }
+
+    if (o.x1 > o.x0 && o.y1 > o.y0) out.push_back (o);
+  }
+}
+
+/**
+ * Reads the panels, as an SVG or a list of rectangles.
+ *
+ * @return -1 if the file can't be read
+ */
+int readPanels (const char* path, double height, std::vector<Outline>& out) {
+  FILE* f = fopen (path, "r");
+  std::vector<char> text;
+  char buffer[4096];
+  size_t n;
+
+  if (!f) return -1;
+  while ((n = fread (buffer, 1, sizeof (buffer), f)) > 0)
+    text.insert (text.end (), buffer, buffer + n);
+  fclose (f);
+  text.push_back (0);
+
+  if (strstr (&text[0], "<svg")) {
+    readSvg (&text[0], height, out);
+    return 0;
+  }
+
+  for (char* line = strtok (&text[0], "\n"); line; line = strtok (0, "\n")) {
+    Outline o;
+
+    if (line[0] == '#') continue;
+    if (sscanf (line, "%lf %lf %lf %lf", &o.x0, &o.y0, &o.x1, &o.y1) != 4)
+      continue;
+    if (o.x1 > o.x0 && o.y1 > o.y0) out.push_back (o);
+  }
+
+  return 0;
+}
+
+/**
+ * Plans a panel's strokes along one axis, spaced as doStrokes spaces them.
+ *
+ * @return the number of strokes whose ramp runs onto the panel
+ */
+int planPanel (const Machine* m, const Params* p, const Outline* o, int axis,
+    std::vector<PlannedStroke>& out) {
+  Params q = *p;
+  Spacing s;
+  long limit = axis == HORIZONTAL ? m->height : m->width;
+  int clipped = 0;
+
+  q.panelLeft = lround (o->x0 * m->stepsPerMm);
+  q.panelRight = lround (o->x1 * m->stepsPerMm);
+  q.panelBottom = lround (o->y0 * m->countsPerMm);
+  q.panelTop = lround (o->y1 * m->countsPerMm);
+
+  // Without a fan set, the machine's
+  if (q.fanSteps <= 0) q.fanSteps = lround (m->fanWidth * m->stepsPerMm);
+  if (q.fanCounts <= 0) q.fanCounts = lround (m->fanWidth * m->countsPerMm);
+
+  planSpacing (&q, axis == HORIZONTAL ? VERTICAL : HORIZONTAL, &s);
+  if (s.clamped)
+    printf ("  its first %s stroke is on the limit, short of the panel's "
+        "edge\n", axis == HORIZONTAL ? "horizontal" : "vertical");
+
+  for (int i = 0; i < s.count; i++) {
+    PlannedStroke k;
+
+    k.axis = axis;
+    k.at = s.first + (long)i * s.gap;
+    if (k.at > limit) k.at = limit;
+    k.from = axis == HORIZONTAL ? q.panelLeft : q.panelBottom;
+    k.to = axis == HORIZONTAL ? q.panelRight : q.panelTop;
+    k.sprays = i < s.sprayMin ? SEGMENT_TOP : i > s.sprayMax ?
+      SEGMENT_BOTTOM : SEGMENT_TOP | SEGMENT_BOTTOM;
+    out.push_back (k);
+
+    if (axis == HORIZONTAL && (k.from < p->horizontal.stepsToStart ||
+          m->width - k.to < p->horizontal.stepsToStart))
+      clipped++;
+  }
+
+  return clipped;
+}
+
+void putNumber (std::vector<uint8_t>& out, long n) {
+  unsigned long z = (unsigned long)n << 1 ^ (n < 0 ? ~0UL : 0);
+
+  while (z >= 0x80) {
+    out.push_back ((uint8_t)(z | 0x80));
+    z >>= 7;
+  }
+  out.push_back ((uint8_t)z);
+}
+
+/**
+ * Moves along an axis, goUntil taking the whole distance as a long.
+ */
+void putMove (std::vector<uint8_t>& out, int axis, long distance) {
+  if (!distance) return;
+
+  out.push_back (SEGMENT_MOVE << 6 | axis << 5);
+  putNumber (out, distance);
+}
+
+void putLimit (std::vector<uint8_t>& out, int axis, int sign) {
+  out.push_back (SEGMENT_MOVE << 6 | axis << 5 | SEGMENT_LIMIT);
+  putNumber (out, sign);
+}
+
+/**
+ * Encodes the strokes, each axis' in one pass from the bottom left.
+ */
+void encode (const Machine* m, std::vector<PlannedStroke>& strokes,
+    std::vector<uint8_t>& out) {
+  long from[2] = { 0, 0 }, to[2] = { 0, 0 };
+  long x = 0, y = 0;
+  int first = 1;
+
+  std::stable_sort (strokes.begin (), strokes.end (),
+      [] (const PlannedStroke& a, const PlannedStroke& b) {
+        return a.axis != b.axis ? a.axis > b.axis : a.at < b.at;
+      });
+
+  for (size_t i = 0; i < strokes.size (); i++) {
+    const PlannedStroke* k = &strokes[i];
+
+    if (k->axis == HORIZONTAL) {
+      putMove (out, VERTICAL, k->at - y);
+      y = k->at;
+    } else {
+      // The vertical pass starts from the left and one end
+      if (first || strokes[i - 1].axis != VERTICAL) {
+        putLimit (out, HORIZONTAL, -1);
+        putLimit (out, VERTICAL, y > m->height / 2 ? 1 : -1);
+        x = 0;
+        y = y > m->height / 2 ? m->height : 0;
+      }
+      putMove (out, HORIZONTAL, k->at - x);
+      x = k->at;
+    }
+    first = 0;
+
+    out.push_back (SEGMENT_STROKE << 6 | k->axis << 5 | k->sprays);
+    putNumber (out, k->from - from[k->axis]);
+    putNumber (out, k->to - to[k->axis]);
+    from[k->axis] = k->from;
+    to[k->axis] = k->to;
+
+    // Which limit it ends on
+    if (k->axis == HORIZONTAL) x = x ? 0 : m->width;
+    else y = y > m->height / 2 ? 0 : m->height;
+  }
+
+  out.push_back (SEGMENT_END << 6);
+}
+
+/**
+ * Reads the stream back and checks it's the strokes it was written from.
+ */
+int verify (const std::vector<uint8_t>& path,
+    const std::vector<PlannedStroke>& strokes) {
+  SegmentReader r;
+  Segment s;
+  size_t i = 0;
+
+  segmentsBegin (&r, &path[0]);
+  while (segmentNext (&r, &s)) {
+    if (s.op != SEGMENT_STROKE) continue;
+    if (i == strokes.size ()) return -1;
+
+    const PlannedStroke* k = &strokes[i++];
+    if (s.axis != k->axis || s.sprays != k->sprays || s.from != k->from ||
+        s.to != k->to)
+      return -1;
+  }
+
+  return i == strokes.size () ? 0 : -1;
+}
+
+int main (int argc, char** argv) {
+  static Machine m = DEFAULT_MACHINE;
+  static Params p = DEFAULT_PARAMS;
+  const char* out = 0;
+  const char* panels = 0;
+  int vertical = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+
+    if (!strcmp (a, "--vertical")) {
+      vertical = 1;
+    } else if (a[0] != '-') {
+      if (panels) usage ();
+      panels = a;
+    } else if (i + 1 >= argc) {
+      usage ();
+    } else if (!strcmp (a, "-p")) {
+      if (readParams (argv[++i], &p, &m)) {
+        perror (argv[i]);
+        return 2;
+      }
+    } else if (!strcmp (a, "-o")) {
+      out = argv[++i];
+    } else {
+      usage ();
+    }
+  }
+
+  if (!panels) usage ();
+
+  std::vector<Outline> outlines;
+  if (readPanels (panels, m.height / m.countsPerMm, outlines)) {
+    perror (panels);
+    return 2;
+  }
+  if (outlines.empty ()) {
+    fprintf (stderr, "%s: no panels\n", panels);
+    return 2;
+  }
+
+  std::vector<PlannedStroke> strokes;
+  int clipped = 0;
+  for (size_t i = 0; i < outlines.size (); i++) {
+    const Outline* o = &outlines[i];
+
+    printf ("panel %.0f,%.0f-%.0f,%.0f mm\n", o->x0, o->y0, o->x1, o->y1);
+    clipped += planPanel (&m, &p, o, HORIZONTAL, strokes);
+    if (vertical) planPanel (&m, &p, o, VERTICAL, strokes);
+  }
+
+  std::vector<uint8_t> path;
+  encode (&m, strokes, path);
+  if (verify (path, strokes)) {
+    fprintf (stderr, "The toolpath doesn't read back as planned\n");
+    return 1;
+  }
+
+  SimResult r, fixed;
+  simulatePath (&m, &p, &path[0], &r, 0, 0);
+  simulate (&m, &p, &fixed, 0, 0);
+
+  printf ("%zu strokes in %zu bytes, %.1f a stroke\n", strokes.size (),
+      path.size (), (double)path.size () / strokes.size ());
+  if (clipped)
+    printf ("%d strokes ramp onto their panel, move it in from the ends\n",
+        clipped);
+  printf ("cycle %.1fs, the fixed patterns' %.1fs\n", r.cycleTime,
+      fixed.cycleTime);
+
+  if (out) {
+    char file[512], comment[128];
+    FILE* f;
+
+    snprintf (comment, sizeof (comment),
+        "Written by host/toolpath from %s: %zu strokes, %.1fs cycle", panels,
+        strokes.size (), r.cycleTime);
+
+    snprintf (file, sizeof (file), "%s.h", out);
+    if (!(f = fopen (file, "w"))) {
+      perror (file);
+      return 1;
+    }
+    fprintf (f, "#ifndef __TOOLPATH_HDR__\n#define __TOOLPATH_HDR__\n\n");
+    fprintf (f, "// %s\n", comment);
+    fprintf (f, "const uint8_t toolpath[] PROGMEM = {");
+    for (size_t i = 0; i < path.size (); i++)
+      fprintf (f, "%s0x%02x%s", i % 12 ? " " : "\n  ", path[i],
+          i + 1 < path.size () ? "," : "");
+    fprintf (f, "\n};\n\n#endif\n");
+    fclose (f);
+
+    snprintf (file, sizeof (file), "%s.bin", out);
+    if (!(f = fopen (file, "wb"))) {
+      perror (file);
+      return 1;
+    }
+    fwrite (&path[0], 1, path.size (), f);
+    fclose (f);
+  }
+
+  return 0;
+}
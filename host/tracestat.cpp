@@ -0,0 +1,454 @@
+/**
+ * Trace analyzer for captured controller output.
+ *
+ * Memory maps a capture, either binary trace records or the timestamped
+ * text debug output, splits it into chunks parsed on every core and merges
+ * the per-chunk results.
+ *
+ *   tracestat [-j threads] capture...
+ *
+ * Reports stroke durations, where the time went, limit switch bounce and
+ * strokes and jobs per hour.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "Arduino.h"
+#include "messages.h"
+
+#define PINS        64
+#define TREND_ROWS  48
+
+// What the controller was doing between two events
+enum {
+  S_OTHER,
+  S_MOVING,
+  S_SPRAYING,
+  S_REST,
+  S_LIMIT,
+  S_SWITCH,
+  S_FAULT,
+  STATES
+};
+
+const char* stateNames[STATES] = {
+  "other", "moving", "spraying", "resting", "waiting for a limit",
+  "motor switch", "stopped",
+};
+
+typedef struct {
+  long presses;
+  long bounced;
+  long bounces;
+  int most;
+} Bounce;
+
+/**
+ * A stroke or job finishing, for the hourly trend.
+ */
+typedef struct {
+  uint32_t time;
+  int boot;         // Reboots seen in the chunk before it
+  uint8_t kind;
+} Mark;
+
+/**
+ * What one chunk resolved on its own, and what's left to stitch with its
+ * neighbours.
+ */
+typedef struct {
+  double stateTime[STATES];
+  double inherited;         // Time before the first event setting a state
+  std::vector<uint32_t> strokes;
+  std::vector<Mark> marks;
+  std::vector<uint32_t> bootEnds; // Last time seen before each reboot
+  Bounce bounce[PINS];
+  long events;
+  long lines;
+  long faults;
+  long jobs;
+
+  int any;
+  int bootFirst;            // A reboot happened before the first event
+  int fresh;                // A reboot happened since the last event
+  uint32_t first;
+  uint32_t last;
+  int state;                // -1 until an event sets one
+  int leadingEnd;           // A stroke ended before any started
+  uint32_t leadingEndTime;
+  int open;                 // A stroke is still going at the end
+  uint32_t openTime;
+} Partial;
+
+void partialInit (Partial* p) {
+  memset (p->stateTime, 0, sizeof (p->stateTime));
+  memset (p->bounce, 0, sizeof (p->bounce));
+  p->inherited = 0;
+  p->events = p->lines = p->faults = p->jobs = 0;
+  p->any = p->bootFirst = p->fresh = p->leadingEnd = p->open = 0;
+  p->first = p->last = 0;
+  p->state = -1;
+}
+
+/**
+ * Feeds one event through a chunk's state machine.
+ */
+void feed (Partial* p, const TraceRecord* e) {
+  if (e->kind == TRACE_BOOT) {
+    if (!p->any) p->bootFirst = 1;
+    else p->fresh = 1;
+    p->state = S_OTHER;
+    return;
+  }
+
+  p->events++;
+
+  if (!p->any) {
+    p->any = 1;
+    p->first = e->time;
+  } else if (p->fresh || e->time < p->last) {
+    // The controller was reset, if time went backwards without a boot
+    // record the boot message was lost
+    p->bootEnds.push_back (p->last);
+    p->fresh = 0;
+    p->open = 0;
+    p->state = S_OTHER;
+  } else if (p->state < 0) {
+    p->inherited += e->time - p->last;
+  } else {
+    p->stateTime[p->state] += e->time - p->last;
+  }
+  p->last = e->time;
+  int boot = p->bootEnds.size ();
+
+  switch (e->kind) {
+    case TRACE_MOVE:
+      if (p->state != S_SPRAYING) p->state = S_MOVING;
+      break;
+    case TRACE_STROKE:
+      p->state = S_SPRAYING;
+      p->open = 1;
+      p->openTime = e->time;
+      break;
+    case TRACE_STROKE_END:
+      p->state = S_OTHER;
+      if (p->open) {
+        p->strokes.push_back (e->time - p->openTime);
+      } else if (!p->leadingEnd && boot == 0 && p->strokes.empty ()) {
+        p->leadingEnd = 1;
+        p->leadingEndTime = e->time;
+      }
+      p->open = 0;
+      {
+        Mark m = { e->time, boot, TRACE_STROKE_END };
+        p->marks.push_back (m);
+      }
+      break;
+    case TRACE_WAIT:
+      p->state = e->arg == WAIT_REST ? S_REST :
+        e->arg == WAIT_LIMIT ? S_LIMIT : S_SWITCH;
+      break;
+    case TRACE_LIMIT:
+      if (e->arg < PINS) {
+        Bounce* b = &p->bounce[e->arg];
+        b->presses++;
+        b->bounces += e->value;
+        if (e->value) b->bounced++;
+        if (e->value > b->most) b->most = e->value;
+      }
+      if (p->state == S_LIMIT) p->state = S_OTHER;
+      break;
+    case TRACE_JOB:
+      p->state = S_OTHER;
+      if (!e->arg) {
+        Mark m = { e->time, boot, TRACE_JOB };
+        p->marks.push_back (m);
+        p->jobs++;
+      }
+      break;
+    case TRACE_FAULT:
+      p->state = S_FAULT;
+      p->faults++;
+      break;
+  }
+}
+
+/**
+ * Parses "<millis> <message>" lines in place. Lines without a time can't
+ * be placed and are only counted.
+ */
+void parseText (const char* s, const char* end, Partial* p) {
+  while (s < end) {
+    const char* eol = (const char*)memchr (s, '\n', end - s);
+    TraceRecord e;
+
+    if (!eol) eol = end;
+    p->lines++;
+    if (parseLine (s, eol, &e)) feed (p, &e);
+    s = eol + 1;
+  }
+}
+
+void parseBinary (const char* s, const char* end, Partial* p) {
+  TraceRecord e;
+
+  for (; s + sizeof (e) <= end; s += sizeof (e)) {
+    memcpy (&e, s, sizeof (e));
+    if (e.kind == TRACE_BOOT && e.time != TRACE_MAGIC) continue;
+    // The flight recorder's dump is from before the reset
+    if (e.kind == TRACE_FLIGHT || e.kind & TRACE_DUMPED) continue;
+    feed (p, &e);
+  }
+}
+
+typedef struct {
+  double stateTime[STATES];
+  std::vector<uint32_t> strokes;
+  std::vector<double> strokeEnds;   // Hours into the capture
+  std::vector<double> jobEnds;
+  Bounce bounce[PINS];
+  long events, lines, faults, jobs, boots;
+
+  int any;
+  uint32_t last;
+  int state;
+  int open;
+  uint32_t openTime;
+  double offset;                    // Milliseconds of earlier boots
+} Totals;
+
+/**
+ * Stitches a chunk onto everything before it.
+ */
+void merge (Totals* t, Partial* p) {
+  for (int i = 0; i < STATES; i++) t->stateTime[i] += p->stateTime[i];
+  t->strokes.insert (t->strokes.end (), p->strokes.begin (),
+      p->strokes.end ());
+  t->events += p->events;
+  t->lines += p->lines;
+  t->faults += p->faults;
+  t->jobs += p->jobs;
+  for (int i = 0; i < PINS; i++) {
+    Bounce* b = &t->bounce[i];
+    b->presses += p->bounce[i].presses;
+    b->bounced += p->bounce[i].bounced;
+    b->bounces += p->bounce[i].bounces;
+    if (p->bounce[i].most > b->most) b->most = p->bounce[i].most;
+  }
+
+  if (!p->any) {
+    t->boots += p->bootFirst;
+    if (p->bootFirst && t->any) {
+      t->offset += t->last;
+      t->last = 0;
+      t->open = 0;
+    }
+    return;
+  }
+
+  int reset = p->bootFirst || (t->any && p->first < t->last);
+  if (reset) {
+    t->boots++;
+    if (t->any) t->offset += t->last;
+    t->open = 0;
+  } else if (t->any) {
+    // The gap between the chunks and the chunk's own stateless start
+    int state = t->state < 0 ? S_OTHER : t->state;
+    t->stateTime[state] += p->first - t->last + p->inherited;
+    if (t->open && p->leadingEnd)
+      t->strokes.push_back (p->leadingEndTime - t->openTime);
+  }
+
+  double base = t->offset;
+  for (size_t i = 0; i < p->marks.size (); i++) {
+    const Mark* m = &p->marks[i];
+    double at = base;
+    for (int b = 0; b < m->boot; b++) at += p->bootEnds[b];
+    at = (at + m->time) / 3.6e6;
+    if (m->kind == TRACE_JOB) t->jobEnds.push_back (at);
+    else t->strokeEnds.push_back (at);
+  }
+  for (size_t b = 0; b < p->bootEnds.size (); b++)
+    t->offset += p->bootEnds[b];
+  t->boots += p->bootEnds.size ();
+
+  if (p->state >= 0) t->state = p->state;
+  if (p->open) {
+    t->open = 1;
+    t->openTime = p->openTime;
+  } else if (p->state >= 0 || !p->bootEnds.empty ()) {
+    t->open = 0;
+  }
+  t->last = p->last;
+  t->any = 1;
+}
+
+double percentile (std::vector<uint32_t>& v, double q) {
+  size_t i = (size_t)(q * (v.size () - 1));
+  std::nth_element (v.begin (), v.begin () + i, v.end ());
+  return v[i] / 1000.0;
+}
+
+void report (Totals* t) {
+  printf ("%ld events, %ld boots, %ld jobs, %ld faults\n", t->events,
+      t->boots, t->jobs, t->faults);
+
+  std::vector<uint32_t>& s = t->strokes;
+  if (!s.empty ()) {
+    double sum = 0;
+    for (size_t i = 0; i < s.size (); i++) sum += s[i];
+    printf ("\nstrokes %zu: mean %.2fs  p50 %.2fs  p90 %.2fs  p99 %.2fs"
+        "  max %.2fs\n", s.size (), sum / s.size () / 1000.0,
+        percentile (s, 0.5), percentile (s, 0.9), percentile (s, 0.99),
+        percentile (s, 1.0));
+  }
+
+  double total = 0;
+  for (int i = 0; i < STATES; i++) total += t->stateTime[i];
+  if (total > 0) {
+    printf ("\ntime\n");
+    for (int i = 0; i < STATES; i++) {
+      if (!t->stateTime[i]) continue;
+      printf ("  %-20s %10.1fs %5.1f%%\n", stateNames[i],
+          t->stateTime[i] / 1000.0, 100.0 * t->stateTime[i] / total);
+    }
+  }
+
+  int header = 0;
+  for (int i = 0; i < PINS; i++) {
+    Bounce* b = &t->bounce[i];
+    if (!b->presses) continue;
+    if (!header++) printf ("\nlimit bounce\n");
+    printf ("  pin %2d: %ld presses, %.1f%% bounced, %.2f edges each, "
+        "%d at most\n", i, b->presses, 100.0 * b->bounced / b->presses,
+        (double)b->bounces / b->presses, b->most);
+  }
+
+  double hours = 0;
+  for (size_t i = 0; i < t->strokeEnds.size (); i++)
+    hours = std::max (hours, t->strokeEnds[i]);
+  for (size_t i = 0; i < t->jobEnds.size (); i++)
+    hours = std::max (hours, t->jobEnds[i]);
+  if (t->strokeEnds.empty () && t->jobEnds.empty ()) return;
+
+  // At most TREND_ROWS rows of whole hours
+  size_t bucket = (size_t)hours / TREND_ROWS + 1;
+  size_t rows = (size_t)hours / bucket + 1;
+  std::vector<long> strokes (rows), jobs (rows);
+  for (size_t i = 0; i < t->strokeEnds.size (); i++)
+    strokes[(size_t)t->strokeEnds[i] / bucket]++;
+  for (size_t i = 0; i < t->jobEnds.size (); i++)
+    jobs[(size_t)t->jobEnds[i] / bucket]++;
+
+  printf ("\nhour   strokes/h  jobs/h\n");
+  for (size_t r = 0; r < rows; r++)
+    printf ("%5zu %10.1f %7.1f\n", r * bucket, (double)strokes[r] / bucket,
+        (double)jobs[r] / bucket);
+}
+
+/**
+ * Splits a capture into one chunk per thread, on line boundaries for text
+ * and record boundaries for binary, and parses them all at once.
+ *
+ * @return the capture's size in bytes, which may well not fit an int, or
+ *    -1 if it can't be read
+ */
+ssize_t analyze (const char* path, int threads, Totals* t) {
+  int fd = open (path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat (fd, &st)) {
+    perror (path);
+    return -1;
+  }
+
+  size_t size = st.st_size;
+  if (!size) {
+    close (fd);
+    return 0;
+  }
+
+  const char* data = (const char*)mmap (0, size, PROT_READ, MAP_PRIVATE, fd,
+      0);
+  close (fd);
+  if (data == MAP_FAILED) {
+    perror (path);
+    return -1;
+  }
+  madvise ((void*)data, size, MADV_SEQUENTIAL);
+
+  uint32_t magic = 0;
+  if (size >= 4) memcpy (&magic, data, 4);
+  int binary = magic == TRACE_MAGIC;
+
+  std::vector<size_t> cuts (threads + 1);
+  cuts[0] = 0;
+  cuts[threads] = size;
+  for (int i = 1; i < threads; i++) {
+    size_t at = size / threads * i;
+    if (binary) {
+      at -= at % sizeof (TraceRecord);
+    } else {
+      const char* nl = (const char*)memchr (data + at, '\n', size - at);
+      at = nl ? nl - data + 1 : size;
+    }
+    cuts[i] = std::max (at, cuts[i - 1]);
+  }
+
+  std::vector<Partial> parts (threads);
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; i++) {
+    partialInit (&parts[i]);
+    pool.push_back (std::thread (binary ? parseBinary : parseText,
+          data + cuts[i], data + cuts[i + 1], &parts[i]));
+  }
+  for (int i = 0; i < threads; i++) pool[i].join ();
+
+  for (int i = 0; i < threads; i++) merge (t, &parts[i]);
+
+  munmap ((void*)data, size);
+  return size;
+}
+
+int main (int argc, char** argv) {
+  int threads = std::thread::hardware_concurrency ();
+  int i = 1;
+
+  if (i + 1 < argc && !strcmp (argv[i], "-j")) {
+    threads = atoi (argv[i + 1]);
+    i += 2;
+  }
+  if (i >= argc) {
+    fprintf (stderr, "usage: tracestat [-j threads] capture...\n");
+    return 2;
+  }
+  if (threads < 1) threads = 1;
+
+  static Totals t;
+  t.state = -1;
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now ();
+  double bytes = 0;
+  for (; i < argc; i++) {
+    ssize_t n = analyze (argv[i], threads, &t);
+    if (n < 0) return 1;
+    bytes += n;
+  }
+  double elapsed = std::chrono::duration<double> (
+      std::chrono::steady_clock::now () - start).count ();
+
+  fprintf (stderr, "%.0f MB in %.2fs on %d threads\n", bytes / 1e6, elapsed,
+      threads);
+  report (&t);
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * Drives a VFD over Modbus with the firmware's own master.
+ *
+ * Sends a ramp the way goUntilVertical does before a move, then keeps
+ * polling the output frequency, all through src/modbus.h and src/vfd.h
+ * running on the host clock. The firmware gives the drive its speed on
+ * the analog input; with nothing on that here, the frequency is written
+ * to the setpoint register, for a drive set to take it from there.
+ *
+ *   vfdctl [-b baud] [-t seconds] device frequency ramp
+ *
+ * The frequency is in hundredths of a Hz and the ramp in tenths of a
+ * second. host/vfdsim stands in for the drive.
+ */
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "realtime.h"
+#include "vfd.h"
+
+int main (int argc, char** argv) {
+  long baud = VFD_BAUD;
+  double seconds = 3;
+  int i = 1;
+
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (!strcmp (argv[i], "-b")) baud = atol (argv[i + 1]);
+    else if (!strcmp (argv[i], "-t")) seconds = atof (argv[i + 1]);
+  }
+  if (i != argc - 3 || toSpeed (baud) == B0) {
+    fprintf (stderr, "usage: vfdctl [-b baud] [-t seconds] device "
+        "frequency ramp\n");
+    return 2;
+  }
+  if (!serialOpen (&Serial1, argv[i], baud)) {
+    perror (argv[i]);
+    return 1;
+  }
+
+  vfdBegin ();
+  modbusBegin (baud);   // For the frame gap at another baud rate
+  uint16_t frequency = atoi (argv[i + 1]);
+  uint16_t ramp = atoi (argv[i + 2]);
+  uint16_t written = VFD_UNSENT;
+
+  vfdPrepare (ramp);
+  modbusQueue (VFD_SLAVE, MODBUS_WRITE, VFD_FREQUENCY, frequency, &written);
+
+  unsigned long start = millis ();
+  unsigned long shown = 0;
+  unsigned long longest = 0;
+
+  while (millis () - start < seconds * 1000) {
+    unsigned long before = micros ();
+    vfdPoll ();
+    longest = std::max (longest, micros () - before);
+
+    if (millis () - shown >= 250) {
+      shown = millis ();
+      printf ("%6.2fs %7.2f Hz\n", (shown - start) / 1000.0,
+          vfd.output / 100.0);
+    }
+    usleep (200);
+  }
+
+  printf ("%s, %u timeouts, %u errors, longest poll %lu us\n",
+      vfdTook (ramp) && written == frequency ? "settings taken" :
+      "settings not taken", modbus.timeouts, modbus.errors, longest);
+  return 0;
+}
@@ -0,0 +1,191 @@
+/**
+ * A simulated VFD answering Modbus RTU on a pseudo-terminal.
+ *
+ * Holds the registers src/vfd.h uses and ramps its output frequency
+ * towards the setpoint the way the drive would, as if its run relay were
+ * always closed. Prints the name of its
+ * pty, which host/vfdctl (or anything else) can talk to.
+ *
+ *   vfdsim [-a slave] [-e drop-rate] [-l late-rate]
+ *
+ * -e drops that fraction of the requests unanswered and garbles as many
+ * replies, to exercise the master's retries. -l answers that fraction
+ * only after the master has timed out, so the reply lands on its retry.
+ */
+
+#define _XOPEN_SOURCE 600
+#include <poll.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "realtime.h"
+#include "vfd.h"
+
+#define GAP_US    4000    // Silence that ends a frame at 9600 baud
+#define LATE      (MODBUS_TIMEOUT / 1000.0 + 0.03)  // Seconds
+
+typedef struct {
+  uint16_t accel;
+  uint16_t decel;
+  uint16_t frequency;
+  double output;
+  double at;            // When output was last brought up to date
+} Drive;
+
+Drive drive = { VERTICAL_RAMP, VERTICAL_RAMP, 0, 0, 0 };
+uint8_t slave = VFD_SLAVE;
+double dropRate;
+double lateRate;
+
+struct {
+  uint8_t frame[MODBUS_FRAME];
+  int length;
+  double due;           // When it goes out, 0 for nothing held back
+} late;
+
+double now () {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Ramps the output towards the setpoint. The ramp times are in tenths of
+ * a second from a stop to VFD_MAX_FREQUENCY.
+ */
+void update () {
+  double t = now ();
+  double dt = t - drive.at;
+  double target = drive.frequency;
+  uint16_t ramp = target > drive.output ? drive.accel : drive.decel;
+  double step = ramp ? VFD_MAX_FREQUENCY * dt / (ramp * 0.1) : 1e9;
+
+  if (drive.output < target)
+    drive.output = std::min (target, drive.output + step);
+  else
+    drive.output = std::max (target, drive.output - step);
+  drive.at = t;
+}
+
+uint16_t* reg (uint16_t address) {
+  static uint16_t output;
+
+  switch (address) {
+    case VFD_ACCEL: return &drive.accel;
+    case VFD_DECEL: return &drive.decel;
+    case VFD_FREQUENCY: return &drive.frequency;
+    case VFD_OUTPUT:
+      output = (uint16_t)(drive.output + 0.5);
+      return &output;
+    default: return 0;
+  }
+}
+
+void reply (int fd, uint8_t* f, int n) {
+  uint16_t crc = modbusCrc (f, n);
+  f[n++] = crc;
+  f[n++] = crc >> 8;
+
+  if (drand48 () < dropRate) f[n / 2] ^= 0x5a;
+  if (!late.due && drand48 () < lateRate) {
+    memcpy (late.frame, f, n);
+    late.length = n;
+    late.due = now () + LATE;
+    return;
+  }
+  if (write (fd, f, n) < 0) perror ("write");
+}
+
+void exception (int fd, const uint8_t* request, uint8_t code) {
+  uint8_t f[5] = { request[0], (uint8_t)(request[1] | 0x80), code };
+  reply (fd, f, 3);
+}
+
+/**
+ * Answers one complete request frame.
+ */
+void handle (int fd, const uint8_t* f, int n) {
+  if (n != 8 || modbusCrc (f, 6) != (f[6] | f[7] << 8)) {
+    fprintf (stderr, "Dropped a %d byte frame\n", n);
+    return;
+  }
+  if (f[0] != slave || drand48 () < dropRate) return;
+
+  uint16_t address = f[2] << 8 | f[3];
+  uint16_t value = f[4] << 8 | f[5];
+  uint16_t* r = reg (address);
+  update ();
+
+  if (f[1] == MODBUS_READ) {
+    if (value != 1 || !r) return exception (fd, f, 2);
+    uint8_t out[7] = { f[0], f[1], 2, (uint8_t)(*r >> 8), (uint8_t)*r };
+    reply (fd, out, 5);
+  } else if (f[1] == MODBUS_WRITE) {
+    if (!r || address == VFD_OUTPUT) return exception (fd, f, 2);
+    *r = value;
+    printf ("%.3f register 0x%04x = %d\n", now (), address, value);
+    fflush (stdout);
+
+    uint8_t out[8];
+    memcpy (out, f, 6);
+    reply (fd, out, 6);
+  } else {
+    exception (fd, f, 1);
+  }
+}
+
+int main (int argc, char** argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp (argv[i], "-a")) slave = atoi (argv[i + 1]);
+    else if (!strcmp (argv[i], "-e")) dropRate = atof (argv[i + 1]);
+    else if (!strcmp (argv[i], "-l")) lateRate = atof (argv[i + 1]);
+  }
+
+  int fd = posix_openpt (O_RDWR | O_NOCTTY);
+  struct termios t;
+  if (fd < 0 || grantpt (fd) || unlockpt (fd)) {
+    perror ("posix_openpt");
+    return 1;
+  }
+  int s = open (ptsname (fd), O_RDWR | O_NOCTTY);
+  if (s >= 0 && !tcgetattr (s, &t)) {
+    cfmakeraw (&t);
+    tcsetattr (s, TCSANOW, &t);
+  }
+  if (s >= 0) close (s);
+
+  printf ("%s\n", ptsname (fd));
+  fflush (stdout);
+  drive.at = now ();
+  srand48 (1);
+
+  uint8_t frame[MODBUS_FRAME];
+  int n = 0;
+  for (;;) {
+    struct pollfd p = { fd, POLLIN, 0 };
+    int wait = n ? GAP_US / 1000 : -1;
+
+    if (late.due) {
+      int due = std::max (0, (int)((late.due - now ()) * 1000));
+      wait = wait < 0 ? due : std::min (wait, due);
+    }
+    int ready = poll (&p, 1, wait);
+
+    if (late.due && now () >= late.due) {
+      if (write (fd, late.frame, late.length) < 0) perror ("write");
+      late.due = 0;
+    }
+
+    if (ready > 0 && (p.revents & POLLIN)) {
+      uint8_t c;
+      if (read (fd, &c, 1) == 1 && n < MODBUS_FRAME) frame[n++] = c;
+    } else if (ready == 0 && n) {
+      handle (fd, frame, n);
+      n = 0;
+    } else if (ready > 0) {
+      // Nobody has the other side open yet
+      usleep (10000);
+    }
+  }
+}
@@ -21,15 +21,53 @@
 #define MIN                 2
 #define MAX                 15
 
+// Set to start each transition while the stroke before it slows into its
+// limit, with the guns already closed, instead of after it has stopped
+#define BLENDED_TURNAROUNDS 1
+
+// Where the panel is, in steps right of the left limit and encoder counts
+// up from the bottom one. The guns are only open over it, and only once the
+// carriage is at speed. 0 and 0 opens them from limit to limit.
+#define PANEL_LEFT          0
+#define PANEL_RIGHT         0
+#define PANEL_BOTTOM        0
+#define PANEL_TOP           0
+
+// How wide a band one gun covers and how far apart the two guns are, in
+// steps across vertical strokes and counts across horizontal ones, and how
+// much of a band, in percent, the next stroke goes over again. With the
+// panel's bounds, the strokes are spaced to these instead of the stroke
+// gaps. A fan of 0 keeps the stroke gaps.
+#define FAN_STEPS           0
+#define FAN_COUNTS          0
+#define GUN_STEPS           6000
+#define GUN_COUNTS          6000
+#define STROKE_OVERLAP      30
+
 // Milliseconds to wait after a change in limit switch state
 #define DEBOUNCE_TIME       150
-#define MOTOR_SWITCH_DELAY  3000 // Wait 3 seconds after switching off the motor
+
+// Both VFD direction relays are held open this long before a reversal
+#define MOTOR_DEAD_TIME     200
 
 // Microseconds between each step
 #define HORIZONTAL_STEPPER_MIN_DELAY  150
 #define HORIZONTAL_STEPPER_MAX_DELAY  1600
 #define HORIZONTAL_STEPPER_START_GAP  600
 
+// Shapes the horizontal moves against the carriage and gun mount ringing
+// (see shaper.h): SHAPER_OFF, SHAPER_ZV or SHAPER_ZVD. The ringing is at
+// SHAPER_FREQUENCY tenths of a Hz with a damping ratio of SHAPER_DAMPING
+// thousandths. Shaped moves slow down onto their count, and into a limit
+// once they know how far it is. Timer1's ramps, with HARDWARE_STEPPING,
+// aren't shaped.
+#define SHAPER_OFF          0
+#define SHAPER_ZV           1
+#define SHAPER_ZVD          2
+#define SHAPER              SHAPER_OFF
+#define SHAPER_FREQUENCY    150
+#define SHAPER_DAMPING      50
+
 // The directions that lead the paint head towards the left and right
 #define LEFT_DIRECTION      1
 #define RIGHT_DIRECTION     0
@@ -41,34 +79,138 @@
 #define TOP_SPRAY           34
 #define BOTTOM_SPRAY        35
 
+// On, the gun holder is turned 90 degrees for vertical strokes. It takes
+// GUN_SETTLE milliseconds to get there and stop swinging either way.
+#define GUN_ROTATION        MOT_1_SEL
+#define GUN_SETTLE          500
+
 // Induction motor pins
 #define HORIZONTAL_SPEED          0
 #define VERTICAL_SPEED            1
 
+// The vertical VFD's Modbus link, on an RS485 transceiver on Serial1
+#define VFD_SLAVE           1
+#define VFD_BAUD            9600
+#define VFD_MAX_FREQUENCY   5000 // Hundredths of a Hz, the analog full scale
+
+// Vertical moves run at this frequency, in hundredths of a Hz, ramping
+// over VERTICAL_RAMP tenths of a second from a stop to VFD_MAX_FREQUENCY
+#define VERTICAL_FREQUENCY  5000
+#define VERTICAL_RAMP       5
+
+// The vertical encoder, swap the channels if it counts down going up
+#define ENCODER_A           ENC_A
+#define ENCODER_B           ENC_B
+
+// PWM to the VFD's analog frequency input, through a 0-10 V converter
+#define VFD_SPEED           PWM_1
+
+// Vertical position loop gains, in 256ths of a duty step per encoder
+// count (P), per count and tick (I) and per count per tick of speed (D)
+#define VERTICAL_KP         512
+#define VERTICAL_KI         4
+#define VERTICAL_KD         2048
+
+// The position loop's rate in Hz, and how many of its ticks without an
+// encoder count mean the carriage has stopped
+#define PID_RATE            100
+#define PID_SETTLE          10
+
+// The limit switches are sampled this often, in Hz, by the timer that
+// runs the position loop every SAMPLE_RATE / PID_RATE samples
+#define SAMPLE_RATE         1000
+
+// The encoder's index channel, on an external interrupt pin, if it has one
+// #define ENCODER_INDEX       21
+
 // Stepper motor pins
 #define HORIZONTAL_STEPPER_DIRECTION    STP_1_DIR
 #define HORIZONTAL_STEPPER_STEP         STP_1_STP
 #define HORIZONTAL_STEPPER_ENABLE       STP_1_EN
 
+// Define to step from Timer1's output compare instead of the step pin, with
+// the driver's STEP input on OC1A and jumpered on to T5 to count the steps.
+// Without it Timer1's interrupt works the step pin, from a queue of steps
+// #define HARDWARE_STEPPING
+#define HORIZONTAL_STEPPER_PULSE        11
+#define HORIZONTAL_STEPPER_COUNT        47
+
+// Define to paint panels as a conveyor carries them through, left to right.
+// CONVEYOR_RATE is its feed in steps a second and CONVEYOR_RATIO how many
+// carriage steps, in 256ths, it moves a panel a step. The carriage keeps
+// CONVEYOR_MARGIN steps clear of the horizontal limits.
+// #define CONVEYOR
+#define CONVEYOR_STEPPER_DIRECTION      STP_2_DIR
+#define CONVEYOR_STEPPER_STEP           STP_2_STP
+#define CONVEYOR_STEPPER_ENABLE         STP_2_EN
+#define CONVEYOR_DIRECTION  0   // The level that carries the panels right
+#define CONVEYOR_RATE       100
+#define CONVEYOR_RATIO      256
+#define CONVEYOR_MARGIN     500
+
+// Define to split the panel between two carriages, the second on STP_3 and
+// right of the first, each homing on its own end's limit. DUAL_ROOM is the
+// second's place at the right limit in steps from the first's at the left
+// one, and DUAL_KEEP_OUT the closest they may come, counted in steps as
+// there's no switch between them.
+// #define DUAL_CARRIAGE
+#define SECOND_STEPPER_DIRECTION        STP_3_DIR
+#define SECOND_STEPPER_STEP             STP_3_STP
+#define SECOND_STEPPER_ENABLE           STP_3_EN
+#define DUAL_ROOM           30000
+#define DUAL_KEEP_OUT       4000
+
+// Define to give the panels on the bed COATS coats each. There are
+// STATION_COUNT of them side by side, between their STATION_BOUNDS in steps
+// right of the left limit, each stained with its STATION_STAINS entry. A
+// coat of stain n dries for the nth of STAIN_DRY, in seconds, before the
+// next, and the carriage paints the other stations meanwhile.
+// #define MULTI_COAT
+#define STATION_COUNT       2
+#define STATION_BOUNDS      { { 1000, 19000 }, { 21000, 39000 } }
+#define STATION_STAINS      { 0, 1 }
+#define COATS               3
+#define STAINS              2
+#define STAIN_DRY           { 600, 900 }
+
+// Define to run the toolpath host/toolpath wrote to toolpath.h instead of
+// the stroke patterns
+// #define TOOLPATH
+
+// Define to paint the PART_COUNT parts laid out on the bed, each of
+// PART_BOUNDS { left, right, bottom, top } in steps right of the left limit
+// and counts up from the bottom one, in rows that skip the bed between them
+// #define SPARSE_BED
+#define PART_COUNT          4
+#define PART_BOUNDS         { { 2000, 12000, 2000, 12000 }, \
+                              { 20000, 36000, 2000, 8000 }, \
+                              { 2000, 16000, 24000, 36000 }, \
+                              { 26000, 34000, 28000, 34000 } }
+
 // Limit switch pins
 #define TOP_LIMIT           LM_1
 #define BOTTOM_LIMIT        LM_4
 #define LEFT_LIMIT          LM_3
 #define RIGHT_LIMIT         LM_2
 
-#define LED   50
+#define LED   STATUS_LED
+
+// Pauses and resumes a job between strokes, pressed pulls it low
+#define PAUSE_BUTTON        BTN_2
+
+// Step through the recipes in the EEPROM, for the next job, pressed pulls
+// them low. RECIPES is the most the table holds.
+#define RECIPE_NEXT         BTN_1
+#define RECIPE_PREVIOUS     BTN_3
+#define RECIPES             16
 
-#define goLeft(delay) digitalWrite(HORIZONTAL_STEPPER_DIRECTION, LEFT_DIRECTION);\
-                digitalWrite(HORIZONTAL_STEPPER_STEP, 1);\
-                delayMicroseconds(delay);\
-                digitalWrite(HORIZONTAL_STEPPER_STEP, 0);\
-                delayMicroseconds(delay);
+// Milliseconds between status reports in debug builds
+#define STATUS_INTERVAL     5000
 
-#define goRight(delay) digitalWrite(HORIZONTAL_STEPPER_DIRECTION, RIGHT_DIRECTION);\
-                digitalWrite(HORIZONTAL_STEPPER_STEP, 1);\
-                delayMicroseconds(delay);\
-                digitalWrite(HORIZONTAL_STEPPER_STEP, 0);\
-                delayMicroseconds(delay);
+// Define to keep the last FLIGHT_RECORDS trace events, 8 bytes each, in RAM
+// a reset leaves alone and dump them over serial on the next boot
+#define FLIGHT_RECORDER
+#define FLIGHT_RECORDS      64
 
 #define horizontalOff { digitalWrite (HORIZONTAL_STEPPER_ENABLE, HIGH); }
 #define horizontalOn { digitalWrite (HORIZONTAL_STEPPER_ENABLE, LOW); }
@@ -5,23 +5,65 @@
 #include "limits.h"
 #include "sprays.h"
 #include "controls.h"
+#include "params.h"
+#include "vfd.h"
+#include "pid.h"
+#include "stepper.h"
+#include "conveyor.h"
+#include "dual.h"
+#include "overtravel.h"
+#include "spacing.h"
+#include "schedule.h"
+#include "segments.h"
+#include "layout.h"
+#include "recipes.h"
+#include "shaper.h"
+#include "ram.h"
 
 struct {
   int vertical;
   int horizontal;
+  uint8_t closed;     // The current stroke's guns are closed
 } strokes;
 
-typedef struct {
-  int min;
-  int max;
-  int stepsToStart;
-} Profile;
+/**
+ * The pattern under way's strokes, when they're spaced to the fan.
+ */
+Spacing spacing;
+uint8_t spaced;
 
-volatile int verticalCounter;
+/**
+ * The guns a toolpath's stroke opens, or 0 to zone them by the count.
+ */
+uint8_t strokeSprays;
+
+/**
+ * Set, by axis, once a move to a limit is slowing into it. Blended
+ * turnarounds close the guns and start the transition then.
+ */
+uint8_t braking[2];
 
-const Profile horizontalProfile = {HORIZONTAL_STEPPER_MIN_DELAY,
-  HORIZONTAL_STEPPER_MAX_DELAY,
-  HORIZONTAL_STEPPER_START_GAP};
+/**
+ * Where the carriage is, in steps right of the left limit.
+ */
+long carriageX;
+
+#ifdef HARDWARE_STEPPING
+int carriageSign;     // Which way Timer5's count goes, 1 right
+#endif
+
+/**
+ * Returns where the carriage is, with a move under way. carriageX is
+ * where the steps queued so far take it.
+ */
+long carriagePosition () {
+#ifdef HARDWARE_STEPPING
+  if (stepper.running) return carriageX + carriageSign * (long)stepperSteps ();
+  return carriageX;
+#else
+  return carriageX - stepperQueued ();
+#endif
+}
 
 /**
  * Returns whether a direction is vertical
@@ -30,127 +72,271 @@ int isVertical(int direction) {
   return direction == UP || direction == DOWN;
 }
 
+#ifndef HARDWARE_STEPPING
 /**
- * Take one step in a given direction.
+ * Queues one step in a given direction for Timer1 to take, once there's
+ * room for it. A step the other way waits for the ones queued to be taken.
  */
-inline void go (int direction, long delay) {
-  switch (direction) {
-    case LEFT:
-      goLeft(delay);
-      break;
-    case RIGHT:
-      goRight(delay);
-      break;
-    case UP:
-      Stop ("Going up with old functionality...");
-      // TODO goUp(delay);
-      break;
-    case DOWN:
-      Stop ("Going down with old functionality...");
-      // TODO goDown(delay);
-      break;
+char step (Pt* pt, int direction, int delay) {
+  PT_BEGIN (pt);
+
+  PT_WAIT_UNTIL (pt, stepperRoom (direction));
+  if (stepperIdle ()) {
+    digitalWrite (HORIZONTAL_STEPPER_DIRECTION,
+        direction == LEFT ? LEFT_DIRECTION : RIGHT_DIRECTION);
+#ifdef DUAL_CARRIAGE
+    if (second.coupled) digitalWrite (SECOND_STEPPER_DIRECTION,
+        direction == LEFT ? LEFT_DIRECTION : RIGHT_DIRECTION);
+#endif
   }
+
+#ifdef DUAL_CARRIAGE
+  stepperQueue (direction, delay, second.coupled);
+  if (second.coupled) second.x += direction == LEFT ? -1 : 1;
+#else
+  stepperQueue (direction, delay, 0);
+#endif
+  carriageX += direction == LEFT ? -1 : 1;
+
+  PT_END (pt);
 }
+#endif
 
 void stopVertical () {
-  digitalWrite (MOTOR_UP, LOW);
-  digitalWrite (MOTOR_DOWN, LOW);
+  pidStop ();
+  pidApply ();
 }
 
+/**
+ * Runs open loop at the top speed, for moves to a limit.
+ */
 void goVertical (int direction) {
-  if (direction == UP) {
-    digitalWrite (MOTOR_DOWN, LOW);
-    digitalWrite (MOTOR_UP, HIGH);
-  } else {
-    digitalWrite (MOTOR_UP, LOW);
-    digitalWrite (MOTOR_DOWN, HIGH);
-  }
+  pidRun (direction == UP ? pid.most : -pid.most);
+  pidApply ();
 }
 
-void goUntilVertical (int direction, int steps) {
-  int limit = getDirection (limit);
+/**
+ * Keeps the position loop's output, the direction relays and the VFD's
+ * link going. Runs as its own task, so vertical moves only wait.
+ */
+void verticalPoll () {
+  pidApply ();
+  interlockPoll ();
+  vfdPoll ();
+}
+
+char goUntilVertical (Pt* pt, int direction, long steps) {
+  static Pt child;
+  static int limit;
+  static uint8_t moves;
+
+  PT_BEGIN (pt);
+
+  limit = getLimit (direction);
+  braking[VERTICAL] = 0;
+
+  // The drive gets its ramps before the relay starts it, and its speed as
+  // the top of the analog input
+  vfdPrepare (params.verticalRamp);
+  pidTopSpeed (params.verticalFrequency);
+  PT_WAIT_UNTIL (pt, vfdReady ());
+  if (!vfdTook (params.verticalRamp))
+    debug ("The VFD didn't take its ramps, going on with the old ones");
 
   if (steps == LIMIT) {
     goVertical (direction);
-    while (!digitalRead (limit));
-    delay (DEBOUNCE_TIME);
+    PT_WAIT_UNTIL (pt, limitPressed (limit));
+    braking[VERTICAL] = 1;
+    PT_SPAWN (pt, &child, debounce (&child, limit));
     stopVertical ();
   } else {
-    verticalCounter = 0;
-    goVertical (direction);
-    while (verticalCounter < steps && !digitalRead (limit));
+    // Closed loop, braking onto the count instead of coasting past it
+    moves = seen.moves;
+    pidMoveTo (encoderPosition () + (direction == UP ? steps : -steps));
+    PT_WAIT_UNTIL (pt, seen.moves != moves || limitPressed (limit));
     stopVertical ();
   }
 
-  delay (MOTOR_REST);
+  // The encoder tells when the carriage has stopped, no need to rest
+  trace (TRACE_WAIT, WAIT_REST, 0);
+  PT_WAIT_UNTIL (pt, pidStopped ());
+
+  // The bottom limit is the encoder's zero
+  if (steps == LIMIT && direction == DOWN) encoderZero ();
+
+  PT_END (pt);
 }
 
-/**
- * Keeps moving in the given direction until the direction's limit switch is
- * pressed if steps == LIMIT
- * Otherwise move until one of the following events occur:
- *  The limit switch in that direction is pressed
- *  The number of steps has been done
- */
-void goUntil (int direction, int steps) {
-#ifdef __debug__
-  char msg[100];
-  if(steps == LIMIT)
-    sprintf (msg, "Going to the %s end of the machine", extremeStr (direction));
-  else
-    sprintf (msg, "Going %d steps in the %s direction", steps, nameStr (direction));
+char goUntilHorizontal (Pt* pt, int direction, long steps) {
+  static Pt child;
+  static int limit;
+  static Profile p;
+#ifndef HARDWARE_STEPPING
+  static q16 decrement;
+  static q16 mot_delay;     // Microseconds a half step
+  static Shaper shaper;
+  static Ramp ramp;
+  static Shaped shaped;
+  static long elapsed;      // Microseconds into a shaped move's plan
+  long dropped;             // Queued steps the limit cut off
 #endif
+  static long stepsSoFar;
+  static long travel;       // Steps from limit to limit, once run
+  static uint8_t fromEnd;   // Started at the other limit
 
-  debug (msg);
-  int limit = getLimit (direction);
+  PT_BEGIN (pt);
 
-  if (isVertical (direction)) {
-    return goUntilVertical (direction, steps);
-  }
+  limit = getLimit (direction);
+  fromEnd = steps == LIMIT &&
+    limitPressed (getLimit (direction == LEFT ? RIGHT : LEFT));
+  braking[HORIZONTAL] = 0;
 
-  Profile p = horizontalProfile;
+  p = params.horizontal;
 
   horizontalOn;
 
-  float decrement = (float)(p.max - p.min) / (float)p.stepsToStart;
-  Serial.println (decrement);
-  float mot_delay = (float)p.max;
+  stepsSoFar = 0;
+
+#ifdef HARDWARE_STEPPING
+  digitalWrite (HORIZONTAL_STEPPER_DIRECTION,
+      direction == LEFT ? LEFT_DIRECTION : RIGHT_DIRECTION);
+  carriageSign = direction == LEFT ? -1 : 1;
+  stepperStart (&p, steps == LIMIT ? 0 : steps + 1,
+      !(params.blend && fromEnd && travel) ? 0 :
+      travel > p.stepsToStart ? travel - p.stepsToStart : 1);
+
+  while (!limitPressed (limit) && stepper.running) {
+    if (stepper.braking) braking[HORIZONTAL] = 1;
+    PT_YIELD (pt);
+  }
 
-  int stepsSoFar = 0;
+  stepperHalt ();
+  stepsSoFar = stepperSteps ();
+  carriageX += direction == LEFT ? -stepsSoFar : stepsSoFar;
+#else
+  if (params.shaper) {
+    // Slowing into the limit as well, once it's known how far it is
+    shaperPlan (&params, &shaper);
+    rampPlan (&ramp, &p, steps != LIMIT ? steps + 1L :
+        fromEnd && travel ? travel : LIMIT);
+    shapedPlan (&shaped, &shaper, &ramp);
+    elapsed = 0;
 
-  while (!digitalRead (limit) && stepsSoFar < p.stepsToStart) {
-    if(steps != LIMIT) {
-      if (stepsSoFar > steps) break;
+    // Timed by the plan's own clock, a step's worth at a time, so the
+    // steps add up to the planned distance however long each really takes
+    while (!limitPressed (limit)) {
+      if (steps != LIMIT && stepsSoFar > steps) break;
+
+      if (elapsed >= ramp.slowing) braking[HORIZONTAL] = 1;
+      mot_delay = q16FromInt (shapedDelay (&shaped, elapsed));
+      elapsed += 2 * q16ToInt (mot_delay);
+
+      PT_SPAWN (pt, &child, step (&child, direction, q16ToInt (mot_delay)));
+      stepsSoFar++;
     }
+  } else {
+    decrement = q16Div (p.max - p.min, p.stepsToStart);
+#ifdef __debug__
+    {
+      char msg[40];
+      sprintf (msg, "Ramping by %ld.%03ld us a step", q16ToInt (decrement),
+          (decrement & 0xffff) * 1000L >> 16);
+      debug (msg);
+    }
+#endif
+    mot_delay = q16FromInt (p.max);
 
-    go (direction, (int)mot_delay);
-    if (mot_delay > p.min) {
-      if(mot_delay - decrement >= p.min)
-        mot_delay -= decrement;
-      else {
-        mot_delay = p.min;
+    while (!limitPressed (limit) && stepsSoFar < p.stepsToStart) {
+      if(steps != LIMIT) {
+        if (stepsSoFar > steps) break;
       }
+
+      PT_SPAWN (pt, &child, step (&child, direction, q16ToInt (mot_delay)));
+      if (mot_delay > q16FromInt (p.min)) {
+        if(q16Sub (mot_delay, decrement) >= q16FromInt (p.min))
+          mot_delay = q16Sub (mot_delay, decrement);
+        else {
+          mot_delay = q16FromInt (p.min);
+        }
+      }
+      stepsSoFar++;
     }
-    stepsSoFar++;
-  }
 
 
-  while (!digitalRead (limit)) {
-    if(steps != LIMIT) {
-      if (stepsSoFar > steps) break;
+    while (!limitPressed (limit)) {
+      if(steps != LIMIT) {
+        if (stepsSoFar > steps) break;
+      }
+
+      // Blended, slow down into a limit whose distance is known
+      if (params.blend && fromEnd && travel &&
+          stepsSoFar >= travel - p.stepsToStart) {
+        braking[HORIZONTAL] = 1;
+        if (q16Add (mot_delay, decrement) <= q16FromInt (p.max))
+          mot_delay = q16Add (mot_delay, decrement);
+      }
+
+      PT_SPAWN (pt, &child, step (&child, direction, q16ToInt (mot_delay)));
+      stepsSoFar++;
     }
+  }
+
+  // The last steps are still queued, unless the limit cuts them short
+  PT_WAIT_UNTIL (pt, stepperIdle () || limitPressed (limit));
+  dropped = stepperHalt ();
+  stepsSoFar -= labs (dropped);
+  carriageX -= dropped;
+#ifdef DUAL_CARRIAGE
+  if (second.coupled) second.x -= dropped;
+#endif
+#endif
+
+  if (fromEnd) travel = stepsSoFar;
+  if (direction == LEFT && limitPressed (limit)) carriageX = 0;
 
-    go (direction, mot_delay);
-    stepsSoFar++;
+  // Blended, the next move is on the other axis and needn't wait
+  if (!params.blend) {
+    horizontalOff;
+
+    trace (TRACE_WAIT, WAIT_REST, params.motorRest);
+    PT_SLEEP (pt, params.motorRest);
+
+    horizontalOn;
   }
 
-  horizontalOff;
+  PT_SPAWN (pt, &child, debounce (&child, limit));
+
+  PT_END (pt);
+}
 
-  delay(MOTOR_REST);
+/**
+ * Keeps moving in the given direction until the direction's limit switch is
+ * pressed if steps == LIMIT
+ * Otherwise move until one of the following events occur:
+ *  The limit switch in that direction is pressed
+ *  The number of steps has been done
+ *
+ * The Pt goes straight to the axis' own thread, so a vertical and a
+ * horizontal move can run at the same time.
+ */
+char goUntil (Pt* pt, int direction, long steps) {
+  if (pt->line == 0) {
+#ifdef __debug__
+    char msg[100];
+    if(steps == LIMIT)
+      sprintf (msg, "Going to the %s end of the machine", extremeStr (direction));
+    else
+      sprintf (msg, "Going %ld steps in the %s direction", steps, nameStr (direction));
+    debug (msg);
+#endif
 
-  horizontalOn;
+    trace (TRACE_MOVE, direction, steps == LIMIT ? TRACE_LIMIT_MOVE :
+        steps < TRACE_LIMIT_MOVE ? (uint16_t)steps : TRACE_LIMIT_MOVE - 1);
+  }
 
-  delay(DEBOUNCE_TIME);
+  return isVertical (direction) ?
+    goUntilVertical (pt, direction, steps) :
+    goUntilHorizontal (pt, direction, steps);
 }
 
 /**
@@ -158,41 +344,81 @@ void goUntil (int direction, int steps) {
  *
  * @param direction is the direction to move a stroke's distance towards
  */
-void transition (int direction) {
+char transition (Pt* pt, int direction) {
+  static Pt child;
+  static int gap;
+
+  PT_BEGIN (pt);
+
+  gap = spaced ? spacing.gap : isVertical (direction) ?
+    params.verticalStrokeGap : params.horizontalStrokeGap;
+
 #ifdef __debug__
-  static char msg[100];
-  sprintf (msg, "Going %s by %d steps", nameStr (direction), STROKE_GAP);
-  debug (msg);
+  {
+    char msg[100];
+    sprintf (msg, "Going %s by %d steps", nameStr (direction), gap);
+    debug (msg);
+  }
 #endif
-  int limit = getLimit (direction);
 
   turnOffSprays ();
-  goUntil(direction,
-      (isVertical(direction) ?
-       VERTICAL_STROKE_GAP :
-       HORIZONTAL_STROKE_GAP)
-      );
+  PT_SPAWN (pt, &child, goUntil (&child, direction, gap));
+
+  PT_END (pt);
 }
 
 /**
  * Wait for a sequence of Left Left or Right Right limit switch presses.
  *
- * @return if Left Left, return the pin for the Right limit switch,
- *          Otherwise, return the pin for the Left limit switch
+ * @param endPoint is set to the pin for the Right limit switch if Left Left,
+ *          Otherwise, to the pin for the Left limit switch
  */
-int horizontalStrokeWait () {
+char horizontalStrokeWait (Pt* pt, int* endPoint) {
+  static Pt child;
+  static int limit;
+
+  PT_BEGIN (pt);
+
   debug ("Waiting for a horizontal stroke");
-  char limit = waitPressHorizontal();
+  PT_SPAWN (pt, &child, waitPressHorizontal (&child, &limit));
 
   if (limit == LEFT_LIMIT) {
     debug ("Left limit pressed");
     debug ("Going to the right...");
-    return RIGHT_LIMIT;
+    *endPoint = RIGHT_LIMIT;
   } else {
     debug ("Right limit pressed");
     debug ("Going to the left");
-    return LEFT_LIMIT;
+    *endPoint = LEFT_LIMIT;
+  }
+
+  PT_END (pt);
+}
+
+/**
+ * Waits for the start of a vertical stroke and sets endPoint to the limit
+ * switch pin that if pressed would indicate the stroke is finished.
+ */
+char verticalStrokeWait (Pt* pt, int* endPoint) {
+  static Pt child;
+  static int limit;
+
+  PT_BEGIN (pt);
+
+  debug ("Waiting for a vertical stroke");
+  PT_SPAWN (pt, &child, waitPressVertical (&child, &limit));
+
+  if (limit == BOTTOM_LIMIT) {
+    debug ("Bottom limit pressed");
+    debug ("Going to the top...");
+    *endPoint = TOP_LIMIT;
+  } else {
+    debug ("Top limit pressed");
+    debug ("Going to the bottom...");
+    *endPoint = BOTTOM_LIMIT;
   }
+
+  PT_END (pt);
 }
 
 /**
@@ -200,93 +426,786 @@ int horizontalStrokeWait () {
  * Otherwise, if the stroke is less than MIN, spray only the BOTTOM_SPRAY
  *            if the stroke is greater than MAX, spray only the TOP_SPRAY
  */
-void stroke (int axis) {
-  int* strokeCount = (axis == VERTICAL ? &(strokes.vertical) : &(strokes.horizontal));
-  int endPoint = (axis == VERTICAL ? verticalStrokeWait() : horizontalStrokeWait ());
+void zoneSprays (int count) {
+  if (strokeSprays) {
+    if (strokeSprays == (SEGMENT_TOP | SEGMENT_BOTTOM)) bothSprays ();
+    else if (strokeSprays == SEGMENT_TOP) topSpray ();
+    else bottomSpray ();
+    return;
+  }
 
-  // Turn on the appropriate solenoids based on which stroke
-  // is currently being drawn
-  if (*strokeCount >= MIN && *strokeCount <= MAX) {
+  int sprayMin = spaced ? spacing.sprayMin : params.sprayMin;
+  int sprayMax = spaced ? spacing.sprayMax : params.sprayMax;
+
+  if (count >= sprayMin && count <= sprayMax) {
     bothSprays ();
-  } else if (*strokeCount < MIN) {
+  } else if (count < sprayMin) {
     topSpray ();
-  } else if (*strokeCount > MAX) {
+  } else if (count > sprayMax) {
     bottomSpray ();
   }
+}
 
-  goUntil(getDirection(endPoint), LIMIT);
+/**
+ * Returns whether a planned stroke's guns should be open now.
+ */
+int strokeWindow (int axis, const Window* w) {
+  if (axis == HORIZONTAL) return inWindow (w, carriagePosition ());
+  return inWindow (w, encoderPosition ()) && pidCruising ();
+}
 
-  waitPress (endPoint);
+/**
+ * Runs a stroke from one limit to the other with the guns zoned by
+ * zoneSprays, open all the way or, planned, only over the panel (see
+ * overtravel.h).
+ */
+char stroke (Pt* pt, int axis) {
+  static Pt child;
+  static int* strokeCount;
+  static int endPoint;
+  static uint8_t moved;
+  static uint8_t planned;
+  static uint8_t open;
+  static Window window;
+
+  PT_BEGIN (pt);
+
+  strokes.closed = 0;
+  strokeCount = (axis == VERTICAL ? &(strokes.vertical) : &(strokes.horizontal));
+  if (axis == VERTICAL)
+    PT_SPAWN (pt, &child, verticalStrokeWait (&child, &endPoint));
+  else
+    PT_SPAWN (pt, &child, horizontalStrokeWait (&child, &endPoint));
+
+  // Usually turned at the start of the reset and settled by now
+  gunRotate (axis);
+  if (!gunSettled ()) {
+    trace (TRACE_WAIT, WAIT_REST, 0);
+    PT_WAIT_UNTIL (pt, gunSettled ());
+  }
+
+  trace (TRACE_STROKE, axis, *strokeCount);
+
+  planned = planStroke (&params, axis, getDirection (endPoint),
+      axis == HORIZONTAL ? carriagePosition () : encoderPosition (), &window);
+  if (planned && window.clipped)
+    debug ("The ramp runs onto the panel, its edge is left unpainted");
+
+  // Turn on the appropriate solenoids based on which stroke
+  // is currently being drawn
+  open = !planned;
+  if (open) zoneSprays (*strokeCount);
+
+  // Blended, the guns close as soon as the move starts slowing down
+  PT_INIT (&child);
+  for (;;) {
+    moved = goUntil (&child, getDirection (endPoint), LIMIT) == PT_EXITED;
+    if (moved || (params.blend && braking[axis])) break;
+
+    if (planned && strokeWindow (axis, &window) != open) {
+      open = !open;
+      if (open) zoneSprays (*strokeCount);
+      else turnOffSprays ();
+    }
+
+    PT_YIELD (pt);
+  }
+
+  if (moved) PT_SPAWN (pt, &child, waitPress (&child, endPoint));
 
   turnOffSprays ();
+  strokes.closed = 1;
+
+  trace (TRACE_STROKE_END, axis, *strokeCount);
 
-  *strokeCount++;
+  (*strokeCount)++;
 
   debug ("Done spraying...");
+
+  // The rest of the move, with the transition under way beside it
+  if (!moved)
+    PT_WAIT_UNTIL (pt, goUntil (&child, getDirection (endPoint), LIMIT) ==
+        PT_EXITED);
+
+  PT_END (pt);
 }
 
 /**
- * Waits for the start of a vertical stroke and returns the limit switch
- * pin that if pressed would indicate the stroke is finished.
+ * Set by the operator task, holds a job back between strokes.
  */
-int verticalStrokeWait () {
-  debug ("Waiting for a vertical stroke");
-  char limit = waitPressVertical();
+int paused;
 
-  if (limit == BOTTOM_LIMIT) {
-    debug ("Bottom limit pressed");
-    debug ("Going to the top...");
-    return TOP_LIMIT;
-  } else {
-    debug ("Top limit pressed");
-    debug ("Going to the bottom...");
-    return BOTTOM_LIMIT;
+/**
+ * Does strokes perpendicular to the given direction.
+ */
+char doStrokes (Pt* pt, int direction) {
+  static Pt child;
+  static Pt next;
+  static int axis;
+  static uint8_t stroked;
+  static uint8_t moved;
+  static int done;
+
+  PT_BEGIN (pt);
+
+#ifdef __debug__
+  {
+    char msg[100];
+    sprintf (msg, "Doing %s strokes until the %s limit is reached",
+        !isVertical (direction) ? "vertical" : "horizontal",
+        nameStr (direction));
+    debug (msg);
   }
+#endif
+
+  axis = isVertical (direction) ? HORIZONTAL : VERTICAL;
+  *(axis == VERTICAL ? &strokes.vertical : &strokes.horizontal) = 0;
+
+  // Spaced to the fan, the strokes start half a fan into the panel and
+  // stop once it's covered instead of at the limit
+  spaced = (direction == UP || direction == RIGHT) &&
+    planSpacing (&params, isVertical (direction) ? VERTICAL : HORIZONTAL,
+        &spacing);
+  if (spaced) {
+#ifdef __debug__
+    {
+      char msg[60];
+      sprintf (msg, "%d strokes %d apart", spacing.count, spacing.gap);
+      debug (msg);
+    }
+#endif
+    if (spacing.clamped)
+      debug ("The panel is too near the limit, its first stroke is off it");
+    PT_SPAWN (pt, &child, goUntil (&child, direction, spacing.first));
+  }
+
+  for (done = 0; !limitPressed (getLimit (direction)); done++) {
+    PT_WAIT_WHILE (pt, paused);
+
+    // No transition after the last one
+    if (spaced && done == spacing.count - 1) {
+      PT_SPAWN (pt, &child, stroke (&child, axis));
+      break;
+    }
+
+    if (!params.blend) {
+      PT_SPAWN (pt, &child, stroke (&child, axis));
+      PT_SPAWN (pt, &child, transition (&child, direction));
+      continue;
+    }
+
+    // Blended, the transition starts once the stroke's guns close and the
+    // next stroke once both are done
+    PT_INIT (&child);
+    PT_WAIT_UNTIL (pt, (stroked = stroke (&child, axis) == PT_EXITED) ||
+        strokes.closed);
+
+    PT_INIT (&next);
+    moved = 0;
+    while (!stroked || !moved) {
+      if (!stroked) stroked = stroke (&child, axis) == PT_EXITED;
+      if (!moved) moved = transition (&next, direction) == PT_EXITED;
+      if (!stroked || !moved) PT_YIELD (pt);
+    }
+  }
+
+  spaced = 0;
+
+  PT_END (pt);
 }
 
+#ifdef CONVEYOR
 /**
- * Does strokes perpendicular to the given direction.
+ * Where the carriage should be on the panel under it. track keeps it at
+ * target + panelShift (), so a vertical stroke stays straight on the moving
+ * panel and a transition is a move across the panel, not the machine.
+ */
+struct {
+  uint8_t on;
+  long target;        // Steps right, in the panel's frame
+  long right;         // The furthest right the carriage may go
+  int speed;          // Steps into the ramp
+  int direction;
+} follow;
+
+/**
+ * Returns how far right of x the target is: carriageX for the steps still
+ * to queue, carriagePosition () for how far the carriage really is off it.
+ */
+long followError (long x) {
+  return follow.target + panelShift () - x;
+}
+
+/**
+ * Moves the conveyor's feed, in whole 256 steps, into the target. Neither
+ * count then grows for as long as the conveyor runs, and the shift they
+ * add up to is the same to the step.
+ */
+void followRebase () {
+  long turns = conveyor.steps >> 8;
+
+  follow.target += turns * CONVEYOR_RATIO;
+  conveyor.steps -= turns << 8;
+}
+
+/**
+ * Steps the carriage after its target, ramping as goUntil does. Holds the
+ * feed while the target is at the right end of the carriage's room, and
+ * while the job is paused, so no panel goes by unpainted.
+ */
+char track (Pt* pt) {
+  static Pt child;
+  static long error;
+  static int direction;
+
+  PT_BEGIN (pt);
+
+  for (;;) {
+    conveyor.held = paused || follow.target + panelShift () >= follow.right;
+
+    if (!follow.on || !(error = followError (carriageX))) {
+      follow.speed = 0;
+      PT_YIELD (pt);
+      continue;
+    }
+
+    direction = error > 0 ? RIGHT : LEFT;
+    if (direction != follow.direction) follow.speed = 0;
+    follow.direction = direction;
+
+    if (limitPressed (getLimit (direction)))
+      Stop ("The carriage ran into a limit following the conveyor");
+
+    // Faster while there's room to slow down, slower once there isn't
+    if (labs (error) > follow.speed) {
+      if (follow.speed < params.horizontal.stepsToStart) follow.speed++;
+    } else if (follow.speed > 0) {
+      follow.speed--;
+    }
+
+    PT_SPAWN (pt, &child, step (&child, direction, params.horizontal.max -
+        (long)(params.horizontal.max - params.horizontal.min) *
+        follow.speed / params.horizontal.stepsToStart));
+  }
+
+  PT_END (pt);
+}
+
+/**
+ * Paints the panels as the conveyor brings them, with vertical strokes
+ * working right to left along each. Fed about a stroke gap a stroke, the
+ * carriage stays where it is; faster, the feed is held at the right end,
+ * and slower, the next stroke waits at the left end for the panel.
+ */
+char flow (Pt* pt) {
+  static Pt child;
+
+  PT_BEGIN (pt);
+
+  debug ("Following the conveyor");
+  gunRotate (VERTICAL);
+
+  // The left limit zeroes the carriage, the right one is the room it has
+  PT_SPAWN (pt, &child, goUntil (&child, DOWN, LIMIT));
+  PT_SPAWN (pt, &child, goUntil (&child, LEFT, LIMIT));
+  PT_SPAWN (pt, &child, goUntil (&child, RIGHT, LIMIT));
+  follow.right = carriageX - CONVEYOR_MARGIN;
+
+  conveyorStart ();
+  follow.target = follow.right;
+  follow.on = 1;
+
+  for (;;) {
+    PT_WAIT_WHILE (pt, paused);
+    PT_WAIT_UNTIL (pt, labs (followError (carriagePosition ())) <= 1);
+
+    PT_SPAWN (pt, &child, stroke (&child, VERTICAL));
+
+    PT_WAIT_UNTIL (pt, follow.target - params.horizontalStrokeGap +
+        panelShift () >= CONVEYOR_MARGIN);
+    trace (TRACE_MOVE, LEFT, params.horizontalStrokeGap);
+    follow.target -= params.horizontalStrokeGap;
+    followRebase ();
+  }
+
+  PT_END (pt);
+}
+#endif
+
+#ifdef DUAL_CARRIAGE
+/**
+ * Paints the panel in vertical strokes with both carriages at once, each
+ * on its half. They share the spray solenoids, so each takes as many
+ * strokes as the other: the stroke gap shrinks, if it must, to split the
+ * room into an even number of them. The second starts that many gaps right
+ * of the first, so the strokes either side of the seam are a gap apart as
+ * everywhere else.
  */
-void doStrokes (int direction) {
+char split (Pt* pt) {
+  static Pt child;
+  static int gap;
+  static long seam;
+
+  PT_BEGIN (pt);
+
+  gap = params.horizontalStrokeGap;
+  seam = ((long)DUAL_ROOM + 2L * gap - 1) / (2L * gap);
+  params.horizontalStrokeGap = DUAL_ROOM / (2 * seam);
+  seam *= params.horizontalStrokeGap;
+  assert ((seam >= DUAL_KEEP_OUT),
+      "The seam is inside the keep out, widen the stroke gap");
+
+  turnOffAll ();
+  gunRotate (VERTICAL);
+  second.coupled = 0;
+  PT_SPAWN (pt, &child, goUntil (&child, DOWN, LIMIT));
+  PT_SPAWN (pt, &child, goUntil (&child, LEFT, LIMIT));
+  PT_SPAWN (pt, &child, secondMove (&child, RIGHT, LIMIT));
+  PT_SPAWN (pt, &child, secondMove (&child, LEFT, DUAL_ROOM - seam));
+
 #ifdef __debug__
-  char msg[100];
-  sprintf (msg, "Doing %s strokes until the %s limit is reached",
-      !isVertical (direction) ? "vertical" : "horizontal",
-      nameStr (direction));
+  {
+    char msg[60];
+    sprintf (msg, "Split at %ld steps, strokes %d apart", seam,
+        params.horizontalStrokeGap);
+    debug (msg);
+  }
 #endif
-  debug (msg);
 
-  int limit;
+  // The second carriage ends its half on the right limit
+  second.coupled = 1;
+  PT_SPAWN (pt, &child, doStrokes (&child, RIGHT));
+  second.coupled = 0;
+  params.horizontalStrokeGap = gap;
 
-  limit = getLimit (direction);
+  PT_END (pt);
+}
+#endif
 
-  switch (direction) {
-    case UP:
-      while (!digitalRead (limit)) {
-        stroke(HORIZONTAL);
-        transition (UP);
-      }
-      break;
-    case DOWN:
-      while (!digitalRead (limit)) {
-        stroke(HORIZONTAL);
-        transition (DOWN);
-      }
-      break;
-    case LEFT:
-      while (!digitalRead (limit)) {
-        stroke(VERTICAL);
-        transition (LEFT);
+#ifdef MULTI_COAT
+/**
+ * Gives every station its coats, one at a time in the order nextStation
+ * picks. A coat is the horizontal strokes up the bed with the panel's
+ * bounds set to the station's, so the guns only open over it.
+ */
+char coat (Pt* pt) {
+  static Pt child;
+  static int at;
+  static long left;
+  static long right;
+
+  PT_BEGIN (pt);
+
+  left = params.panelLeft;
+  right = params.panelRight;
+  stationsBegin (stations, millis ());
+
+  while ((at = nextStation (&params, stations, STATION_COUNT,
+          millis ())) >= 0) {
+    if (stationWait (&stations[at], millis ()))
+      debug ("Waiting for a coat to dry");
+    PT_WAIT_UNTIL (pt, !stationWait (&stations[at], millis ()));
+    PT_WAIT_WHILE (pt, paused);
+
+#ifdef __debug__
+    {
+      char msg[60];
+      sprintf (msg, "Coat %d of %d on station %d", stations[at].coats + 1,
+          params.coats, at);
+      debug (msg);
+    }
+#endif
+
+    params.panelLeft = stations[at].left;
+    params.panelRight = stations[at].right;
+
+    turnOffAll ();
+    gunRotate (HORIZONTAL);
+    PT_SPAWN (pt, &child, goUntil (&child, DOWN, LIMIT));
+    PT_SPAWN (pt, &child, goUntil (&child, LEFT, LIMIT));
+    PT_SPAWN (pt, &child, doStrokes (&child, UP));
+    turnOffAll ();
+
+    stationCoated (&params, &stations[at], millis ());
+  }
+
+  params.panelLeft = left;
+  params.panelRight = right;
+
+  PT_END (pt);
+}
+#endif
+
+#ifdef TOOLPATH
+/**
+ * Runs the toolpath. Each stroke's window is set as the panel's bounds on
+ * its axis, so stroke opens the guns over it as it would over the panel.
+ */
+char runPath (Pt* pt) {
+  static Pt child;
+  static SegmentReader reader;
+  static Segment segment;
+  static long bounds[4];
+
+  PT_BEGIN (pt);
+
+  bounds[0] = params.panelLeft;
+  bounds[1] = params.panelRight;
+  bounds[2] = params.panelBottom;
+  bounds[3] = params.panelTop;
+
+  turnOffAll ();
+  PT_SPAWN (pt, &child, goUntil (&child, DOWN, LIMIT));
+  PT_SPAWN (pt, &child, goUntil (&child, LEFT, LIMIT));
+
+  segmentsBegin (&reader, toolpath);
+  while (segmentNext (&reader, &segment)) {
+    PT_WAIT_WHILE (pt, paused);
+
+    if (segment.op == SEGMENT_MOVE) {
+      turnOffSprays ();
+      PT_SPAWN (pt, &child, goUntil (&child, segment.axis == VERTICAL ?
+            (segment.distance < 0 ? DOWN : UP) :
+            (segment.distance < 0 ? LEFT : RIGHT),
+            segment.sprays & SEGMENT_LIMIT ? LIMIT : labs (segment.distance)));
+      continue;
+    }
+
+    if (segment.axis == HORIZONTAL) {
+      params.panelLeft = segment.from;
+      params.panelRight = segment.to;
+    } else {
+      params.panelBottom = segment.from;
+      params.panelTop = segment.to;
+    }
+    strokeSprays = segment.sprays;
+    PT_SPAWN (pt, &child, stroke (&child, segment.axis));
+  }
+
+  strokeSprays = 0;
+  params.panelLeft = bounds[0];
+  params.panelRight = bounds[1];
+  params.panelBottom = bounds[2];
+  params.panelTop = bounds[3];
+
+  PT_END (pt);
+}
+#endif
+
+#ifdef SPARSE_BED
+/**
+ * Paints the parts on the bed row by row (see layout.h). Each row starts
+ * from the end nearer the carriage, and the guns open over its parts only.
+ */
+char sparse (Pt* pt) {
+  static Pt child;
+  static Pt next;
+  static Row row;
+  static int n;
+  static int direction;
+  static int toward;
+  static long y;
+  static long start;
+  static long end;
+  static long rise;
+  static long across;
+  static long length;
+  static uint8_t up;
+  static uint8_t there;
+  static uint8_t open;
+  static uint8_t guns;
+
+  PT_BEGIN (pt);
+
+  partsBegin (parts);
+  planLayout (&params, parts, PART_COUNT, &layout);
+
+#ifdef __debug__
+  {
+    char msg[60];
+    sprintf (msg, "%d rows %d apart over %d parts", layout.count, layout.gap,
+        PART_COUNT);
+    debug (msg);
+  }
+#endif
+
+  turnOffAll ();
+  gunRotate (HORIZONTAL);
+  PT_SPAWN (pt, &child, goUntil (&child, DOWN, LIMIT));
+  PT_SPAWN (pt, &child, goUntil (&child, LEFT, LIMIT));
+
+  for (n = 0; n < layout.count; n++) {
+    y = layout.first + (long)n * layout.gap;
+    if (!planRow (&params, &layout, parts, PART_COUNT, y, &row)) continue;
+
+    PT_WAIT_WHILE (pt, paused);
+
+    // Up to the row and across to its start at once, the guns closed
+    direction = rowRun (&params, &row, carriageX, &start, &end);
+    rise = y - encoderPosition ();
+    toward = start < carriageX ? LEFT : RIGHT;
+    across = labs (start - carriageX);
+    up = rise <= 0;
+    there = across == 0;
+
+    turnOffSprays ();
+    PT_INIT (&child);
+    PT_INIT (&next);
+    while (!up || !there) {
+      if (!up) up = goUntil (&child, UP, rise) == PT_EXITED;
+      if (!there) there = goUntil (&next, toward, across - 1) == PT_EXITED;
+      if (!up || !there) PT_YIELD (pt);
+    }
+
+    if (!gunSettled ()) {
+      trace (TRACE_WAIT, WAIT_REST, 0);
+      PT_WAIT_UNTIL (pt, gunSettled ());
+    }
+
+    trace (TRACE_STROKE, HORIZONTAL, n);
+
+    // The guns open and close part by part along the row
+    open = 0;
+    length = labs (end - carriageX);
+    PT_INIT (&child);
+    while (length > 0 && goUntil (&child, direction, length - 1) !=
+        PT_EXITED) {
+      guns = rowSprays (&params, &layout, parts, PART_COUNT, y,
+          carriagePosition ());
+      if (guns != open) {
+        strokeSprays = open = guns;
+        if (open) zoneSprays (0);
+        else turnOffSprays ();
       }
-      break;
-    case RIGHT:
-      while (!digitalRead (limit)) {
-        stroke(VERTICAL);
-        transition (RIGHT);
+      PT_YIELD (pt);
+    }
+
+    turnOffSprays ();
+    strokeSprays = 0;
+
+    trace (TRACE_STROKE_END, HORIZONTAL, n);
+  }
+
+  turnOffAll ();
+
+  PT_END (pt);
+}
+#endif
+
+/**
+ * Runs a job from start to end. It starts over when it's done, as the
+ * loop used to.
+ */
+char job (Pt* pt) {
+  static Pt child;
+
+  PT_BEGIN (pt);
+
+  PT_WAIT_WHILE (pt, paused);
+  recipeLoad ();
+  debug ("Starting a job");
+  trace (TRACE_JOB, 1, 0);
+
+#ifdef CONVEYOR
+  // The panels keep coming, this never returns
+  PT_SPAWN (pt, &child, flow (&child));
+#endif
+#ifdef DUAL_CARRIAGE
+  PT_SPAWN (pt, &child, split (&child));
+#endif
+#ifdef MULTI_COAT
+  PT_SPAWN (pt, &child, coat (&child));
+#endif
+#ifdef TOOLPATH
+  PT_SPAWN (pt, &child, runPath (&child));
+#endif
+#ifdef SPARSE_BED
+  PT_SPAWN (pt, &child, sparse (&child));
+#endif
+
+  // Reset vertically, the guns turning on the way
+  /* turnOffAll ();
+  gunRotate (HORIZONTAL);
+  PT_SPAWN (pt, &child, goUntil (&child, DOWN, LIMIT));
+  PT_SPAWN (pt, &child, goUntil (&child, LEFT, LIMIT));
+  debug ("Reached the bottom! Done resetting");
+
+  // Do horizontal strokes
+  PT_SPAWN (pt, &child, doStrokes (&child, UP));
+
+  // Reset horizontally
+  turnOffAll ();
+  gunRotate (VERTICAL);
+  PT_SPAWN (pt, &child, goUntil (&child, LEFT, LIMIT));
+  PT_SPAWN (pt, &child, goUntil (&child, UP, LIMIT));
+  debug ("Reached the left! Done resetting");
+
+  // Do vertical strokes
+  PT_SPAWN (pt, &child, doStrokes (&child, RIGHT)); */
+
+  PT_SPAWN (pt, &child, goUntil (&child, DOWN, LIMIT));
+  PT_SPAWN (pt, &child, goUntil (&child, UP, LIMIT));
+
+  // PT_SPAWN (pt, &child, goUntil (&child, LEFT, LIMIT));
+  // PT_SPAWN (pt, &child, goUntil (&child, RIGHT, LIMIT));
+
+  debug ("Job done");
+  trace (TRACE_JOB, 0, 0);
+
+  // Hang indefinitely
+  // Stop ("Done painting!");
+
+  PT_END (pt);
+}
+
+/**
+ * Drives the vertical axis whatever the job is waiting on.
+ */
+char motion (Pt* pt) {
+  PT_BEGIN (pt);
+
+  for (;;) {
+    verticalPoll ();
+    PT_YIELD (pt);
+  }
+
+  PT_END (pt);
+}
+
+/**
+ * Toggles a pause on each press of the pause button.
+ */
+char operatorInput (Pt* pt) {
+  PT_BEGIN (pt);
+
+  for (;;) {
+    PT_WAIT_UNTIL (pt, digitalRead (PAUSE_BUTTON) == LOW);
+    PT_SLEEP (pt, DEBOUNCE_TIME);
+    if (digitalRead (PAUSE_BUTTON) != LOW) continue;
+
+    paused = !paused;
+    debug (paused ? "Paused" : "Resumed");
+
+    PT_WAIT_WHILE (pt, digitalRead (PAUSE_BUTTON) == LOW);
+    PT_SLEEP (pt, DEBOUNCE_TIME);
+  }
+
+  PT_END (pt);
+}
+
+/**
+ * Steps through the recipes on each press of RECIPE_NEXT or
+ * RECIPE_PREVIOUS, blinking the status LED once for the first recipe,
+ * twice for the second and so on.
+ */
+char recipeInput (Pt* pt) {
+  static int button;
+  static uint8_t blinks;
+
+  PT_BEGIN (pt);
+
+  for (;;) {
+    PT_WAIT_UNTIL (pt, recipes.count &&
+        (digitalRead (RECIPE_NEXT) == LOW ||
+         digitalRead (RECIPE_PREVIOUS) == LOW));
+    button = digitalRead (RECIPE_NEXT) == LOW ? RECIPE_NEXT :
+      RECIPE_PREVIOUS;
+    PT_SLEEP (pt, DEBOUNCE_TIME);
+    if (digitalRead (button) != LOW) continue;
+
+    recipeSelect ((recipes.selected + (button == RECIPE_NEXT ? 1 :
+            recipes.count - 1)) % recipes.count);
+#ifdef __debug__
+    {
+      char msg[60];
+      sprintf (msg, "Recipe %d of %d selected for the next job",
+          recipes.selected + 1, recipes.count);
+      debug (msg);
+    }
+#endif
+
+    for (blinks = 0; blinks <= recipes.selected; blinks++) {
+      digitalWrite (STATUS_LED, HIGH);
+      PT_SLEEP (pt, 200);
+      digitalWrite (STATUS_LED, LOW);
+      PT_SLEEP (pt, 200);
+    }
+
+    PT_WAIT_WHILE (pt, digitalRead (button) == LOW);
+    PT_SLEEP (pt, DEBOUNCE_TIME);
+  }
+
+  PT_END (pt);
+}
+
+/**
+ * Takes up what the interrupt handlers saw.
+ */
+char dispatch (Pt* pt) {
+  PT_BEGIN (pt);
+
+  for (;;) {
+    eventsDispatch ();
+    PT_YIELD (pt);
+  }
+
+  PT_END (pt);
+}
+
+#ifdef __debug__
+/**
+ * Reports where the carriage is every STATUS_INTERVAL.
+ */
+char status (Pt* pt) {
+  PT_BEGIN (pt);
+
+  for (;;) {
+    PT_SLEEP (pt, STATUS_INTERVAL);
+    {
+      char msg[60];
+      sprintf (msg, "At %ld counts, the VFD at %u.%02u Hz%s",
+          encoderPosition (), vfd.output / 100, vfd.output % 100,
+          paused ? ", paused" : "");
+      debug (msg);
+    }
+  }
+
+  PT_END (pt);
+}
+
+/**
+ * Answers the commands typed at the serial port, one a line:
+ *    ram   where the RAM went, see ram.h
+ */
+char console (Pt* pt) {
+  static char line[16];
+  static uint8_t length;
+
+  PT_BEGIN (pt);
+
+  for (;;) {
+    PT_WAIT_UNTIL (pt, Serial.available ());
+    {
+      char c = Serial.read ();
+
+      if (c != '\r' && c != '\n') {
+        // Too long to be a command, it won't match any
+        if (length < sizeof (line) - 1) line[length++] = c;
+        continue;
       }
-      break;
+    }
+
+    line[length] = 0;
+    length = 0;
+    if (!line[0]) continue;
+
+    if (!strcmp (line, "ram")) ramReport ();
+    else debug ("Commands: ram");
   }
+
+  PT_END (pt);
 }
+#endif
 
 /**
  * Sets up the following outputs:
@@ -300,59 +1219,64 @@ void doStrokes (int direction) {
  *    Right limit switch
  */
 void setup () {
+  ramBegin ();
+#ifdef __trace__
+  Serial.begin (TRACE_BAUD);
+#else
   Serial.begin (9600);
-  verticalCounter = 0;
+#endif
+  traceBegin ();
+  recordBegin ();
+  flightBegin ();
+  vfdBegin ();
 
   pinMode (TOP_SPRAY, OUTPUT);
   pinMode (BOTTOM_SPRAY, OUTPUT);
+  gunBegin ();
 
   pinMode (HORIZONTAL_STEPPER_DIRECTION, OUTPUT);
   pinMode (HORIZONTAL_STEPPER_STEP, OUTPUT);
   pinMode (HORIZONTAL_STEPPER_ENABLE, OUTPUT);
+  stepperBegin ();
+  conveyorBegin ();
+  secondBegin ();
 
   pinMode (MOTOR_UP, OUTPUT);
   pinMode (MOTOR_DOWN, OUTPUT);
+  interlockBegin ();
 
   pinMode (BOTTOM_LIMIT, INPUT);
   pinMode (TOP_LIMIT, INPUT);
 
   pinMode (LEFT_LIMIT, INPUT);
   pinMode (RIGHT_LIMIT, INPUT);
+  eventsBegin ();
+  pidBegin ();
   pinMode (LED, OUTPUT);
+  pinMode (PAUSE_BUTTON, INPUT_PULLUP);
+  recipesBegin ();
+
+  taskAdd (dispatch);
+  taskAdd (job);
+  taskAdd (motion);
+  taskAdd (operatorInput);
+  taskAdd (recipeInput);
+#ifdef CONVEYOR
+  taskAdd (feed);
+  taskAdd (track);
+#endif
+#ifdef __debug__
+  taskAdd (status);
+  taskAdd (console);
+#endif
 
   debug ("Done initializing...");
 }
 
 /**
- * This doesn't really loop as it hangs indefinitely in the end.
- *
- * The program is only repeated by resetting the microcontroller.
+ * Gives each task a turn until it blocks. The job starts over when it's
+ * done, the other tasks never end.
  */
 void loop () {
-  // Reset vertically
-  /* turnOffAll ();
-  goUntil (DOWN, LIMIT);
-  goUntil (LEFT, LIMIT);
-  debug ("Reached the bottom! Done resetting");
-
-  // Do horizontal strokes
-  doStrokes(UP);
-
-  // Reset horizontally
-  turnOffAll ();
-  goUntil (LEFT, LIMIT);
-  goUntil (UP, LIMIT);
-  debug ("Reached the left! Done resetting");
-
-  // Do vertical strokes
-  doStrokes (RIGHT); */
-
-  goUntil (DOWN, LIMIT);
-  goUntil (UP, LIMIT);
-
-  // goUntil (LEFT, LIMIT);
-  // goUntil (RIGHT, LIMIT);
-
-  // Hang indefinitely
-  // Stop ("Done painting!");
+  taskRun ();
 }
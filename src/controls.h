@@ -2,17 +2,56 @@
 #define __CONTROLS_HDR__
 
 #include "debug.h"
+#include "interlock.h"
+#include "params.h"
+#include "stepper.h"
 
 /**
- * Turns off both motors and updates the motor states.
+ * The gun holder's orientation and when it was last turned.
+ */
+struct {
+  int axis;               // The strokes it's turned for
+  unsigned long since;
+} gun;
+
+void gunBegin () {
+  pinMode (GUN_ROTATION, OUTPUT);
+  digitalWrite (GUN_ROTATION, LOW);
+  gun.axis = HORIZONTAL;
+  gun.since = millis ();
+}
+
+/**
+ * Turns the gun holder for strokes on an axis. It doesn't wait for the
+ * holder to settle, so issue it as the carriage sets off for the pattern.
+ */
+void gunRotate (int axis) {
+  if (axis == gun.axis) return;
+
+  debug (axis == VERTICAL ? "Turning the guns for vertical strokes" :
+      "Turning the guns for horizontal strokes");
+  digitalWrite (GUN_ROTATION, axis == VERTICAL ? HIGH : LOW);
+  gun.axis = axis;
+  gun.since = millis ();
+}
+
+/**
+ * Returns whether the holder has had params.gunSettle since it was turned.
+ */
+int gunSettled () {
+  return millis () - gun.since >= (unsigned long)params.gunSettle;
+}
+
+/**
+ * Turns off both motors, and cuts the step pulses Timer1 would otherwise
+ * go on making by itself. The interlock holds off the next reversal for as
+ * long as the relays need.
  */
 void turnOffMotors () {
   debug ("Turning off both induction motors");
 
-  digitalWrite (MOTOR_UP, LOW);
-  digitalWrite (MOTOR_DOWN, LOW);
-
-  delay (MOTOR_SWITCH_DELAY);
+  interlockStop ();
+  stepperHalt ();
 }
 
 /**
@@ -20,6 +59,7 @@ void turnOffMotors () {
  */
 void turnOffSprays () {
   debug ("Turning off both sprays");
+  trace (TRACE_SPRAYS, 0, 0);
   digitalWrite (TOP_SPRAY, LOW);
   digitalWrite (BOTTOM_SPRAY, LOW);
 }
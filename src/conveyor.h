@@ -0,0 +1,76 @@
+#ifndef __CONVEYOR_HDR__
+#define __CONVEYOR_HDR__
+
+#include "WoodStain.h"
+#include "pt.h"
+
+/**
+ * The conveyor that carries the panels through, with CONVEYOR defined.
+ *
+ * Its stepper runs at a steady CONVEYOR_RATE from its own task, carrying
+ * the panels towards the right limit. conveyor.steps counts what it has
+ * fed, and the carriage's moves are planned against that count rather
+ * than the clock: panelShift is how far the panel has moved under the
+ * carriage since the conveyor started, or since the count was last
+ * rebased into the carriage's target. So the feed can be held, when the
+ * carriage runs out of room, without spoiling the stroke under way.
+ */
+#ifdef CONVEYOR
+
+#ifdef HARDWARE_STEPPING
+#error "The carriage follows the conveyor with software steps"
+#endif
+
+struct {
+  uint8_t running;
+  uint8_t held;
+  long steps;               // Fed since conveyorStart or a rebase
+} conveyor;
+
+void conveyorBegin () {
+  pinMode (CONVEYOR_STEPPER_DIRECTION, OUTPUT);
+  pinMode (CONVEYOR_STEPPER_STEP, OUTPUT);
+  pinMode (CONVEYOR_STEPPER_ENABLE, OUTPUT);
+  digitalWrite (CONVEYOR_STEPPER_ENABLE, HIGH);
+  digitalWrite (CONVEYOR_STEPPER_DIRECTION, CONVEYOR_DIRECTION);
+}
+
+void conveyorStart () {
+  conveyor.steps = 0;
+  conveyor.held = 0;
+  conveyor.running = 1;
+  digitalWrite (CONVEYOR_STEPPER_ENABLE, LOW);
+}
+
+/**
+ * Returns how far the panel has moved right since the conveyor started, or
+ * the last rebase, in carriage steps.
+ */
+long panelShift () {
+  return conveyor.steps * CONVEYOR_RATIO >> 8;
+}
+
+/**
+ * Steps the conveyor while it runs and isn't held.
+ */
+char feed (Pt* pt) {
+  PT_BEGIN (pt);
+
+  for (;;) {
+    PT_WAIT_UNTIL (pt, conveyor.running && !conveyor.held);
+
+    digitalWrite (CONVEYOR_STEPPER_STEP, HIGH);
+    PT_SLEEP_US (pt, 500000L / CONVEYOR_RATE);
+    digitalWrite (CONVEYOR_STEPPER_STEP, LOW);
+    conveyor.steps++;
+    PT_SLEEP_US (pt, 500000L / CONVEYOR_RATE);
+  }
+
+  PT_END (pt);
+}
+
+#else
+#define conveyorBegin() {}
+#endif
+
+#endif
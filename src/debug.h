@@ -5,14 +5,35 @@
 
 #define __debug__
 
+// Binary trace records replace the text output when this is defined
+// #define __trace__
+
+// Input and output changes are traced too when this is defined, for replay
+// on the host
+// #define __record__
+
+#ifdef __record__
+#define __trace__
+#endif
+
+#ifdef __trace__
+#undef __debug__
+#endif
+
+#include "trace.h"
+#include "record.h"
+
 #ifdef __debug__
 #define assert(c,e) if (!c) { Stop (e); }
-#define debug(m) Serial.println (m)
+#define debug(m) do { Serial.print (millis ()); Serial.print (' '); \
+                    Serial.println (m); } while (0)
 #else
 #define assert(c,e) {}
-#define debug(m) {}
+#define debug(m) do {} while (0)
 #endif
 
+#include "flight.h"
+
 extern void turnOffAll();
 
 /**
@@ -37,7 +58,9 @@ const char* nameStr (int direction) {
  * Stops the paint program and displays the reason for stopping.
  */
 void Stop (const char* reason) {
+  debug ("Stopping...");
   debug (reason);
+  trace (TRACE_FAULT, 0, 0);
   turnOffAll ();
 
   // Hang and blink the status LED
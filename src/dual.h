@@ -0,0 +1,99 @@
+#ifndef __DUAL_HDR__
+#define __DUAL_HDR__
+
+#include "WoodStain.h"
+#include "pt.h"
+#include "params.h"
+#include "limits.h"
+
+/**
+ * A second carriage on the horizontal rail, right of the first, with
+ * DUAL_CARRIAGE defined.
+ *
+ * Each carriage homes on its own end's limit, the first on the left one
+ * and the second on the right one, and the panel is split between them at
+ * a seam. Once the second is at the start of its half they are coupled:
+ * each step the first takes, the second takes alongside it, so both halves
+ * are painted by the same strokes and the distance between the carriages
+ * never changes. Their guns hang off the same spray solenoids.
+ *
+ * Neither has a switch on its inner side. The keep-out between them is
+ * only their step counts from homing. Coupled, the gap can't change, so
+ * it's the second's own moves left, towards the first, that are checked.
+ */
+#ifdef DUAL_CARRIAGE
+
+#ifdef CONVEYOR
+#error "The conveyor's carriage tracking drives only the first carriage"
+#endif
+#ifdef HARDWARE_STEPPING
+#error "The second carriage is stepped beside the first, from software"
+#endif
+
+extern long carriageX;
+
+struct {
+  uint8_t coupled;      // Steps along with the first carriage
+  long x;               // Steps right of the first carriage's left limit
+} second;
+
+void secondBegin () {
+  pinMode (SECOND_STEPPER_DIRECTION, OUTPUT);
+  pinMode (SECOND_STEPPER_STEP, OUTPUT);
+  pinMode (SECOND_STEPPER_ENABLE, OUTPUT);
+  digitalWrite (SECOND_STEPPER_ENABLE, LOW);
+}
+
+/**
+ * Sets the second carriage's step output, counting the step as it ends.
+ */
+void secondPulse (int direction, uint8_t level) {
+  digitalWrite (SECOND_STEPPER_DIRECTION,
+      direction == LEFT ? LEFT_DIRECTION : RIGHT_DIRECTION);
+  digitalWrite (SECOND_STEPPER_STEP, level);
+  if (!level) second.x += direction == LEFT ? -1 : 1;
+}
+
+/**
+ * Moves the second carriage on its own, ramping as goUntil does, until its
+ * right limit if steps == LIMIT. Reaching the limit sets its place to
+ * DUAL_ROOM. Going left it stops the machine rather than step inside
+ * DUAL_KEEP_OUT of the first, so home it to the right before that.
+ */
+char secondMove (Pt* pt, int direction, long steps) {
+  static long done;
+  static int speed;
+  static int delay;
+
+  PT_BEGIN (pt);
+
+  for (done = 0, speed = 0; steps == LIMIT || done < steps; done++) {
+    if (direction == RIGHT && limitPressed (RIGHT_LIMIT)) break;
+    if (direction == LEFT && second.x - 1 - carriageX < DUAL_KEEP_OUT)
+      Stop ("The second carriage would come inside the keep out");
+
+    // Faster while there's room to slow down, slower once there isn't
+    if (steps == LIMIT || steps - done > speed) {
+      if (speed < params.horizontal.stepsToStart) speed++;
+    } else if (speed > 0) {
+      speed--;
+    }
+    delay = params.horizontal.max - (long)(params.horizontal.max -
+        params.horizontal.min) * speed / params.horizontal.stepsToStart;
+
+    secondPulse (direction, HIGH);
+    PT_SLEEP_US (pt, delay);
+    secondPulse (direction, LOW);
+    PT_SLEEP_US (pt, delay);
+  }
+
+  if (steps == LIMIT) second.x = DUAL_ROOM;
+
+  PT_END (pt);
+}
+
+#else
+#define secondBegin() {}
+#endif
+
+#endif
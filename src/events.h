@@ -0,0 +1,206 @@
+#ifndef __EVENTS_HDR__
+#define __EVENTS_HDR__
+
+#include "WoodStain.h"
+#include "debug.h"
+
+/**
+ * Events from the interrupt handlers to the main code.
+ *
+ * The handlers push onto a ring and eventsDispatch, from a task, pops off
+ * it. There is one producer, since AVR interrupts don't nest, and one
+ * consumer, so neither side turns interrupts off: each index is a byte,
+ * which the AVR reads and writes in one go, and only its owner writes it.
+ *
+ * The limit switches aren't on pins with change interrupts on the Mega, so
+ * the sample timer reads them every tick and pushes their edges. The
+ * dispatcher keeps each one's level and counts its presses and releases,
+ * so a wait that looks late still sees a press that came and went. A full
+ * ring is a fault, an edge would be lost.
+ */
+
+#define EVENTS            32    // A power of two
+
+#define EVENT_LIMIT       0     // arg pin, value the new level
+#define EVENT_MOVE_DONE   1     // arg axis
+#define EVENT_INDEX       2     // value the encoder count, low 16 bits
+#define EVENT_FAULT       3     // arg FAULT_*
+
+#define FAULT_VERTICAL_LIMITS   0
+#define FAULT_HORIZONTAL_LIMITS 1
+
+typedef struct {
+  uint32_t time;    // millis () when it happened
+  uint8_t kind;
+  uint8_t arg;
+  uint16_t value;
+} Event;
+
+// Keeps the compiler from moving the ring's loads and stores past an index
+#define eventBarrier() __asm__ __volatile__ ("" ::: "memory")
+
+struct {
+  Event ring[EVENTS];
+  volatile uint8_t head;      // Written only by the handlers
+  volatile uint8_t tail;      // Written only by the dispatcher
+  volatile uint8_t full;      // An event didn't fit
+  uint8_t sampled;            // The limits at the last sample, a bit each
+} events;
+
+#define LIMITS  4
+
+// Each axis' pair is next to each other, for the fault check
+const int limitPins[LIMITS] = {
+  TOP_LIMIT, BOTTOM_LIMIT, LEFT_LIMIT, RIGHT_LIMIT
+};
+
+/**
+ * What the dispatcher has seen.
+ */
+struct {
+  uint8_t level[LIMITS];
+  uint8_t presses[LIMITS];
+  uint8_t releases[LIMITS];
+  uint8_t moves;              // Closed loop moves done
+  uint8_t indexes;            // Encoder index pulses
+  uint16_t index;             // The encoder count at the last one
+} seen;
+
+/**
+ * Queues an event. Only call this from an interrupt handler.
+ */
+void eventPush (uint8_t kind, uint8_t arg, uint16_t value) {
+  uint8_t head = events.head;
+  uint8_t next = (head + 1) & (EVENTS - 1);
+
+  if (next == events.tail) {
+    events.full = 1;
+    return;
+  }
+
+  Event* e = &events.ring[head];
+  e->time = millis ();
+  e->kind = kind;
+  e->arg = arg;
+  e->value = value;
+
+  eventBarrier ();
+  events.head = next;
+}
+
+/**
+ * Takes the oldest event off the ring.
+ *
+ * @return whether there was one
+ */
+int eventPop (Event* e) {
+  uint8_t tail = events.tail;
+  if (tail == events.head) return 0;
+
+  eventBarrier ();
+  *e = events.ring[tail];
+  eventBarrier ();
+  events.tail = (tail + 1) & (EVENTS - 1);
+
+  return 1;
+}
+
+int limitIndex (int pin) {
+  for (uint8_t i = 0; i < LIMITS; i++)
+    if (limitPins[i] == pin) return i;
+
+  Stop ("Error in limit index because the pin isn't a limit switch..");
+  return 0;
+}
+
+/**
+ * Takes the limits' levels as they are. Call once after their pins are
+ * set up and before the sample timer starts.
+ */
+void eventsBegin () {
+  events.sampled = 0;
+
+  for (uint8_t i = 0; i < LIMITS; i++) {
+    seen.level[i] = digitalRead (limitPins[i]) != LOW;
+    events.sampled |= seen.level[i] << i;
+  }
+}
+
+/**
+ * Reads the limit switches and pushes what changed. Runs in the sample
+ * timer's interrupt.
+ */
+void limitSample () {
+  uint8_t levels = 0;
+
+  // Straight to the core, the dispatcher records what it needs to
+  for (uint8_t i = 0; i < LIMITS; i++)
+    if ((digitalRead) (limitPins[i])) levels |= 1 << i;
+
+  uint8_t changed = levels ^ events.sampled;
+  for (uint8_t i = 0; i < LIMITS; i++)
+    if (changed & 1 << i)
+      eventPush (EVENT_LIMIT, limitPins[i], levels >> i & 1);
+
+  // Both ends of an axis at once, only a jammed or broken switch does that,
+  // but for two carriages, which each have one of the horizontal pair
+  if ((levels & 0x3) == 0x3 && (changed & 0x3))
+    eventPush (EVENT_FAULT, FAULT_VERTICAL_LIMITS, 0);
+#ifndef DUAL_CARRIAGE
+  if ((levels & 0xc) == 0xc && (changed & 0xc))
+    eventPush (EVENT_FAULT, FAULT_HORIZONTAL_LIMITS, 0);
+#endif
+
+  events.sampled = levels;
+}
+
+void eventHandle (const Event* e) {
+  uint8_t i;
+
+  switch (e->kind) {
+    case EVENT_LIMIT:
+      i = limitIndex (e->arg);
+      seen.level[i] = e->value;
+      if (e->value) seen.presses[i]++;
+      else seen.releases[i]++;
+      recordInput (e->time, e->arg, e->value);
+      break;
+    case EVENT_MOVE_DONE:
+      seen.moves++;
+      break;
+    case EVENT_INDEX:
+      seen.indexes++;
+      seen.index = e->value;
+      break;
+    case EVENT_FAULT:
+      Stop (e->arg == FAULT_VERTICAL_LIMITS ?
+          "Both vertical limits are pressed" :
+          "Both horizontal limits are pressed");
+      break;
+  }
+}
+
+/**
+ * Handles every event waiting on the ring.
+ */
+void eventsDispatch () {
+  Event e;
+
+  while (eventPop (&e)) eventHandle (&e);
+
+  if (events.full) Stop ("The event ring filled up, an edge was lost");
+}
+
+int limitPressed (int pin) {
+  return seen.level[limitIndex (pin)];
+}
+
+uint8_t limitPresses (int pin) {
+  return seen.presses[limitIndex (pin)];
+}
+
+uint8_t limitReleases (int pin) {
+  return seen.releases[limitIndex (pin)];
+}
+
+#endif
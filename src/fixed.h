@@ -0,0 +1,235 @@
+#ifndef __FIXED_HDR__
+#define __FIXED_HDR__
+
+#include <stdint.h>
+
+/**
+ * Fixed-point numbers, so the motion code doesn't pull in soft float.
+ *
+ * A q16 is Q16.16 in 32 bits, up to 32767 either way in 65536ths. A q8 is
+ * Q8.8 in 16 bits, up to 127 either way in 256ths, for fractions such as a
+ * shaper's amplitudes. The operations saturate at the largest value of
+ * their sign instead of wrapping, and a product or quotient rounds towards
+ * 0. They only use 32 bit integer operations, which the 8-bit core does
+ * far faster than float. q16Mul takes four 16 by 16 bit multiplies and
+ * q16Div 16 shift-and-subtract rounds. q16MulQ8 and q16MulInt take a 16
+ * bit operand and so only two multiplies, which is what to use where the
+ * other side fits.
+ *
+ * A ratio of two plain integers comes out of q16Div as a q16, and a q16
+ * over a plain integer is just the integer division.
+ */
+
+typedef int32_t q16;
+typedef int16_t q8;
+
+#define Q16_ONE     65536L
+#define Q16_MAX     0x7fffffffL
+#define Q16_MIN     (-Q16_MAX)
+#define Q16_PI      205887L
+
+#define Q8_ONE      256
+#define Q8_MAX      0x7fff
+#define Q8_MIN      (-Q8_MAX)
+
+q16 q16FromInt (long i) {
+  return i > 32767 ? Q16_MAX : i < -32767 ? Q16_MIN : (q16)i << 16;
+}
+
+/**
+ * Rounds down.
+ */
+long q16ToInt (q16 a) {
+  return a >> 16;
+}
+
+q16 q16FromQ8 (q8 a) {
+  return (q16)a << 8;
+}
+
+q8 q8FromQ16 (q16 a) {
+  a >>= 8;
+  return a > Q8_MAX ? Q8_MAX : a < Q8_MIN ? Q8_MIN : (q8)a;
+}
+
+q16 q16Add (q16 a, q16 b) {
+  q16 s = (q16)((uint32_t)a + (uint32_t)b);
+
+  // Only two of the same sign overflow, into the other sign
+  if (((a ^ s) & (b ^ s)) < 0) return a < 0 ? Q16_MIN : Q16_MAX;
+  return s;
+}
+
+q16 q16Sub (q16 a, q16 b) {
+  q16 d = (q16)((uint32_t)a - (uint32_t)b);
+
+  if (((a ^ b) & (a ^ d)) < 0) return a < 0 ? Q16_MIN : Q16_MAX;
+  return d;
+}
+
+/**
+ * Returns a times b shifted right by shift, or Q16_MAX if that doesn't fit
+ * in 31 bits.
+ */
+uint32_t fixedProduct (uint32_t a, uint32_t b, uint8_t shift) {
+  uint32_t al = a & 0xffff, ah = a >> 16;
+  uint32_t bl = b & 0xffff, bh = b >> 16;
+  uint32_t lo = al * bl;
+  uint32_t mid = al * bh;
+  uint32_t cross = ah * bl;
+  uint32_t hi = ah * bh;
+
+  // The 64 bit product in hi and lo
+  mid += cross;
+  if (mid < cross) hi += 0x10000;
+  hi += mid >> 16;
+  mid <<= 16;
+  lo += mid;
+  if (lo < mid) hi++;
+
+  if (hi >> shift) return Q16_MAX;
+  if (shift) lo = lo >> shift | hi << (32 - shift);
+  return lo > (uint32_t)Q16_MAX ? Q16_MAX : lo;
+}
+
+q16 fixedMultiply (int32_t a, int32_t b, uint8_t shift) {
+  uint32_t p = fixedProduct (a < 0 ? -(uint32_t)a : a,
+      b < 0 ? -(uint32_t)b : b, shift);
+
+  return (a < 0) != (b < 0) ? -(q16)p : (q16)p;
+}
+
+q16 q16Mul (q16 a, q16 b) {
+  return fixedMultiply (a, b, 16);
+}
+
+/**
+ * fixedProduct with b 16 bits, shift at most 16: the two halves of a
+ * times b, the high one shifted up.
+ */
+uint32_t fixedProductShort (uint32_t a, uint16_t b, uint8_t shift) {
+  uint32_t hi = (a >> 16) * b;
+  uint32_t lo = (a & 0xffff) * b;
+
+  if (hi >> (15 + shift)) return Q16_MAX;
+  hi <<= 16 - shift;
+  lo >>= shift;
+
+  return lo > (uint32_t)Q16_MAX - hi ? Q16_MAX : hi + lo;
+}
+
+q16 fixedMultiplyShort (int32_t a, int16_t b, uint8_t shift) {
+  uint32_t p = fixedProductShort (a < 0 ? -(uint32_t)a : a,
+      b < 0 ? -b : b, shift);
+
+  return (a < 0) != (b < 0) ? -(q16)p : (q16)p;
+}
+
+q16 q16MulQ8 (q16 a, q8 b) {
+  return fixedMultiplyShort (a, b, 8);
+}
+
+q16 q16MulInt (q16 a, int16_t i) {
+  return fixedMultiplyShort (a, i, 0);
+}
+
+q8 q8Mul (q8 a, q8 b) {
+  long p = (long)a * b / Q8_ONE;
+  return p > Q8_MAX ? Q8_MAX : p < Q8_MIN ? Q8_MIN : (q8)p;
+}
+
+/**
+ * Returns a over b, a bit of the fraction for each shift and subtract.
+ */
+q16 q16Div (q16 a, q16 b) {
+  uint8_t negative = (a < 0) != (b < 0);
+  uint32_t n = a < 0 ? -(uint32_t)a : a;
+  uint32_t d = b < 0 ? -(uint32_t)b : b;
+
+  if (!d) return !n ? 0 : negative ? Q16_MIN : Q16_MAX;
+
+  uint32_t q = n / d;
+  uint32_t r = n % d;
+
+  if (q > 32767) return negative ? Q16_MIN : Q16_MAX;
+
+  // r is under d, which is at most 2^31, so doubling it can't overflow
+  for (uint8_t i = 0; i < 16; i++) {
+    r <<= 1;
+    q <<= 1;
+    if (r >= d) {
+      r -= d;
+      q |= 1;
+    }
+  }
+
+  return negative ? -(q16)q : (q16)q;
+}
+
+q16 q16Recip (q16 a) {
+  return q16Div (Q16_ONE, a);
+}
+
+/**
+ * Returns the integer square root of a, rounded down.
+ */
+uint32_t fixedRoot (uint32_t a) {
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+
+  while (bit > a) bit >>= 2;
+  while (bit) {
+    if (a >= root + bit) {
+      a -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+
+  return root;
+}
+
+/**
+ * The root of a q16 is the integer root of it times 65536. Small values
+ * get all 16 bits of that, large ones as many as 32 bits hold.
+ */
+q16 q16Sqrt (q16 a) {
+  uint32_t x = a;
+  uint8_t shift = 0;
+
+  if (a <= 0) return 0;
+
+  while (shift < 16 && !(x & 0xc0000000UL)) {
+    x <<= 2;
+    shift += 2;
+  }
+
+  return (q16)(fixedRoot (x) << ((16 - shift) / 2));
+}
+
+/**
+ * e to the a. Halved until it's within a half, where five terms of the
+ * series are good to a couple of 65536ths, then squared back up.
+ */
+q16 q16Exp (q16 a) {
+  uint8_t halvings = 0;
+  q16 term = Q16_ONE;
+  q16 sum = Q16_ONE;
+
+  while (a > Q16_ONE / 2 || a < -Q16_ONE / 2) {
+    a /= 2;
+    halvings++;
+  }
+
+  for (uint8_t i = 1; i <= 5; i++) {
+    term = q16Mul (term, a) / i;
+    sum = q16Add (sum, term);
+  }
+
+  while (halvings--) sum = q16Mul (sum, sum);
+  return sum;
+}
+
+#endif
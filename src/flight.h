@@ -0,0 +1,130 @@
+#ifndef __FLIGHT_HDR__
+#define __FLIGHT_HDR__
+
+#include "WoodStain.h"
+#include "trace.h"
+
+/**
+ * The flight recorder, with FLIGHT_RECORDER defined.
+ *
+ * Every trace event, the moves, limits, sprays and the rest, also goes
+ * into a ring of the last FLIGHT_RECORDS in .noinit RAM, which the C
+ * runtime doesn't clear on a reset. The next boot finds them there and
+ * dumps them over serial, oldest first, so a hang in Stop or a brown-out
+ * leaves a record of what led up to it without slow serial logging left
+ * on. Power cycling loses the RAM, and a ring whose check doesn't add up,
+ * after that or a reset in the middle of a write, is dropped.
+ *
+ * Debug builds dump it as text, the records as numbers:
+ *
+ *   <millis> Flight <records> records before the reset (<cause>)
+ *   <millis> Flight <time> <kind> <arg> <value>
+ *
+ * Trace builds write a TRACE_FLIGHT record and then the records, with
+ * TRACE_DUMPED set in their kinds so they aren't taken for new events.
+ */
+#ifdef FLIGHT_RECORDER
+
+#define FLIGHT_MAGIC  0x544c4657UL // "WFLT"
+
+typedef struct {
+  uint32_t magic;             // FLIGHT_MAGIC once it's been started
+  uint16_t head;              // Where the next record goes
+  uint16_t count;
+  uint16_t check;             // The sum of flightSum over the records
+  TraceRecord records[FLIGHT_RECORDS];
+} Flight;
+
+Flight flight __attribute__ ((section (".noinit")));
+
+uint16_t flightSum (const TraceRecord* r) {
+  return (uint16_t)(r->time + (r->time >> 16) + r->kind + (r->arg << 8) +
+      r->value);
+}
+
+/**
+ * Records an event, over the oldest once the ring is full.
+ */
+void flightWrite (uint8_t kind, uint8_t arg, uint16_t value) {
+  TraceRecord* r = &flight.records[flight.head];
+
+  if (flight.count < FLIGHT_RECORDS) flight.count++;
+  else flight.check -= flightSum (r);
+
+  r->time = (uint32_t)millis ();
+  r->kind = kind;
+  r->arg = arg;
+  r->value = value;
+  flight.check += flightSum (r);
+
+  if (++flight.head == FLIGHT_RECORDS) flight.head = 0;
+}
+
+/**
+ * Whether the ring in RAM is one flightBegin started, as it was left.
+ */
+int flightValid () {
+  uint16_t check = 0;
+
+  if (flight.magic != FLIGHT_MAGIC || flight.count > FLIGHT_RECORDS ||
+      flight.head >= FLIGHT_RECORDS) return 0;
+  // It fills from the start before it wraps
+  if (flight.count < FLIGHT_RECORDS && flight.head != flight.count) return 0;
+
+  for (uint16_t i = 0; i < flight.count; i++)
+    check += flightSum (&flight.records[i]);
+  return check == flight.check;
+}
+
+const char* flightCauseStr (uint8_t cause) {
+  return cause & _BV (WDRF) ? "watchdog" :
+          cause & _BV (BORF) ? "brown-out" :
+          cause & _BV (EXTRF) ? "reset button" :
+          cause & _BV (PORF) ? "power-on" : "software";
+}
+
+void flightDump (uint8_t cause) {
+  uint16_t first = flight.count < FLIGHT_RECORDS ? 0 : flight.head;
+
+#ifdef __debug__
+  char msg[64];
+
+  sprintf (msg, "Flight %u records before the reset (%s)", flight.count,
+      flightCauseStr (cause));
+  debug (msg);
+#else
+  traceSend (TRACE_FLIGHT, cause, flight.count);
+#endif
+
+  for (uint16_t i = 0; i < flight.count; i++) {
+    const TraceRecord* r = &flight.records[(first + i) % FLIGHT_RECORDS];
+
+#ifdef __debug__
+    sprintf (msg, "Flight %lu %u %u %u", (unsigned long)r->time, r->kind,
+        r->arg, r->value);
+    debug (msg);
+#elif defined (__trace__)
+    traceWriteAt (r->time, r->kind | TRACE_DUMPED, r->arg, r->value);
+#endif
+  }
+}
+
+/**
+ * Dumps what the ring kept from before the reset, if anything, and starts
+ * it over. Call once after traceBegin.
+ */
+void flightBegin () {
+  uint8_t cause = MCUSR;
+
+  MCUSR = 0;
+  if (flightValid () && flight.count) flightDump (cause);
+
+  flight.magic = FLIGHT_MAGIC;
+  flight.head = flight.count = flight.check = 0;
+}
+#else
+#define flightWrite(k, a, v) do {} while (0)
+#define flightBegin() {}
+#endif
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __INTERLOCK_HDR__
+#define __INTERLOCK_HDR__
+
+#include "WoodStain.h"
+#include "debug.h"
+
+/**
+ * Break-before-make for the VFD's direction relays.
+ *
+ * Callers only ask for a direction. interlockPoll opens the relay that
+ * isn't wanted at once and closes the wanted one as soon as the other has
+ * been open for MOTOR_DEAD_TIME. Each relay's last change is kept, so a
+ * reversal waits out only what is left of the dead time, and a move asked
+ * for long after the last one starts straight away. Nothing here waits;
+ * keep calling interlockPoll until interlockMoving says the relay is in.
+ */
+
+#define INTERLOCK_STOP  -1
+
+struct {
+  int wanted;                 // UP, DOWN or INTERLOCK_STOP
+  uint8_t closed[2];          // Indexed by UP and DOWN
+  unsigned long changed[2];   // millis () at each relay's last change
+} interlock;
+
+int relayPin (int direction) {
+  return direction == UP ? MOTOR_UP : MOTOR_DOWN;
+}
+
+void relaySet (int direction, uint8_t closed) {
+  if (interlock.closed[direction] == closed) return;
+
+  digitalWrite (relayPin (direction), closed);
+  interlock.closed[direction] = closed;
+  interlock.changed[direction] = millis ();
+}
+
+/**
+ * Starts with both relays open, as the pins come out of reset. Call once
+ * after their pins are set up.
+ */
+void interlockBegin () {
+  interlock.wanted = INTERLOCK_STOP;
+  interlock.closed[UP] = interlock.closed[DOWN] = LOW;
+  interlock.changed[UP] = millis () - MOTOR_DEAD_TIME;
+  interlock.changed[DOWN] = interlock.changed[UP];
+}
+
+/**
+ * Milliseconds left before the wanted relay may close.
+ */
+unsigned long interlockHoldOff () {
+  int other = interlock.wanted == UP ? DOWN : UP;
+
+  if (interlock.wanted == INTERLOCK_STOP || interlock.closed[other])
+    return MOTOR_DEAD_TIME;
+
+  unsigned long open = millis () - interlock.changed[other];
+  return open >= MOTOR_DEAD_TIME ? 0 : MOTOR_DEAD_TIME - open;
+}
+
+void interlockPoll () {
+  int wanted = interlock.wanted;
+
+  if (wanted != UP) relaySet (UP, LOW);
+  if (wanted != DOWN) relaySet (DOWN, LOW);
+
+  if (wanted != INTERLOCK_STOP && !interlock.closed[wanted] &&
+      !interlockHoldOff ())
+    relaySet (wanted, HIGH);
+}
+
+/**
+ * Returns whether the relay for the wanted direction is in.
+ */
+int interlockMoving () {
+  return interlock.wanted != INTERLOCK_STOP &&
+    interlock.closed[interlock.wanted];
+}
+
+/**
+ * Asks for the carriage to move up or down.
+ */
+void interlockGo (int direction) {
+  interlock.wanted = direction;
+  interlockPoll ();
+
+  if (!interlockMoving ()) {
+    debug ("Holding off the motor relays");
+    trace (TRACE_WAIT, WAIT_SWITCH, interlockHoldOff ());
+  }
+}
+
+void interlockStop () {
+  interlock.wanted = INTERLOCK_STOP;
+  interlockPoll ();
+}
+
+#endif
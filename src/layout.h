@@ -0,0 +1,190 @@
+#ifndef __LAYOUT_HDR__
+#define __LAYOUT_HDR__
+
+#include "WoodStain.h"
+#include "params.h"
+#include "segments.h"
+
+/**
+ * Sparse beds, with SPARSE_BED defined: several parts laid out on the bed
+ * with room between them.
+ *
+ * The parts are the PART_COUNT rectangles of PART_BOUNDS. They're painted
+ * in rows, horizontal strokes up the bed a stroke gap apart, or spaced to
+ * the fan if params.fanCounts is set (see spacing.h), from the top gun on
+ * the lowest part's bottom edge to the bottom gun on the highest part's top
+ * one. A gun opens over a part once at least half its band is on it, or
+ * all of the part is in its band. A row runs from a ramp's length before
+ * its first part to its last part, and on past that as far as a shaped
+ * move takes to slow down, not from limit to limit. A row that crosses no
+ * part isn't run at all. Between rows, the carriage goes straight up to
+ * the next one that crosses a part and across to its start at the same
+ * time, with the guns closed. Along a row, the guns close over the gaps
+ * between its parts.
+ *
+ * Bounds are in steps right of the left limit and counts up from the
+ * bottom one. The planning only keeps positions, so the host tools run it
+ * too.
+ */
+
+typedef struct {
+  long left;
+  long right;
+  long bottom;
+  long top;
+} Part;
+
+typedef struct {
+  long first;         // From the bottom limit to the first row
+  int gap;
+  int count;
+  int band;           // How high a band one gun covers
+} Layout;
+
+typedef struct {
+  long from;          // The left edge of the row's leftmost part
+  long to;            // and the right edge of its rightmost one
+  uint8_t guns;       // SEGMENT_TOP and SEGMENT_BOTTOM, the ones it opens
+} Row;
+
+/**
+ * Loads the parts from PART_BOUNDS.
+ */
+void partsBegin (Part* parts) {
+  static const long bounds[PART_COUNT][4] = PART_BOUNDS;
+
+  for (int i = 0; i < PART_COUNT; i++) {
+    parts[i].left = bounds[i][0];
+    parts[i].right = bounds[i][1];
+    parts[i].bottom = bounds[i][2];
+    parts[i].top = bounds[i][3];
+  }
+}
+
+/**
+ * Plans the rows over n parts.
+ */
+void planLayout (const Params* p, const Part* parts, int n, Layout* l) {
+  long low = 0, high = 0;
+  long guns = p->gunCounts;
+
+  for (int i = 0; i < n; i++) {
+    if (!i || parts[i].bottom < low) low = parts[i].bottom;
+    if (!i || parts[i].top > high) high = parts[i].top;
+  }
+
+  if (p->fanCounts > 0) {
+    // The widest gap that still overlaps enough
+    l->gap = (long)p->fanCounts * (100 - p->overlap) / 100;
+    l->band = p->fanCounts;
+  } else {
+    l->gap = p->horizontalStrokeGap;
+    l->band = p->horizontalStrokeGap;
+  }
+  if (l->gap < 1) l->gap = 1;
+
+  l->first = low - guns / 2;
+  if (l->first < 0) l->first = 0;
+  l->count = n && high > low ? (high + guns / 2 - l->first) / l->gap + 1 : 0;
+}
+
+/**
+ * Returns the guns that cover a part from the row at y.
+ */
+uint8_t partGuns (const Params* p, const Layout* l, const Part* part,
+    long y) {
+  uint8_t guns = 0;
+
+  for (int top = 0; top < 2; top++) {
+    long at = top ? y + p->gunCounts / 2 : y - p->gunCounts / 2;
+    long above = at + l->band / 2 < part->top ? at + l->band / 2 : part->top;
+    long below = at - l->band / 2 > part->bottom ?
+      at - l->band / 2 : part->bottom;
+    long on = above - below;
+
+    if (on > 0 && (2 * on >= l->band || on == part->top - part->bottom))
+      guns |= top ? SEGMENT_TOP : SEGMENT_BOTTOM;
+  }
+
+  return guns;
+}
+
+/**
+ * Plans the row at y.
+ *
+ * @return the guns it opens, 0 if it crosses no part
+ */
+uint8_t planRow (const Params* p, const Layout* l, const Part* parts, int n,
+    long y, Row* r) {
+  r->guns = 0;
+
+  for (int i = 0; i < n; i++) {
+    uint8_t guns = partGuns (p, l, &parts[i], y);
+
+    if (!guns) continue;
+    if (!r->guns || parts[i].left < r->from) r->from = parts[i].left;
+    if (!r->guns || parts[i].right > r->to) r->to = parts[i].right;
+    r->guns |= guns;
+  }
+
+  return r->guns;
+}
+
+/**
+ * Returns the guns to open at x along the row at y.
+ */
+uint8_t rowSprays (const Params* p, const Layout* l, const Part* parts,
+    int n, long y, long x) {
+  uint8_t guns = 0;
+
+  for (int i = 0; i < n; i++)
+    if (x >= parts[i].left && x < parts[i].right)
+      guns |= partGuns (p, l, &parts[i], y);
+
+  return guns;
+}
+
+/**
+ * Works out where a row's run starts and ends, from whichever end is
+ * nearer the carriage at x.
+ *
+ * @return the direction it runs in
+ */
+int rowRun (const Params* p, const Row* r, long x, long* start, long* end) {
+  long ramp = p->horizontal.stepsToStart;
+  long overrun = p->shaper ? ramp : 0;
+  long left = r->from - ramp > 0 ? r->from - ramp : 0;
+  long right = r->to + ramp;
+
+  if (labs (x - left) <= labs (x - right)) {
+    *start = left;
+    *end = r->to + overrun;
+    return RIGHT;
+  }
+
+  *start = right;
+  *end = r->from - overrun > 0 ? r->from - overrun : 0;
+  return LEFT;
+}
+
+#ifdef SPARSE_BED
+
+#ifdef CONVEYOR
+#error "The conveyor brings its own panels, it has no parts laid out"
+#endif
+#ifdef DUAL_CARRIAGE
+#error "The parts are painted by one carriage"
+#endif
+#ifdef MULTI_COAT
+#error "The stations are painted whole"
+#endif
+#ifdef TOOLPATH
+#error "A toolpath is the whole job"
+#endif
+
+Part parts[PART_COUNT];
+Layout layout;
+
+#endif
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "WoodStain.h"
 #include "debug.h"
+#include "pt.h"
+#include "events.h"
 // #include "controls.h"
 // #include "limits.h"
 
@@ -13,17 +15,72 @@ extern "C" {
 const int verticalLimits[2] = {TOP_LIMIT, BOTTOM_LIMIT};
 const int horizontalLimits[2] = {LEFT_LIMIT, RIGHT_LIMIT};
 
+/**
+ * Waits out the debounce time after a limit switch changed state, counting
+ * how many times it bounced meanwhile.
+ *
+ * The waits in here are threads (see pt.h) that wait on the limits' events
+ * (see events.h); run them with PT_SPAWN. Only one of each runs at a time,
+ * but for debounce, which can run for each limit at once.
+ */
+char debounce (Pt* pt, int limit) {
+  static uint8_t edges[LIMITS];   // Apart, so two limits can debounce at once
+  int bounces;
+
+  PT_BEGIN (pt);
+
+  edges[limitIndex (limit)] = limitPresses (limit) + limitReleases (limit);
+  PT_SLEEP (pt, DEBOUNCE_TIME);
+  bounces = (uint8_t)(limitPresses (limit) + limitReleases (limit) -
+      edges[limitIndex (limit)]);
+
+#ifdef __debug__
+  if (bounces) {
+    char msg[40];
+    sprintf (msg, "Limit %d bounced %d times", limit, bounces);
+    debug (msg);
+  }
+#endif
+  trace (TRACE_LIMIT, limit, bounces);
+
+  PT_END (pt);
+}
+
+/**
+ * Returns where in pins the first limit that's pressed, or has been since
+ * its presses were counted, is. Returns len if there's none.
+ */
+unsigned int pressedSince (const int* pins, unsigned int len,
+    const uint8_t* presses) {
+  unsigned int i;
+
+  for (i = 0; i < len; i++)
+    if (limitPressed (pins[i]) || limitPresses (pins[i]) != presses[i]) break;
+
+  return i;
+}
+
 /**
  * Waits for any limit switch in a given array to be pressed.
+ *
+ * @param pressed is set to the pin of the one that was
  */
-unsigned int waitPressAny(const int* pins, unsigned int len) {
-  unsigned int i = 0;
+char waitPressAny (Pt* pt, const int* pins, unsigned int len, int* pressed) {
+  static Pt child;
+  static uint8_t presses[LIMITS];
+  static unsigned int i;
+
+  PT_BEGIN (pt);
+
+  trace (TRACE_WAIT, WAIT_LIMIT, 0);
+  for (i = 0; i < len; i++) presses[i] = limitPresses (pins[i]);
 
-  while(digitalRead(pins[i % len]) == LOW) i++;
+  PT_WAIT_UNTIL (pt, (i = pressedSince (pins, len, presses)) < len);
+  *pressed = pins[i];
 
-  delay(DEBOUNCE_TIME);
+  PT_SPAWN (pt, &child, debounce (&child, *pressed));
 
-  return pins[i % len];
+  PT_END (pt);
 }
 
 /**
@@ -84,35 +141,45 @@ int getDirection (int limit) {
  * This waits for any limit switch to be pressed from the two given
  * limit switches.
  *
- * @return returns the limit switch pin that corresponds to the pressed
- * limit switch after debouncing it.
+ * @param pressed is set to the limit switch pin that corresponds to the
+ * pressed limit switch after debouncing it.
  */
-int waitPressAnyOfTwo (int a, int b) {
-  char A, B;
+char waitPressAnyOfTwo (Pt* pt, int a, int b, int* pressed) {
+  static Pt child;
+  static int pins[2];
+  static uint8_t presses[2];
+  static unsigned int i;
 
-  assert (!(digitalRead (a) || digitalRead (b)),
+  PT_BEGIN (pt);
+
+  assert (!(limitPressed (a) || limitPressed (b)),
       "Waiting for buttons to be pressed when a button is already pressed");
 
   debug("Waiting for any limit switch to be pressed...");
+  trace (TRACE_WAIT, WAIT_LIMIT, 0);
+
+  pins[0] = a;
+  pins[1] = b;
+  presses[0] = limitPresses (a);
+  presses[1] = limitPresses (b);
 
   // Wait for either to be pressed first
-  while (!((A = digitalRead (a)) || (B = digitalRead (b))));
+  PT_WAIT_UNTIL (pt, (i = pressedSince (pins, 2, presses)) < 2);
 
-  assert (!(A && B), "Both the A and B limits are pressed. Fix that!");
+  assert (!(limitPressed (a) && limitPressed (b)),
+      "Both the A and B limits are pressed. Fix that!");
 
-  delay (DEBOUNCE_TIME);
+  PT_SPAWN (pt, &child, debounce (&child, pins[i]));
 
-  if (A) {
-    while (digitalRead (a));
-    debug ("\tThe A limit switch has been pressed");
-  } else if (B) {
-    while (digitalRead (b));
-    debug ("\tThe B limit switch has been pressed");
-  }
+  PT_WAIT_WHILE (pt, limitPressed (pins[i]));
+  debug (i == 0 ? "\tThe A limit switch has been pressed" :
+      "\tThe B limit switch has been pressed");
 
-  delay (DEBOUNCE_TIME);
+  PT_SPAWN (pt, &child, debounce (&child, pins[i]));
 
-  return A ? a : b;
+  *pressed = pins[i];
+
+  PT_END (pt);
 }
 
 /**
@@ -120,12 +187,22 @@ int waitPressAnyOfTwo (int a, int b) {
  *
  * @param limit is the limit switch pin number
  */
-void waitRelease (int limit) {
-  assert (digitalRead (limit),
+char waitRelease (Pt* pt, int limit) {
+  static Pt child;
+  static uint8_t releases;
+
+  PT_BEGIN (pt);
+
+  assert (limitPressed (limit),
       "Waiting for an unpressed button to be released...Stopping");
 
-  while (digitalRead (limit));
-  delay (DEBOUNCE_TIME);
+  trace (TRACE_WAIT, WAIT_LIMIT, 0);
+  releases = limitReleases (limit);
+  PT_WAIT_UNTIL (pt, !limitPressed (limit) ||
+      limitReleases (limit) != releases);
+  PT_SPAWN (pt, &child, debounce (&child, limit));
+
+  PT_END (pt);
 }
 
 /**
@@ -133,44 +210,71 @@ void waitRelease (int limit) {
  *
  * @param limit is the limit switch pin number
  */
-void waitPress (int limit) {
-  /* assert (!digitalRead (limit),
+char waitPress (Pt* pt, int limit) {
+  static Pt child;
+  static uint8_t presses;
+
+  PT_BEGIN (pt);
+
+  /* assert (!limitPressed (limit),
       "Waiting for a pressed button to be pressed...Stopping"); */
 
-  while (!digitalRead (limit));
-  delay (DEBOUNCE_TIME);
+  trace (TRACE_WAIT, WAIT_LIMIT, 0);
+  presses = limitPresses (limit);
+  PT_WAIT_UNTIL (pt, pressedSince (&limit, 1, &presses) == 0);
+  PT_SPAWN (pt, &child, debounce (&child, limit));
+
+  PT_END (pt);
 }
 
 /**
  * Provided that limit is a pin for a limit switch and the switch is
  * currently pressed, return when the switch is released for the second time.
  */
-void waitSecondRelease (int limit) {
-  waitRelease (limit);
-  waitPress (limit);
-  waitRelease (limit);
+char waitSecondRelease (Pt* pt, int limit) {
+  static Pt child;
+
+  PT_BEGIN (pt);
+
+  PT_SPAWN (pt, &child, waitRelease (&child, limit));
+  PT_SPAWN (pt, &child, waitPress (&child, limit));
+  PT_SPAWN (pt, &child, waitRelease (&child, limit));
+
+  PT_END (pt);
 }
 
 /**
  * This waits for any horizontal limit switch to be pressed.
  *
- * @return returns the limit switch pin that corresponds to the pressed
- * limit switch after debouncing it.
+ * @param pressed is set to the limit switch pin that corresponds to the
+ * pressed limit switch after debouncing it.
  */
-int waitPressHorizontal() {
+char waitPressHorizontal (Pt* pt, int* pressed) {
+  static Pt child;
+
+  PT_BEGIN (pt);
+
   debug ("Waiting for any horizontal limit switch to be pressed");
-  return waitPressAny(horizontalLimits, 2);
+  PT_SPAWN (pt, &child, waitPressAny (&child, horizontalLimits, 2, pressed));
+
+  PT_END (pt);
 }
 
 /**
  * This waits for any vertical limit switch to be pressed.
  *
- * @return returns the limit switch pin that corresponds to the pressed
- * limit switch after debouncing it.
+ * @param pressed is set to the limit switch pin that corresponds to the
+ * pressed limit switch after debouncing it.
  */
-int waitPressVertical () {
+char waitPressVertical (Pt* pt, int* pressed) {
+  static Pt child;
+
+  PT_BEGIN (pt);
+
   debug ("Waiting for any vertical limit switch to be pressed");
-  return waitPressAny(verticalLimits, 2);
+  PT_SPAWN (pt, &child, waitPressAny (&child, verticalLimits, 2, pressed));
+
+  PT_END (pt);
 }
 
 #endif
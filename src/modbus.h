@@ -0,0 +1,224 @@
+#ifndef __MODBUS_HDR__
+#define __MODBUS_HDR__
+
+#include "WoodStain.h"
+
+/**
+ * A Modbus RTU master on Serial1.
+ *
+ * Requests are queued and modbusPoll, called from whatever loop the
+ * controller is spinning in, moves them along one step at a time: it
+ * never waits for the line. The RS485 transceiver is expected to switch
+ * direction by itself.
+ */
+
+#define MODBUS_QUEUE      8     // Requests that can wait, a power of two
+#define MODBUS_TIMEOUT    100   // Milliseconds to wait for a reply
+#define MODBUS_RETRIES    2
+#define MODBUS_FRAME      16
+
+#define MODBUS_READ       0x03  // Read holding registers
+#define MODBUS_WRITE      0x06  // Write a single register
+
+#define MODBUS_FAILED     0xffff  // A write's result when it didn't go through
+
+#define MODBUS_IDLE       0
+#define MODBUS_WAITING    1
+
+typedef struct {
+  uint8_t slave;
+  uint8_t function;
+  uint16_t address;
+  uint16_t value;     // The value to write
+  uint16_t* result;   // Where a read value goes, or a written one once
+                      // it's acknowledged, if anywhere
+} ModbusRequest;
+
+struct {
+  ModbusRequest queue[MODBUS_QUEUE];
+  uint8_t head;
+  uint8_t tail;
+
+  uint8_t state;
+  uint8_t tries;
+  uint8_t frame[MODBUS_FRAME];
+  uint8_t length;
+  uint8_t expected;
+  unsigned long sent;     // millis () when the request went out
+  unsigned long quiet;    // micros () when the line last changed
+  unsigned int gap;       // Microseconds of silence between frames
+
+  unsigned int timeouts;
+  unsigned int errors;
+} modbus;
+
+/**
+ * The Modbus CRC-16, sent low byte first.
+ */
+uint16_t modbusCrc (const uint8_t* data, uint8_t n) {
+  uint16_t crc = 0xffff;
+
+  while (n--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++)
+      crc = crc & 1 ? (crc >> 1) ^ 0xa001 : crc >> 1;
+  }
+
+  return crc;
+}
+
+void modbusBegin (long baud) {
+  Serial1.begin (baud);
+
+  // 3.5 characters of 11 bits, or a fixed 1.75 ms above 19200 baud
+  modbus.gap = baud > 19200 ? 1750 : 38500000L / baud;
+  modbus.quiet = micros ();
+}
+
+/**
+ * Queues a request.
+ *
+ * @return whether there was room for it
+ */
+int modbusQueue (uint8_t slave, uint8_t function, uint16_t address,
+    uint16_t value, uint16_t* result) {
+  uint8_t next = (modbus.tail + 1) & (MODBUS_QUEUE - 1);
+  if (next == modbus.head) return 0;
+
+  ModbusRequest* r = &modbus.queue[modbus.tail];
+  r->slave = slave;
+  r->function = function;
+  r->address = address;
+  r->value = value;
+  r->result = result;
+  modbus.tail = next;
+
+  return 1;
+}
+
+/**
+ * Returns whether every queued request has been answered or given up on.
+ */
+int modbusIdle () {
+  return modbus.head == modbus.tail;
+}
+
+/**
+ * Returns whether a request with the given function is still queued.
+ */
+int modbusPending (uint8_t function) {
+  uint8_t i;
+
+  for (i = modbus.head; i != modbus.tail; i = (i + 1) & (MODBUS_QUEUE - 1))
+    if (modbus.queue[i].function == function) return 1;
+
+  return 0;
+}
+
+void modbusSend () {
+  ModbusRequest* r = &modbus.queue[modbus.head];
+  uint8_t* f = modbus.frame;
+
+  f[0] = r->slave;
+  f[1] = r->function;
+  f[2] = r->address >> 8;
+  f[3] = r->address;
+  f[4] = r->value >> 8;
+  f[5] = r->value;
+  uint16_t crc = modbusCrc (f, 6);
+  f[6] = crc;
+  f[7] = crc >> 8;
+
+  // A read of one register comes back as 7 bytes, a write is echoed
+  modbus.expected = r->function == MODBUS_READ ? 7 : 8;
+  modbus.length = 0;
+
+  // Nothing that came in before belongs to this reply
+  while (Serial1.available ()) Serial1.read ();
+
+  Serial1.write (f, 8);
+  modbus.sent = millis ();
+  modbus.state = MODBUS_WAITING;
+}
+
+/**
+ * Retires the request at the head of the queue. A write's result gets
+ * what the slave took, or MODBUS_FAILED if it didn't.
+ */
+void modbusDone (uint8_t ok) {
+  ModbusRequest* r = &modbus.queue[modbus.head];
+
+  if (r->function == MODBUS_WRITE && r->result)
+    *r->result = ok ? r->value : MODBUS_FAILED;
+
+  modbus.head = (modbus.head + 1) & (MODBUS_QUEUE - 1);
+  modbus.tries = 0;
+  modbus.state = MODBUS_IDLE;
+  modbus.quiet = micros ();
+}
+
+/**
+ * Checks a complete reply against the request at the head of the queue.
+ */
+void modbusReply () {
+  ModbusRequest* r = &modbus.queue[modbus.head];
+  uint8_t* f = modbus.frame;
+  uint8_t n = modbus.length;
+
+  if (n < 5 || modbusCrc (f, n - 2) != (f[n - 2] | f[n - 1] << 8) ||
+      f[0] != r->slave) {
+    // Garbled, try again
+    modbus.errors++;
+    if (++modbus.tries > MODBUS_RETRIES) modbusDone (0);
+    else modbus.state = MODBUS_IDLE;
+    modbus.quiet = micros ();
+    return;
+  }
+
+  if (f[1] != r->function) {
+    // An exception; asking again won't change the answer
+    modbus.errors++;
+    modbusDone (0);
+    return;
+  }
+
+  if (r->function == MODBUS_READ && r->result) *r->result = f[3] << 8 | f[4];
+  modbusDone (1);
+}
+
+/**
+ * Moves the transaction at the head of the queue along. Call this often.
+ */
+void modbusPoll () {
+  if (modbus.state == MODBUS_IDLE) {
+    // A late reply to a request that timed out, the line isn't quiet yet
+    while (Serial1.available ()) {
+      Serial1.read ();
+      modbus.quiet = micros ();
+    }
+
+    if (!modbusIdle () && micros () - modbus.quiet >= modbus.gap)
+      modbusSend ();
+    return;
+  }
+
+  while (Serial1.available ()) {
+    int c = Serial1.read ();
+    if (modbus.length < MODBUS_FRAME) modbus.frame[modbus.length++] = c;
+    modbus.quiet = micros ();
+  }
+
+  // Exception replies are 5 bytes long
+  uint8_t n = modbus.length;
+  if (n >= modbus.expected || (n == 5 && (modbus.frame[1] & 0x80)) ||
+      (n && micros () - modbus.quiet >= modbus.gap)) {
+    modbusReply ();
+  } else if (millis () - modbus.sent > MODBUS_TIMEOUT) {
+    modbus.timeouts++;
+    if (++modbus.tries > MODBUS_RETRIES) modbusDone (0);
+    else modbus.state = MODBUS_IDLE;
+    modbus.quiet = micros ();
+  }
+}
+
+#endif
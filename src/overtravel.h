@@ -0,0 +1,68 @@
+#ifndef __OVERTRAVEL_HDR__
+#define __OVERTRAVEL_HDR__
+
+#include "WoodStain.h"
+#include "params.h"
+
+/**
+ * Overtravel planning: where along a stroke the guns are open.
+ *
+ * A stroke runs from limit to limit, past the panel on both ends. With
+ * the panel's bounds in the parameter block, the guns open once the
+ * carriage is over the panel and done speeding up, and close as it leaves
+ * the panel, so the panel only ever sees the cruise. The horizontal ramp
+ * is the profile's stepsToStart from the start limit. The vertical one is
+ * the drive's, so the loop's speed tells when it's over. A blended stroke
+ * slowing into its limit closes the guns as it starts to, whatever the plan.
+ *
+ * Bounds are in steps from the left limit and counts from the bottom one.
+ * An axis whose bounds are both 0 isn't planned, its guns open at the start
+ * limit as they always have.
+ */
+
+typedef struct {
+  long from;          // The guns open once the carriage is past here
+  long to;            // and close again once it's past here
+  int sign;           // 1 when the stroke goes up or right, -1 otherwise
+  uint8_t clipped;    // The ramp runs onto the panel, its edge is skipped
+} Window;
+
+/**
+ * Plans a stroke's window.
+ *
+ * @param start is where the stroke starts on its axis
+ * @return whether the axis is planned
+ */
+int planStroke (const Params* p, int axis, int direction, long start,
+    Window* w) {
+  long low = axis == HORIZONTAL ? p->panelLeft : p->panelBottom;
+  long high = axis == HORIZONTAL ? p->panelRight : p->panelTop;
+
+  if (low >= high) return 0;
+
+  w->sign = direction == RIGHT || direction == UP ? 1 : -1;
+  w->from = w->sign > 0 ? low : high;
+  w->to = w->sign > 0 ? high : low;
+  w->clipped = 0;
+
+  if (axis == HORIZONTAL) {
+    long cruise = start + w->sign * (long)p->horizontal.stepsToStart;
+
+    // Not enough room before the panel for the whole ramp
+    if ((cruise - w->from) * w->sign > 0) {
+      w->from = cruise;
+      w->clipped = 1;
+    }
+  }
+
+  return 1;
+}
+
+/**
+ * Returns whether a position is in a window.
+ */
+int inWindow (const Window* w, long at) {
+  return (at - w->from) * w->sign >= 0 && (w->to - at) * w->sign > 0;
+}
+
+#endif
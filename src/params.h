@@ -0,0 +1,92 @@
+#ifndef __PARAMS_HDR__
+#define __PARAMS_HDR__
+
+#include "WoodStain.h"
+
+/**
+ * A stepper speed profile. The delays are in microseconds per half step and
+ * the carriage ramps from max to min over stepsToStart steps.
+ */
+typedef struct {
+  int min;
+  int max;
+  int stepsToStart;
+} Profile;
+
+/**
+ * The running parameter block.
+ *
+ * Everything the stroke pattern depends on is read from here instead of
+ * the compile time defaults so a tuned set can be dropped in as tuned.h.
+ */
+typedef struct {
+  Profile horizontal;
+  int horizontalStrokeGap;
+  int verticalStrokeGap;
+  int sprayMin;
+  int sprayMax;
+  int motorRest;
+  int verticalFrequency;
+  int verticalRamp;
+  int pidKp;
+  int pidKi;
+  int pidKd;
+  int blend;
+  int gunSettle;
+  long panelLeft;
+  long panelRight;
+  long panelBottom;
+  long panelTop;
+  int fanSteps;
+  int fanCounts;
+  int gunSteps;
+  int gunCounts;
+  int overlap;
+  int coats;
+  int dryTime[STAINS];
+  int shaper;
+  int shaperFrequency;
+  int shaperDamping;
+} Params;
+
+#define DEFAULT_PARAMS { \
+  { HORIZONTAL_STEPPER_MIN_DELAY, \
+    HORIZONTAL_STEPPER_MAX_DELAY, \
+    HORIZONTAL_STEPPER_START_GAP }, \
+  HORIZONTAL_STROKE_GAP, \
+  VERTICAL_STROKE_GAP, \
+  MIN, \
+  MAX, \
+  MOTOR_REST, \
+  VERTICAL_FREQUENCY, \
+  VERTICAL_RAMP, \
+  VERTICAL_KP, \
+  VERTICAL_KI, \
+  VERTICAL_KD, \
+  BLENDED_TURNAROUNDS, \
+  GUN_SETTLE, \
+  PANEL_LEFT, \
+  PANEL_RIGHT, \
+  PANEL_BOTTOM, \
+  PANEL_TOP, \
+  FAN_STEPS, \
+  FAN_COUNTS, \
+  GUN_STEPS, \
+  GUN_COUNTS, \
+  STROKE_OVERLAP, \
+  COATS, \
+  STAIN_DRY, \
+  SHAPER, \
+  SHAPER_FREQUENCY, \
+  SHAPER_DAMPING }
+
+// Define USE_TUNED_PARAMS to build with the set written by host/sweep
+#ifdef USE_TUNED_PARAMS
+#include "tuned.h"
+#else
+#define TUNED_PARAMS DEFAULT_PARAMS
+#endif
+
+Params params = TUNED_PARAMS;
+
+#endif
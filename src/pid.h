@@ -0,0 +1,239 @@
+#ifndef __PID_HDR__
+#define __PID_HDR__
+
+#include "WoodStain.h"
+#include "interlock.h"
+#include "events.h"
+#include "params.h"
+
+/**
+ * Closed loop position control of the vertical axis.
+ *
+ * The encoder is counted on both edges of both channels. Timer2 samples
+ * the limit switches at SAMPLE_RATE and runs the loop at PID_RATE: a
+ * fixed-point PID on the count, with the derivative
+ * taken on the measured speed and the integral frozen while the output is
+ * pinned, so it can't wind up on a long move. The gains are Q8 and live in
+ * the parameter block.
+ *
+ * The loop only computes a signed duty. pidApply, called from the main
+ * loop, turns its sign into a direction through the interlock and its
+ * size into PWM on the drive's analog frequency input. Full scale on the
+ * input is VFD_MAX_FREQUENCY, so the duty is held to pidTopSpeed's share
+ * of it, the fastest the carriage goes.
+ */
+
+#define PID_SHIFT       8     // The gains are Q8
+#define PID_MAX         255   // Full scale of the analog command
+#define PID_TOLERANCE   5     // Encoder counts that count as on target
+
+#define PID_OFF         0
+#define PID_OPEN        1     // A fixed command, for runs to a limit
+#define PID_CLOSED      2
+
+volatile long encoderCount;   // Counts up from the bottom limit
+
+struct {
+  volatile uint8_t mode;
+  volatile long target;       // Encoder count, closed loop
+  volatile int command;       // Signed duty the loop wants
+  volatile int most;          // The largest duty either way
+  volatile int speed;         // Counts in the last tick
+  volatile uint8_t still;     // Ticks in a row without moving
+  volatile uint8_t steady;    // Ticks in a row moving at the same speed
+  uint8_t arrived;            // The move done event is out
+  long integral;
+  long last;
+} pid;
+
+/**
+ * Counts one edge on either encoder channel.
+ */
+void encoderEdge () {
+  // -1, 0 or 1 for each previous and current state of the two channels
+  static const int8_t steps[16] = {
+    0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0
+  };
+  static uint8_t state;
+
+  // Straight to the core, record mode can't keep up with the encoder
+  state = (state << 2 | (digitalRead) (ENCODER_A) << 1 |
+      (digitalRead) (ENCODER_B)) & 0x0f;
+  encoderCount += steps[state];
+}
+
+#ifdef ENCODER_INDEX
+void encoderIndex () {
+  eventPush (EVENT_INDEX, 0, (uint16_t)encoderCount);
+}
+#endif
+
+long encoderPosition () {
+  noInterrupts ();
+  long count = encoderCount;
+  interrupts ();
+  return count;
+}
+
+void encoderZero () {
+  noInterrupts ();
+  encoderCount = 0;
+  pid.last = 0;
+  interrupts ();
+}
+
+/**
+ * One step of the loop. Runs in the Timer2 interrupt.
+ */
+void pidTick () {
+  long position = encoderCount;
+  int speed = position - pid.last;
+
+  pid.last = position;
+  if (speed && abs (speed - pid.speed) <= PID_TOLERANCE) {
+    if (pid.steady < 255) pid.steady++;
+  } else {
+    pid.steady = 0;
+  }
+  pid.speed = speed;
+  if (speed) pid.still = 0;
+  else if (pid.still < 255) pid.still++;
+
+  if (pid.mode != PID_CLOSED) {
+    pid.integral = 0;
+    if (pid.mode == PID_OFF) pid.command = 0;
+    return;
+  }
+
+  long error = pid.target - position;
+  if (error <= PID_TOLERANCE && error >= -PID_TOLERANCE && !speed) {
+    // On target, let the relays rest
+    pid.command = 0;
+    if (pid.still >= PID_SETTLE && !pid.arrived) {
+      pid.arrived = 1;
+      eventPush (EVENT_MOVE_DONE, VERTICAL, 0);
+    }
+    return;
+  }
+
+  long limit = (long)pid.most << PID_SHIFT;
+  long sum = params.pidKp * error + pid.integral -
+    (long)params.pidKd * speed;
+
+  // Only integrate when it could still change the output
+  if ((sum < limit || error < 0) && (sum > -limit || error > 0)) {
+    pid.integral += params.pidKi * error;
+    pid.integral = constrain (pid.integral, -limit, limit);
+  }
+
+  pid.command = constrain (sum >> PID_SHIFT, -pid.most, pid.most);
+}
+
+ISR (TIMER2_COMPA_vect) {
+  static uint8_t ticks;
+
+  limitSample ();
+
+  if (++ticks < SAMPLE_RATE / PID_RATE) return;
+  ticks = 0;
+  pidTick ();
+}
+
+/**
+ * Starts the encoder and the loop's timer. Call eventsBegin first, the
+ * timer samples the limits.
+ */
+void pidBegin () {
+  pinMode (ENCODER_A, INPUT_PULLUP);
+  pinMode (ENCODER_B, INPUT_PULLUP);
+  pinMode (VFD_SPEED, OUTPUT);
+  pid.most = PID_MAX;
+  attachInterrupt (digitalPinToInterrupt (ENCODER_A), encoderEdge, CHANGE);
+  attachInterrupt (digitalPinToInterrupt (ENCODER_B), encoderEdge, CHANGE);
+#ifdef ENCODER_INDEX
+  pinMode (ENCODER_INDEX, INPUT_PULLUP);
+  attachInterrupt (digitalPinToInterrupt (ENCODER_INDEX), encoderIndex, RISING);
+#endif
+
+  noInterrupts ();
+  TCCR2A = _BV (WGM21);                         // Clear on compare
+  TCCR2B = _BV (CS22) | _BV (CS20);             // Clock / 128
+  OCR2A = F_CPU / 128 / SAMPLE_RATE - 1;
+  TIMSK2 = _BV (OCIE2A);
+  interrupts ();
+}
+
+/**
+ * Holds the carriage at an encoder count. An EVENT_MOVE_DONE says when it
+ * has settled there.
+ */
+void pidMoveTo (long target) {
+  noInterrupts ();
+  pid.target = target;
+  pid.mode = PID_CLOSED;
+  pid.arrived = 0;
+  interrupts ();
+}
+
+/**
+ * Caps the duty at frequency, in hundredths of a Hz, on the drive.
+ */
+void pidTopSpeed (uint16_t frequency) {
+  int most = (long)PID_MAX * frequency / VFD_MAX_FREQUENCY;
+
+  noInterrupts ();
+  pid.most = most < PID_MAX ? most : PID_MAX;
+  interrupts ();
+}
+
+/**
+ * Drives open loop at a fixed signed duty.
+ */
+void pidRun (int command) {
+  noInterrupts ();
+  pid.command = command;
+  pid.mode = PID_OPEN;
+  interrupts ();
+}
+
+void pidStop () {
+  noInterrupts ();
+  pid.mode = PID_OFF;
+  pid.command = 0;
+  interrupts ();
+}
+
+/**
+ * Returns whether the carriage hasn't moved for PID_SETTLE ticks.
+ */
+int pidStopped () {
+  return pid.still >= PID_SETTLE;
+}
+
+/**
+ * Returns whether the carriage has been moving at the same speed for
+ * PID_SETTLE ticks, done speeding up.
+ */
+int pidCruising () {
+  return pid.steady >= PID_SETTLE;
+}
+
+/**
+ * Passes the loop's command on to the relays and the drive.
+ */
+void pidApply () {
+  noInterrupts ();
+  int command = pid.command;
+  interrupts ();
+
+  int wanted = command > 0 ? UP : command < 0 ? DOWN : INTERLOCK_STOP;
+  if (wanted != interlock.wanted) {
+    if (wanted == INTERLOCK_STOP) interlockStop ();
+    else interlockGo (wanted);
+  }
+
+  // Nothing on the analog input until the relay for the sign is in
+  analogWrite (VFD_SPEED, interlockMoving () ? abs (command) : 0);
+}
+
+#endif
@@ -34,4 +34,9 @@
 #define STP_3_DIR 31
 #define STP_3_STP 30
 
+#define ENC_A     2
+#define ENC_B     3
+
+#define PWM_1     6
+
 #endif
@@ -0,0 +1,110 @@
+#ifndef __PT_HDR__
+#define __PT_HDR__
+
+#include "debug.h"
+
+/**
+ * Protothreads: stackless coroutines in two bytes each.
+ *
+ * A thread is a function returning one of the PT_* states and taking its
+ * Pt. The macros turn its body into a switch on the line it last blocked
+ * at, so it picks up where it left off on the next call. Locals don't
+ * survive a block; keep what must in static variables. A switch statement
+ * can't span a blocking macro.
+ *
+ *   char blink (Pt* pt) {
+ *     PT_BEGIN (pt);
+ *     for (;;) {
+ *       digitalWrite (STATUS_LED, HIGH);
+ *       PT_SLEEP (pt, 300);
+ *       digitalWrite (STATUS_LED, LOW);
+ *       PT_SLEEP (pt, 300);
+ *     }
+ *     PT_END (pt);
+ *   }
+ */
+
+typedef struct {
+  unsigned short line;    // Where to pick up, 0 at the start
+  unsigned long since;    // When a PT_SLEEP started
+} Pt;
+
+#define PT_WAITING  0
+#define PT_YIELDED  1
+#define PT_EXITED   2
+
+#define PT_INIT(pt)   ((pt)->line = 0)
+
+#define PT_BEGIN(pt)  { char ptYielded = 1; (void)ptYielded; \
+                        switch ((pt)->line) { case 0:
+
+#define PT_END(pt)    } PT_INIT (pt); return PT_EXITED; }
+
+#define PT_EXIT(pt)   do { PT_INIT (pt); return PT_EXITED; } while (0)
+
+/**
+ * Blocks until a condition holds.
+ */
+#define PT_WAIT_UNTIL(pt, c) do { (pt)->line = __LINE__; case __LINE__: \
+                                  if (!(c)) return PT_WAITING; } while (0)
+
+#define PT_WAIT_WHILE(pt, c) PT_WAIT_UNTIL (pt, !(c))
+
+/**
+ * Lets the other threads run once.
+ */
+#define PT_YIELD(pt)  do { ptYielded = 0; (pt)->line = __LINE__; \
+                        case __LINE__: if (!ptYielded) return PT_YIELDED; \
+                      } while (0)
+
+/**
+ * Runs a child thread to the end. Its Pt is reset first.
+ */
+#define PT_SPAWN(pt, child, thread) do { PT_INIT (child); \
+                        PT_WAIT_UNTIL (pt, (thread) == PT_EXITED); } while (0)
+
+/**
+ * Blocks for ms milliseconds, or us microseconds, without holding up the
+ * other threads.
+ */
+#define PT_SLEEP(pt, ms) do { (pt)->since = millis (); \
+                        PT_WAIT_UNTIL (pt, millis () - (pt)->since >= \
+                            (unsigned long)(ms)); } while (0)
+
+#define PT_SLEEP_US(pt, us) do { (pt)->since = micros (); \
+                        PT_WAIT_UNTIL (pt, micros () - (pt)->since >= \
+                            (unsigned long)(us)); } while (0)
+
+/**
+ * The tasks loop () runs round robin, each until it blocks.
+ */
+#define TASKS       10
+
+typedef char (*Task) (Pt* pt);
+
+struct {
+  Task task[TASKS];
+  Pt pt[TASKS];
+  uint8_t count;
+} tasks;
+
+/**
+ * Adds a task to the loop. A task that doesn't fit would never run, and
+ * the machine would look alive without it, so that stops it instead.
+ */
+void taskAdd (Task task) {
+  if (tasks.count == TASKS) Stop ("More tasks than TASKS");
+
+  PT_INIT (&tasks.pt[tasks.count]);
+  tasks.task[tasks.count++] = task;
+}
+
+/**
+ * Runs every task once. A task that exits is started over.
+ */
+void taskRun () {
+  for (uint8_t i = 0; i < tasks.count; i++)
+    tasks.task[i] (&tasks.pt[i]);
+}
+
+#endif
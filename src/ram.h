@@ -0,0 +1,98 @@
+#ifndef __RAM_HDR__
+#define __RAM_HDR__
+
+#include "WoodStain.h"
+#include "debug.h"
+
+/**
+ * How much of the Mega's 8 KB of RAM is in use.
+ *
+ * The static data, .data, .bss and .noinit, sits at the bottom, the heap
+ * above it and the stack grows down from the top. ramBegin paints what's
+ * between the heap and the stack with RAM_PAINT at boot, and ramStackPeak
+ * works out the deepest the stack has been since from the paint that's
+ * left, so buffers and queues can be sized against that instead of
+ * guessed. A byte the stack wrote RAM_PAINT to looks untouched, so it may
+ * read a byte or so short. `make ram` breaks the static data down by the
+ * file it's defined in.
+ *
+ * The host tools have no such RAM, they get 0 for all of it.
+ */
+#define RAM_PAINT   0xc5
+
+#ifdef __AVR__
+
+extern uint8_t __heap_start;
+extern uint8_t* __brkval;
+
+uint8_t* ramHeapTop () {
+  return __brkval ? __brkval : &__heap_start;
+}
+
+/**
+ * Paints from the top of the heap to the stack. Call first thing in
+ * setup. An interrupt would push onto what's being painted, so they're
+ * held off for the millisecond or two it takes.
+ */
+void ramBegin () {
+  uint8_t* p = ramHeapTop ();
+
+  noInterrupts ();
+  while (p < (uint8_t*)SP) *p++ = RAM_PAINT;
+  interrupts ();
+}
+
+/**
+ * The bytes between the heap and the stack now.
+ */
+int ramFree () {
+  return (int)(SP - (uint16_t)ramHeapTop ());
+}
+
+/**
+ * The bytes the stack has never reached down to.
+ */
+int ramStackUnused () {
+  uint8_t* p = ramHeapTop ();
+  int n = 0;
+
+  while (p + n < (uint8_t*)SP && p[n] == RAM_PAINT) n++;
+  return n;
+}
+
+/**
+ * The most bytes the stack has used since ramBegin.
+ */
+int ramStackPeak () {
+  return (int)(RAMEND + 1 - (uint16_t)ramHeapTop ()) - ramStackUnused ();
+}
+
+/**
+ * The bytes of .data, .bss and .noinit.
+ */
+int ramStatic () {
+  return (int)((uint16_t)&__heap_start - RAMSTART);
+}
+
+#else
+#define ramBegin() {}
+#define ramFree() 0
+#define ramStackUnused() 0
+#define ramStackPeak() 0
+#define ramStatic() 0
+#endif
+
+/**
+ * Writes where the RAM went to the debug output.
+ */
+void ramReport () {
+#ifdef __debug__
+  char msg[80];
+
+  sprintf (msg, "RAM %d static, %d free, the stack at most %d", ramStatic (),
+      ramFree (), ramStackPeak ());
+  debug (msg);
+#endif
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef __RECIPES_HDR__
+#define __RECIPES_HDR__
+
+#include <stddef.h>
+#include <EEPROM.h>
+
+#include "WoodStain.h"
+#include "debug.h"
+#include "params.h"
+
+/**
+ * A table of recipes, one a product, in the EEPROM.
+ *
+ * A recipe is what changes from one product to the next: the horizontal
+ * profile, the stroke gaps, which strokes both guns spray on and the
+ * panel's bounds. The table holds up to RECIPES of them and which one is
+ * selected. The operator steps through them with RECIPE_NEXT and
+ * RECIPE_PREVIOUS, and the selected one is copied over the parameter block
+ * when the next job starts, and at power on. host/recipes writes the table
+ * from parameter sets. Without one the buttons do nothing and the block
+ * keeps its compiled values.
+ *
+ * The fields are fixed width and in an order that needs no padding, so the
+ * host lays them out as the Mega does.
+ */
+
+#define RECIPE_MAGIC      0x5357
+#define RECIPE_ADDRESS    0
+
+typedef struct {
+  uint16_t magic;
+  uint8_t count;
+  uint8_t selected;
+} RecipeTable;
+
+typedef struct {
+  int32_t panelLeft;
+  int32_t panelRight;
+  int32_t panelBottom;
+  int32_t panelTop;
+  int16_t min;
+  int16_t max;
+  int16_t stepsToStart;
+  int16_t horizontalStrokeGap;
+  int16_t verticalStrokeGap;
+  uint8_t sprayMin;
+  uint8_t sprayMax;
+  uint8_t check;            // Makes the bytes sum to 0
+  uint8_t spare[3];
+} Recipe;
+
+uint8_t recipeSum (const Recipe* r) {
+  const uint8_t* b = (const uint8_t*)r;
+  uint8_t sum = 0;
+
+  for (uint8_t i = 0; i < sizeof (Recipe); i++) sum += b[i];
+  return sum;
+}
+
+void recipeFrom (Recipe* r, const Params* p) {
+  memset (r, 0, sizeof (*r));
+  r->panelLeft = p->panelLeft;
+  r->panelRight = p->panelRight;
+  r->panelBottom = p->panelBottom;
+  r->panelTop = p->panelTop;
+  r->min = p->horizontal.min;
+  r->max = p->horizontal.max;
+  r->stepsToStart = p->horizontal.stepsToStart;
+  r->horizontalStrokeGap = p->horizontalStrokeGap;
+  r->verticalStrokeGap = p->verticalStrokeGap;
+  r->sprayMin = p->sprayMin;
+  r->sprayMax = p->sprayMax;
+  r->check = -recipeSum (r);
+}
+
+void recipeApply (const Recipe* r, Params* p) {
+  p->panelLeft = r->panelLeft;
+  p->panelRight = r->panelRight;
+  p->panelBottom = r->panelBottom;
+  p->panelTop = r->panelTop;
+  p->horizontal.min = r->min;
+  p->horizontal.max = r->max;
+  p->horizontal.stepsToStart = r->stepsToStart;
+  p->horizontalStrokeGap = r->horizontalStrokeGap;
+  p->verticalStrokeGap = r->verticalStrokeGap;
+  p->sprayMin = r->sprayMin;
+  p->sprayMax = r->sprayMax;
+}
+
+int recipeAddress (int n) {
+  return RECIPE_ADDRESS + sizeof (RecipeTable) + n * sizeof (Recipe);
+}
+
+struct {
+  uint8_t count;            // 0 without a table
+  uint8_t selected;
+  uint8_t loaded;           // The one in the parameter block
+} recipes;
+
+/**
+ * Copies the selected recipe over the parameter block if it isn't there
+ * already.
+ */
+void recipeLoad () {
+  Recipe r;
+
+  if (!recipes.count || recipes.loaded == recipes.selected) return;
+
+  EEPROM.get (recipeAddress (recipes.selected), r);
+  if (recipeSum (&r)) {
+    debug ("The recipe is corrupt, keeping the last one");
+    recipes.loaded = recipes.selected;
+    return;
+  }
+
+#ifdef __debug__
+  {
+    char msg[40];
+    sprintf (msg, "Loading recipe %d", recipes.selected + 1);
+    debug (msg);
+  }
+#endif
+
+  recipeApply (&r, &params);
+  recipes.loaded = recipes.selected;
+}
+
+/**
+ * Selects a recipe, for the next job and the next power on.
+ */
+void recipeSelect (uint8_t n) {
+  recipes.selected = n;
+  EEPROM.update (RECIPE_ADDRESS + offsetof (RecipeTable, selected), n);
+}
+
+/**
+ * Reads the table and loads the selected recipe.
+ */
+void recipesBegin () {
+  RecipeTable table;
+
+  pinMode (RECIPE_NEXT, INPUT_PULLUP);
+  pinMode (RECIPE_PREVIOUS, INPUT_PULLUP);
+
+  EEPROM.get (RECIPE_ADDRESS, table);
+  recipes.count = 0;
+  if (table.magic != RECIPE_MAGIC || !table.count ||
+      table.count > RECIPES || recipeAddress (table.count) > EEPROM.length ())
+    return;
+
+  recipes.count = table.count;
+  recipes.selected = table.selected < table.count ? table.selected : 0;
+  recipes.loaded = RECIPES;
+  recipeLoad ();
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __RECORD_HDR__
+#define __RECORD_HDR__
+
+#include "trace.h"
+
+/**
+ * Record mode.
+ *
+ * With __record__ defined every change seen on an input and every change
+ * written to an output goes into the trace as a TRACE_INPUT or
+ * TRACE_OUTPUT record, so host/replay can later feed the same inputs, at
+ * the same times, to a new build of the firmware.
+ *
+ * The stepper's step pin is left out, it changes far faster than the
+ * serial port can keep up with. On this board it shares a pin with the
+ * stepper's enable, so that isn't recorded either; TRACE_MOVE records mark
+ * the moves instead.
+ *
+ * Inputs sampled in an interrupt are recorded by whoever takes them up
+ * with recordInput, stamped with when they were sampled.
+ */
+#ifdef __record__
+
+#define RECORD_PINS   70
+#define RECORD_UNSEEN 2
+
+uint8_t recordLevels[RECORD_PINS];
+
+/**
+ * Marks every pin as unseen so its first read is recorded. Call once
+ * right after traceBegin.
+ */
+void recordBegin () {
+  memset (recordLevels, RECORD_UNSEEN, sizeof (recordLevels));
+}
+
+int recordRead (uint8_t pin) {
+  int level = (digitalRead) (pin);
+
+  if (pin < RECORD_PINS && recordLevels[pin] != level) {
+    recordLevels[pin] = level;
+    traceWrite (TRACE_INPUT, pin, level);
+  }
+
+  return level;
+}
+
+/**
+ * Records an input the firmware learned of without reading it, at the
+ * time it changed.
+ */
+void recordInput (uint32_t time, uint8_t pin, uint8_t level) {
+  if (pin < RECORD_PINS && recordLevels[pin] != level) {
+    recordLevels[pin] = level;
+    traceWriteAt (time, TRACE_INPUT, pin, level);
+  }
+}
+
+void recordWrite (uint8_t pin, uint8_t level) {
+  (digitalWrite) (pin, level);
+
+  if (pin == HORIZONTAL_STEPPER_STEP || pin == CONVEYOR_STEPPER_STEP ||
+      pin == SECOND_STEPPER_STEP) return;
+  if (pin < RECORD_PINS && recordLevels[pin] != level) {
+    recordLevels[pin] = level;
+    traceWrite (TRACE_OUTPUT, pin, level);
+  }
+}
+
+// Everything included after this goes through the recorder
+#define digitalRead(p) recordRead (p)
+#define digitalWrite(p, v) recordWrite (p, v)
+#else
+#define recordBegin() {}
+#define recordInput(t, p, l) {}
+#endif
+
+#endif
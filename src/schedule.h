@@ -0,0 +1,105 @@
+#ifndef __SCHEDULE_HDR__
+#define __SCHEDULE_HDR__
+
+#include "WoodStain.h"
+#include "params.h"
+
+/**
+ * Multi-coat jobs over several stations, with MULTI_COAT defined.
+ *
+ * The bed holds STATION_COUNT panels side by side, each between its
+ * STATION_BOUNDS and stained with its entry of STATION_STAINS. Each gets
+ * params.coats coats, and each coat has to dry for its stain's
+ * params.dryTime seconds before the next goes on. Rather than sit out the
+ * drying, the carriage paints another station meanwhile: of the stations
+ * that are dry it takes the one with the most drying still ahead of it, so
+ * the longest waits start first, and when none is dry it waits for the one
+ * that will be first.
+ *
+ * The scheduler only keeps the times, so the host tools run it too.
+ */
+
+typedef struct {
+  long left;                // Steps right of the left limit
+  long right;
+  uint8_t stain;
+  uint8_t coats;            // Laid so far
+  unsigned long dryAt;      // When the last one is dry, in milliseconds
+} Station;
+
+/**
+ * Loads the stations from STATION_BOUNDS and STATION_STAINS, bare and dry
+ * as of now.
+ */
+void stationsBegin (Station* s, unsigned long now) {
+  static const long bounds[STATION_COUNT][2] = STATION_BOUNDS;
+  static const uint8_t stains[STATION_COUNT] = STATION_STAINS;
+
+  for (int i = 0; i < STATION_COUNT; i++) {
+    s[i].left = bounds[i][0];
+    s[i].right = bounds[i][1];
+    s[i].stain = stains[i];
+    s[i].coats = 0;
+    s[i].dryAt = now;
+  }
+}
+
+/**
+ * Returns how long a station has left to dry at now, in milliseconds.
+ */
+long stationWait (const Station* s, unsigned long now) {
+  long wait = (long)(s->dryAt - now);
+  return wait > 0 ? wait : 0;
+}
+
+/**
+ * Picks the station to paint next.
+ *
+ * @return its index, or -1 once each of the n has all its coats
+ */
+int nextStation (const Params* p, const Station* s, int n,
+    unsigned long now) {
+  int best = -1;
+  long bestWait = 0;
+  long bestAhead = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (s[i].coats >= p->coats) continue;
+
+    // The drying its coats after this one will need
+    long wait = stationWait (&s[i], now);
+    long ahead = (long)(p->coats - s[i].coats - 1) * p->dryTime[s[i].stain];
+
+    if (best < 0 || wait < bestWait ||
+        (wait == bestWait && ahead > bestAhead)) {
+      best = i;
+      bestWait = wait;
+      bestAhead = ahead;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * Marks a coat laid on a station at now.
+ */
+void stationCoated (const Params* p, Station* s, unsigned long now) {
+  s->coats++;
+  s->dryAt = now + p->dryTime[s->stain] * 1000UL;
+}
+
+#ifdef MULTI_COAT
+
+#ifdef CONVEYOR
+#error "The conveyor brings its own panels, it has no stations"
+#endif
+#ifdef DUAL_CARRIAGE
+#error "The stations are painted by one carriage at a time"
+#endif
+
+Station stations[STATION_COUNT];
+
+#endif
+
+#endif
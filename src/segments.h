@@ -0,0 +1,120 @@
+#ifndef __SEGMENTS_HDR__
+#define __SEGMENTS_HDR__
+
+#include "WoodStain.h"
+
+/**
+ * Toolpath segments, as written by host/toolpath.
+ *
+ * A toolpath is the whole job worked out on the host: each stroke with the
+ * guns it opens and where along it they're open, and the moves between
+ * them, in the order they're run. It's a stream of segments, each a byte
+ * and one or two numbers:
+ *
+ *    bits 7-6  SEGMENT_END, SEGMENT_MOVE or SEGMENT_STROKE
+ *    bit 5     the axis it runs along, VERTICAL or HORIZONTAL
+ *    bits 1-0  a stroke's guns, SEGMENT_TOP and SEGMENT_BOTTOM, or for a
+ *              move SEGMENT_LIMIT
+ *
+ * A move is followed by how far it goes, negative down or left, or with
+ * SEGMENT_LIMIT just which way, to the limit that way. A stroke
+ * runs limit to limit, and is followed by the two ends of its window (see
+ * overtravel.h), each less the last stroke's on that axis. Both ends 0 is
+ * open limit to limit. The numbers are zigzag varints: the sign in the low
+ * bit and 7 bits a byte, low first, the top bit set on all but the last. So
+ * a move a stroke gap long takes two bytes and a stroke over the same
+ * stretch as the one before it takes three.
+ *
+ * The toolpath starts with the carriage at the bottom and left limits.
+ */
+
+#define SEGMENT_END       0
+#define SEGMENT_MOVE      1
+#define SEGMENT_STROKE    2
+
+#define SEGMENT_TOP       1
+#define SEGMENT_BOTTOM    2
+#define SEGMENT_LIMIT     1
+
+typedef struct {
+  uint8_t op;
+  uint8_t axis;
+  uint8_t sprays;     // A stroke's guns or a move's SEGMENT_LIMIT
+  long distance;      // A move's
+  long from;          // A stroke's window, from the bottom or left limit
+  long to;
+} Segment;
+
+typedef struct {
+  const uint8_t* at;  // In program memory
+  long from[2];       // The last window on each axis
+  long to[2];
+} SegmentReader;
+
+void segmentsBegin (SegmentReader* r, const uint8_t* path) {
+  r->at = path;
+  r->from[VERTICAL] = r->to[VERTICAL] = 0;
+  r->from[HORIZONTAL] = r->to[HORIZONTAL] = 0;
+}
+
+long segmentNumber (SegmentReader* r) {
+  unsigned long n = 0;
+  uint8_t shift = 0;
+  uint8_t b;
+
+  do {
+    b = pgm_read_byte (r->at++);
+    n |= (unsigned long)(b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+
+  return (long)(n >> 1) ^ -(long)(n & 1);
+}
+
+/**
+ * Reads the next segment.
+ *
+ * @return 0 at the end of the toolpath
+ */
+int segmentNext (SegmentReader* r, Segment* s) {
+  uint8_t b = pgm_read_byte (r->at);
+
+  s->op = b >> 6;
+  if (s->op == SEGMENT_END) return 0;
+  r->at++;
+
+  s->axis = (b >> 5) & 1;
+  s->sprays = b & 3;
+
+  if (s->op == SEGMENT_MOVE) {
+    s->distance = segmentNumber (r);
+  } else {
+    r->from[s->axis] += segmentNumber (r);
+    r->to[s->axis] += segmentNumber (r);
+    s->from = r->from[s->axis];
+    s->to = r->to[s->axis];
+  }
+
+  return 1;
+}
+
+/**
+ * With TOOLPATH defined, the job is the toolpath in toolpath.h.
+ */
+#ifdef TOOLPATH
+
+#ifdef CONVEYOR
+#error "A toolpath is planned on a panel that stays put"
+#endif
+#ifdef DUAL_CARRIAGE
+#error "A toolpath is planned for one carriage"
+#endif
+#ifdef MULTI_COAT
+#error "A toolpath is the whole job"
+#endif
+
+#include "toolpath.h"
+
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef __SHAPER_HDR__
+#define __SHAPER_HDR__
+
+#include "WoodStain.h"
+#include "fixed.h"
+#include "params.h"
+
+/**
+ * Input shaping of the horizontal moves.
+ *
+ * A shaped move's speed is planned in time as a trapezoid: from the
+ * profile's slowest speed up at a steady acceleration to its fastest, the
+ * ramp as long as the unshaped one, and back down onto the count. The
+ * trapezoid is then put through a ZV or ZVD shaper: the speed at any time
+ * is a weighted sum of the trapezoid's at that time and half a ringing
+ * period and, for ZVD, a whole one before. The ringing each part of the
+ * ramp starts is cancelled by the same part starting it half a period
+ * later, so the carriage and gun mount don't ring once the speed settles,
+ * at the cost of half a period more ramp (ZV) or a whole one (ZVD). ZVD
+ * still cancels most of it with the frequency a little off.
+ *
+ * The ringing's frequency is params.shaperFrequency tenths of a Hz and its
+ * damping ratio params.shaperDamping thousandths.
+ *
+ * It's all fixed-point (see fixed.h). Speeds are q16 steps a second, times
+ * are microseconds, and the acceleration is in steps a second per 256
+ * microseconds, so a speed change is one fixedMultiply.
+ *
+ * The shaped speed is a straight line between the times a part of the
+ * trapezoid starts or ends, twelve at most. shapedPlan works out each
+ * line once a move, so a step only takes one multiply and the divide for
+ * its delay.
+ */
+
+typedef struct {
+  uint8_t count;
+  q8 amplitude[3];
+  long delay[3];            // Microseconds
+} Shaper;
+
+#define RAMP_NEVER  0x7fffffffL
+
+/**
+ * The speed trapezoid above the slowest speed. A run to a limit that isn't
+ * known yet never slows down.
+ */
+typedef struct {
+  q16 start;                // The slowest speed
+  q16 rise;                 // Its top above that
+  q16 accel;
+  long ramped;              // When it's at the top
+  long slowing;             // When it starts slowing down
+  long stopped;             // When it's back down to the slowest
+} Ramp;
+
+void shaperPlan (const Params* p, Shaper* s) {
+  q16 zeta = q16Div (p->shaperDamping, 1000);
+  q16 root = q16Sqrt (Q16_ONE - q16Mul (zeta, zeta));
+  q16 k = q16Exp (-q16Div (q16Mul (zeta, Q16_PI), root));
+
+  // Half a period is 5 / (f root) seconds, in milliseconds then on
+  long half = fixedMultiply (q16Div (q16FromInt (5000),
+        q16MulInt (root, p->shaperFrequency)), 1000, 16);
+
+  s->amplitude[0] = Q8_ONE;
+  s->delay[0] = 0;
+  s->count = 1;
+
+  // The last amplitude takes up the rounding so they add up to one
+  if (p->shaper == SHAPER_ZV) {
+    s->amplitude[0] = q8FromQ16 (q16Recip (Q16_ONE + k));
+    s->amplitude[1] = Q8_ONE - s->amplitude[0];
+    s->delay[1] = half;
+    s->count = 2;
+  } else if (p->shaper == SHAPER_ZVD) {
+    q16 d = q16Recip (q16Mul (Q16_ONE + k, Q16_ONE + k));
+
+    s->amplitude[0] = q8FromQ16 (d);
+    s->amplitude[1] = q8FromQ16 (q16Mul (2 * k, d));
+    s->amplitude[2] = Q8_ONE - s->amplitude[0] - s->amplitude[1];
+    s->delay[1] = half;
+    s->delay[2] = 2 * half;
+    s->count = 3;
+  }
+}
+
+// 1024 squared over a million, times 256, in 65536ths
+#define RAMP_SCALE  17592186L
+
+// The shortest half step a q16 of steps a second holds, in microseconds
+#define RAMP_FASTEST  16
+
+/**
+ * Plans the trapezoid for a move of steps, or LIMIT. Squared speeds don't
+ * fit a q16, so they're worked out in 1024 steps a second. A profile with
+ * a half step under RAMP_FASTEST is planned at that.
+ */
+void rampPlan (Ramp* r, const Profile* p, long steps) {
+  q16 slow = q16Div (15625, 32L * p->max);
+  q16 fast = q16Div (15625, 32L * (p->min > RAMP_FASTEST ?
+        p->min : RAMP_FASTEST));
+  q16 squared = q16Mul (slow, slow);
+  q16 span = q16Mul (fast, fast) - squared;
+  long twice = 2L * p->stepsToStart;
+
+  // The same distance to get up to speed as the unshaped ramp. Scaled up
+  // first, a steep one's acceleration doesn't fit, so it's scaled 256
+  // times less and the quotient and remainder shifted back up.
+  q16 scaled = fixedMultiply (span, RAMP_SCALE, 24);
+  uint32_t whole = scaled / twice;
+
+  r->start = slow * 1024;
+  r->accel = whole >> 23 ? Q16_MAX :
+    (q16)(whole << 8) + (scaled % twice << 8) / twice;
+
+  if (steps != LIMIT && steps < 2L * p->stepsToStart) {
+    // Too short to get up to speed, half up and half down
+    r->rise = (q16Sqrt (squared + q16Mul (span,
+            q16Div (steps, 2L * p->stepsToStart))) - slow) * 1024;
+    r->ramped = r->slowing = q16Div (r->rise, r->accel) >> 8;
+    r->stopped = 2 * r->ramped;
+    return;
+  }
+
+  r->rise = (fast - slow) * 1024;
+  r->ramped = q16Div (r->rise, r->accel) >> 8;
+
+  if (steps == LIMIT) {
+    r->slowing = r->stopped = RAMP_NEVER;
+  } else {
+    // The cruise's steps over its speed, in seconds first
+    q16 cruise = q16Div (q16Div (steps - 2L * p->stepsToStart, 1024),
+        (r->start + r->rise) / 1024);
+
+    r->slowing = r->ramped + fixedMultiply (cruise, 1000000L, 16);
+    r->stopped = r->slowing + r->ramped;
+  }
+}
+
+/**
+ * Returns the unshaped speed t microseconds into a move, the slowest speed
+ * from its start to its end.
+ */
+q16 rampSpeed (const Ramp* r, long t) {
+  if (t < 0 || t >= r->stopped) return 0;
+  if (t < r->ramped) return r->start + fixedMultiply (r->accel, t, 8);
+  if (t < r->slowing) return r->start + r->rise;
+  return r->start + r->rise - fixedMultiply (r->accel, t - r->slowing, 8);
+}
+
+/**
+ * Returns the shaped speed t microseconds into a move. The jumps to and
+ * from the slowest speed are shaped too, so a move starts and ends on a
+ * fraction of it. A move that hasn't reached its count or limit by the end
+ * of the plan carries on at the last fraction.
+ */
+q16 shapedSpeed (const Shaper* s, const Ramp* r, long t) {
+  q16 v = 0;
+
+  for (uint8_t i = 0; i < s->count; i++)
+    v += q16MulQ8 (rampSpeed (r, t - s->delay[i]), s->amplitude[i]);
+  return v > 0 ? v : q16MulQ8 (r->start, s->amplitude[s->count - 1]);
+}
+
+#define SHAPED_LINES  12
+
+/**
+ * A shaped move's speed, a line at a time.
+ */
+typedef struct {
+  uint8_t count;
+  uint8_t at;                   // The line the last time was on
+  long from[SHAPED_LINES];      // When each starts
+  q16 speed[SHAPED_LINES];      // The speed there
+  q16 slope[SHAPED_LINES];      // Its change, as Ramp's accel
+} Shaped;
+
+/**
+ * The trapezoid's slope t microseconds into it.
+ */
+q16 rampSlope (const Ramp* r, long t) {
+  if (t < 0 || t >= r->stopped) return 0;
+  if (t < r->ramped) return r->accel;
+  if (t < r->slowing) return 0;
+  return -r->accel;
+}
+
+/**
+ * Plans the lines, starting where each impulse of the shaper sees a
+ * corner of the trapezoid. A run to a limit has no corners at RAMP_NEVER.
+ */
+void shapedPlan (Shaped* p, const Shaper* s, const Ramp* r) {
+  long corner[4] = { 0, r->ramped, r->slowing, r->stopped };
+
+  p->count = 0;
+  p->at = 0;
+  for (uint8_t i = 0; i < s->count; i++) {
+    for (uint8_t k = 0; k < 4; k++) {
+      if (corner[k] == RAMP_NEVER) continue;
+
+      // In order, once each
+      long t = corner[k] + s->delay[i];
+      uint8_t j = 0;
+
+      while (j < p->count && p->from[j] < t) j++;
+      if (j < p->count && p->from[j] == t) continue;
+      for (uint8_t m = p->count; m > j; m--) p->from[m] = p->from[m - 1];
+      p->from[j] = t;
+      p->count++;
+    }
+  }
+
+  for (uint8_t j = 0; j < p->count; j++) {
+    p->speed[j] = shapedSpeed (s, r, p->from[j]);
+    p->slope[j] = 0;
+    for (uint8_t i = 0; i < s->count; i++)
+      p->slope[j] += q16MulQ8 (rampSlope (r, p->from[j] - s->delay[i]),
+          s->amplitude[i]);
+  }
+}
+
+/**
+ * Returns the shaped speed t microseconds into a move, from the plan.
+ * Times are expected to go forwards, the line is only looked for from
+ * the last one on.
+ */
+q16 shapedAt (Shaped* p, long t) {
+  if (t < p->from[p->at]) p->at = 0;
+  while (p->at + 1 < p->count && t >= p->from[p->at + 1]) p->at++;
+
+  return p->speed[p->at] +
+    fixedMultiply (p->slope[p->at], t - p->from[p->at], 8);
+}
+
+/**
+ * Returns the half step delay t microseconds into a move, to the nearest
+ * microsecond the step is timed in.
+ */
+int shapedDelay (Shaped* p, long t) {
+  uint32_t v = shapedAt (p, t) >> 8;
+
+  return (int)((500000UL * 256 + v / 2) / v);
+}
+
+#endif
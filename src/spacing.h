@@ -0,0 +1,79 @@
+#ifndef __SPACING_HDR__
+#define __SPACING_HDR__
+
+#include "WoodStain.h"
+#include "params.h"
+
+/**
+ * Stroke spacing from the spray fan.
+ *
+ * Each gun lays a fan wide band and the bands of one gun on strokes next
+ * to each other overlap by params.overlap percent. The strokes are spaced
+ * so that each of the two guns covers the whole panel by itself: the
+ * first stroke has the top gun on the panel's near edge, and the last has
+ * the bottom gun on its far edge, the carriage being half way between
+ * them. The planner takes the largest gap that keeps the overlap, the
+ * fewest strokes that span that with it, then spreads the gap evenly over
+ * them, so it may come out a little smaller. A gun whose band would be off
+ * the panel is zoned off, which leaves the top gun alone on the first
+ * strokes and the bottom one alone on the last ones. A panel closer to the
+ * near limit than half the guns' spacing can't have its first stroke where
+ * it should be; it goes on the limit instead and the plan says so.
+ *
+ * The extent is the panel's bounds in the parameter block (see
+ * overtravel.h), the fan and the guns' spacing are in steps across
+ * vertical strokes and counts across horizontal ones. With no bounds or
+ * no fan the strokes go the fixed stroke gaps apart until the far limit,
+ * zoned by sprayMin and sprayMax, as they always have.
+ */
+
+typedef struct {
+  long first;       // From the near limit to the first stroke
+  int gap;
+  int count;
+  int sprayMin;     // The first stroke with both guns
+  int sprayMax;     // and the last
+  uint8_t clamped;  // The first stroke is on the limit, short of the plan
+} Spacing;
+
+/**
+ * Plans the strokes for a pattern that transitions along axis, away from
+ * the bottom or left limit.
+ *
+ * @return whether it's planned
+ */
+int planSpacing (const Params* p, int axis, Spacing* s) {
+  long low = axis == HORIZONTAL ? p->panelLeft : p->panelBottom;
+  long high = axis == HORIZONTAL ? p->panelRight : p->panelTop;
+  long fan = axis == HORIZONTAL ? p->fanSteps : p->fanCounts;
+  long guns = axis == HORIZONTAL ? p->gunSteps : p->gunCounts;
+  long span = high - low + guns;         // From the first stroke to the last
+
+  if (high <= low || fan <= 0) return 0;
+
+  // The widest gap that still overlaps enough
+  long most = fan * (100 - p->overlap) / 100;
+  if (most < 1) most = 1;
+
+  s->first = low - guns / 2;
+  s->clamped = s->first < 0;
+  if (s->clamped) s->first = 0;
+
+  if (span <= 0) {
+    s->count = 1;
+    s->gap = 0;
+    s->sprayMin = s->sprayMax = 0;
+    return 1;
+  }
+
+  s->count = (span + most - 1) / most + 1;
+  s->gap = span / (s->count - 1);
+
+  // The bottom gun opens once its band is more on the panel than off it
+  s->sprayMin = guns > s->gap / 2 ? (guns - s->gap / 2 + s->gap - 1) / s->gap : 0;
+  s->sprayMax = s->count - 1 - s->sprayMin;
+
+  return 1;
+}
+
+#endif
@@ -5,6 +5,7 @@
  */
 void bothSprays () {
   debug ("Turning on both sprays");
+  trace (TRACE_SPRAYS, 3, 0);
   digitalWrite (TOP_SPRAY, 1);
   digitalWrite (BOTTOM_SPRAY, 1);
 }
@@ -14,6 +15,7 @@ void bothSprays () {
  */
 void bottomSpray () {
   debug ("Turning on the bottom spray");
+  trace (TRACE_SPRAYS, 2, 0);
   digitalWrite (TOP_SPRAY, 0);
   digitalWrite (BOTTOM_SPRAY, 1);
 }
@@ -23,6 +25,7 @@ void bottomSpray () {
  */
 void topSpray () {
   debug ("Turning on the top spray");
+  trace (TRACE_SPRAYS, 1, 0);
   digitalWrite (TOP_SPRAY, 1);
   digitalWrite (BOTTOM_SPRAY, 0);
 }
@@ -0,0 +1,294 @@
+#ifndef __STEPPER_HDR__
+#define __STEPPER_HDR__
+
+#include "WoodStain.h"
+#include "fixed.h"
+#include "params.h"
+
+/**
+ * Step pulses from Timer1's output compare, with HARDWARE_STEPPING.
+ *
+ * Timer1 toggles OC1A (HORIZONTAL_STEPPER_PULSE) every half step by itself,
+ * so the driver's STEP input gets its pulses without the CPU. That pin is
+ * jumpered on to T5 (HORIZONTAL_STEPPER_COUNT), where Timer5 counts the
+ * steps, also by itself. The Timer1 interrupt only runs while the speed
+ * ramps, to reload the compare value once a step, and the Timer5 compare
+ * interrupt marks where the ramp down starts and where a counted move
+ * stops. At cruise neither runs, and how fast the carriage can go is up to
+ * the driver. Counts are 16 bits.
+ *
+ * The ramps are goUntil's: the half step delay falls from the profile's
+ * max to its min over stepsToStart steps and rises back the same way.
+ */
+#ifdef HARDWARE_STEPPING
+
+#define STEPPER_TICKS   2     // Timer1 ticks per microsecond, at clock / 8
+
+struct {
+  volatile uint8_t running;
+  volatile int8_t ramp;       // 1 speeding up, -1 slowing down, 0 cruising
+  volatile uint8_t braking;   // The ramp down has started
+  uint8_t phase;              // 1 between a step's two toggles
+  q16 delay;                  // Half step in microseconds
+  q16 min;
+  q16 max;
+  q16 decrement;
+  uint16_t brakeAt;           // Step to slow down from, 0 for none
+  uint16_t stopAt;            // Step to stop on, 0 for a run to a limit
+} stepper;
+
+void stepperBegin () {
+  pinMode (HORIZONTAL_STEPPER_PULSE, OUTPUT);
+  pinMode (HORIZONTAL_STEPPER_COUNT, INPUT);
+}
+
+/**
+ * Sets the next half step. In clear on compare mode OCR1A isn't buffered,
+ * so this has to happen early in the half step it's for.
+ */
+void stepperLoad () {
+  OCR1A = q16ToInt (stepper.delay) * STEPPER_TICKS - 1;
+}
+
+/**
+ * Cuts the pulses and leaves the step output low.
+ */
+void stepperHalt () {
+  TCCR1B = 0;
+  TIMSK1 = 0;
+  TIMSK5 = 0;
+
+  // Half way through a step, finish it
+  if ((digitalRead) (HORIZONTAL_STEPPER_PULSE)) TCCR1C = _BV (FOC1A);
+  TCCR1A = 0;
+  (digitalWrite) (HORIZONTAL_STEPPER_PULSE, LOW);
+
+  stepper.running = 0;
+}
+
+ISR (TIMER1_COMPA_vect) {
+  // Two toggles to a step
+  if ((stepper.phase ^= 1)) return;
+
+  if (stepper.ramp > 0) {
+    if (stepper.delay >= stepper.min + stepper.decrement) {
+      stepper.delay -= stepper.decrement;
+    } else {
+      // At cruise, hands off
+      stepper.delay = stepper.min;
+      stepper.ramp = 0;
+      TIMSK1 = 0;
+    }
+  } else if (stepper.ramp < 0) {
+    if (stepper.delay + stepper.decrement <= stepper.max) {
+      stepper.delay += stepper.decrement;
+    } else {
+      stepper.delay = stepper.max;
+      stepper.ramp = 0;
+      TIMSK1 = 0;
+    }
+  }
+
+  stepperLoad ();
+}
+
+ISR (TIMER5_COMPA_vect) {
+  uint16_t steps = TCNT5;
+
+  if (stepper.brakeAt && steps >= stepper.brakeAt) {
+    stepper.brakeAt = 0;
+    stepper.braking = 1;
+    stepper.ramp = -1;
+
+    // Counted on the rising edge, the next toggle ends the step
+    stepper.phase = 1;
+    TIMSK1 = _BV (OCIE1A);
+
+    if (stepper.stopAt) OCR5A = stepper.stopAt;
+    else TIMSK5 = 0;
+  } else if (stepper.stopAt && steps >= stepper.stopAt) {
+    stepperHalt ();
+  }
+}
+
+/**
+ * Starts a move. Set the direction first.
+ *
+ * @param steps is how many to stop after, 0 to run until stepperHalt
+ * @param brakeAt is the step to start slowing down from, 0 for none
+ */
+void stepperStart (const Profile* p, uint16_t steps, uint16_t brakeAt) {
+  stepper.max = q16FromInt (p->max);
+  stepper.min = q16FromInt (p->min);
+  stepper.decrement = q16Div (p->max - p->min, p->stepsToStart);
+  stepper.delay = stepper.max;
+  stepper.ramp = 1;
+  stepper.phase = 0;
+  stepper.braking = 0;
+  stepper.brakeAt = brakeAt;
+  stepper.stopAt = steps;
+  stepper.running = 1;
+
+  noInterrupts ();
+  TCCR5A = 0;
+  TCCR5B = _BV (CS52) | _BV (CS51) | _BV (CS50); // Rising edges on T5
+  TCNT5 = 0;
+  OCR5A = brakeAt ? brakeAt : steps;
+  TIMSK5 = brakeAt || steps ? _BV (OCIE5A) : 0;
+
+  TCCR1A = _BV (COM1A0);                         // Toggle OC1A on compare
+  TCNT1 = 0;
+  stepperLoad ();
+  TIMSK1 = _BV (OCIE1A);
+  TCCR1B = _BV (WGM12) | _BV (CS11);             // Clear on compare, / 8
+  interrupts ();
+}
+
+uint16_t stepperSteps () {
+  noInterrupts ();
+  uint16_t steps = TCNT5;
+  interrupts ();
+  return steps;
+}
+
+#else
+
+/**
+ * Without it the steps still come from Timer1, from its compare interrupt:
+ * goUntil queues each step with its half step delay, and the interrupt
+ * raises the step output, then drops it a half step later and waits
+ * another before the next. So the pulses keep their time however long the
+ * other tasks take, and goUntil only has to keep the queue from running
+ * dry. The direction is the task's to set, with nothing queued; a step the
+ * other way waits for the queue to empty.
+ *
+ * Coupled, the second carriage's step output goes with the first's.
+ */
+#define STEPPER_TICKS   2     // Timer1 ticks per microsecond, at clock / 8
+#define STEPPER_QUEUE   16    // Steps queued at most, a power of two
+#define STEPPER_SETUP   10    // Microseconds from the direction to a step
+
+struct {
+  volatile uint8_t clocking;  // Timer1 is running the queue
+  volatile uint8_t head;
+  volatile uint8_t tail;
+  volatile uint8_t queued;    // Steps queued and not yet ended
+  uint8_t phase;              // 1 while the step output is high
+  uint8_t second;             // Pulse the second carriage too
+  int8_t sign;                // Which way the queued steps go, 1 right
+  uint16_t compare[STEPPER_QUEUE];  // Each step's half step, in OCR1A
+} stepper;
+
+#define stepperBegin() {}
+
+/**
+ * Ends a step: the step outputs go low and it's taken.
+ */
+void stepperEndStep () {
+  (digitalWrite) (HORIZONTAL_STEPPER_STEP, LOW);
+#ifdef DUAL_CARRIAGE
+  if (stepper.second) (digitalWrite) (SECOND_STEPPER_STEP, LOW);
+#endif
+  stepper.queued--;
+  stepper.phase = 0;
+}
+
+ISR (TIMER1_COMPA_vect) {
+  if (stepper.phase) {
+    // The low half is as long as the high one, OCR1A stays
+    stepperEndStep ();
+    return;
+  }
+
+  if (stepper.head == stepper.tail) {
+    TCCR1B = 0;
+    TIMSK1 = 0;
+    stepper.clocking = 0;
+    return;
+  }
+
+  OCR1A = stepper.compare[stepper.head];
+  stepper.head = (stepper.head + 1) & (STEPPER_QUEUE - 1);
+  (digitalWrite) (HORIZONTAL_STEPPER_STEP, HIGH);
+#ifdef DUAL_CARRIAGE
+  if (stepper.second) (digitalWrite) (SECOND_STEPPER_STEP, HIGH);
+#endif
+  stepper.phase = 1;
+}
+
+/**
+ * Returns whether every queued step has been taken, and the direction can
+ * change.
+ */
+uint8_t stepperIdle () {
+  return !stepper.clocking;
+}
+
+/**
+ * Returns whether a step in a given direction can be queued now.
+ */
+uint8_t stepperRoom (int direction) {
+  if (stepperIdle ()) return 1;
+  if ((direction == LEFT ? -1 : 1) != stepper.sign) return 0;
+  return ((stepper.tail + 1) & (STEPPER_QUEUE - 1)) != stepper.head;
+}
+
+/**
+ * Queues a step, starting the timer if it's stopped. Check stepperRoom
+ * first, and set the direction while stepperIdle.
+ *
+ * @param delay is the half step in microseconds, up to 32767
+ * @param second is whether the second carriage steps along
+ */
+void stepperQueue (int direction, int delay, uint8_t second) {
+  noInterrupts ();
+  stepper.compare[stepper.tail] = (uint16_t)delay * STEPPER_TICKS - 1;
+  stepper.tail = (stepper.tail + 1) & (STEPPER_QUEUE - 1);
+  stepper.queued++;
+
+  if (!stepper.clocking) {
+    stepper.sign = direction == LEFT ? -1 : 1;
+    stepper.second = second;
+    stepper.phase = 0;
+    stepper.clocking = 1;
+    TCCR1A = 0;
+    TCNT1 = 0;
+    OCR1A = STEPPER_SETUP * STEPPER_TICKS - 1;
+    TIMSK1 = _BV (OCIE1A);
+    TCCR1B = _BV (WGM12) | _BV (CS11);           // Clear on compare, / 8
+  }
+  interrupts ();
+}
+
+/**
+ * Returns the steps queued and not yet taken, negative going left.
+ */
+long stepperQueued () {
+  noInterrupts ();
+  long queued = stepper.queued;
+  interrupts ();
+  return stepper.sign * queued;
+}
+
+/**
+ * Stops the pulses, finishing a step half way through, and drops what's
+ * still queued.
+ *
+ * @return the steps dropped, negative going left
+ */
+long stepperHalt () {
+  noInterrupts ();
+  TCCR1B = 0;
+  TIMSK1 = 0;
+  if (stepper.phase) stepperEndStep ();
+  long dropped = stepper.sign * (long)stepper.queued;
+  stepper.head = stepper.tail = stepper.queued = 0;
+  stepper.clocking = 0;
+  interrupts ();
+
+  return dropped;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef __TRACE_HDR__
+#define __TRACE_HDR__
+
+#include <stdint.h>
+
+/**
+ * Binary trace records.
+ *
+ * With __trace__ defined the controller writes these instead of the text
+ * debug output. Every record is 8 bytes, laid out little endian as on the
+ * AVR, and a stream starts with a TRACE_BOOT record whose time field is
+ * TRACE_MAGIC.
+ */
+typedef struct {
+  uint32_t time;    // millis () when the event happened
+  uint8_t kind;
+  uint8_t arg;
+  uint16_t value;
+} TraceRecord;
+
+#define TRACE_MAGIC       0x52545357UL // "WSTR"
+#define TRACE_VERSION     1
+#define TRACE_BAUD        115200
+
+// Record kinds
+#define TRACE_BOOT        0 // arg is TRACE_VERSION
+#define TRACE_MOVE        1 // arg direction, value steps or TRACE_LIMIT_MOVE
+#define TRACE_STROKE      2 // arg axis, value stroke count
+#define TRACE_STROKE_END  3 // arg axis, value stroke count
+#define TRACE_WAIT        4 // arg WAIT_*, value milliseconds if known
+#define TRACE_LIMIT       5 // arg pin, value bounces seen while debouncing
+#define TRACE_SPRAYS      6 // arg 1 for the top spray, 2 for the bottom
+#define TRACE_JOB         7 // arg 1 when a job starts, 0 when it's done
+#define TRACE_FAULT       8
+#define TRACE_INPUT       9 // arg pin, value the level read (record mode)
+#define TRACE_OUTPUT      10 // arg pin, value the level written (record mode)
+#define TRACE_FLIGHT      11 // arg the reset's cause, value records dumped
+
+#define TRACE_KINDS       12
+
+// Set in the kind of a record the flight recorder kept from before a reset
+#define TRACE_DUMPED      0x80
+
+#define TRACE_LIMIT_MOVE  0xffff
+
+// What the controller is waiting for
+#define WAIT_REST         0
+#define WAIT_LIMIT        1
+#define WAIT_SWITCH       2
+
+// Every event goes to the flight recorder (see flight.h) too
+#define trace(k, a, v) do { flightWrite (k, a, v); traceSend (k, a, v); \
+                        } while (0)
+
+#ifdef __trace__
+#define traceSend(k, a, v) traceWrite (k, a, v)
+
+/**
+ * Writes one record to the serial port, stamped with when it happened.
+ */
+void traceWriteAt (uint32_t time, uint8_t kind, uint8_t arg, uint16_t value) {
+  TraceRecord r = { time, kind, arg, value };
+  Serial.write ((const uint8_t*)&r, sizeof (r));
+}
+
+void traceWrite (uint8_t kind, uint8_t arg, uint16_t value) {
+  traceWriteAt ((uint32_t)millis (), kind, arg, value);
+}
+
+/**
+ * Starts a trace stream. Call once right after Serial.begin.
+ */
+void traceBegin () {
+  TraceRecord r = { TRACE_MAGIC, TRACE_BOOT, TRACE_VERSION, 0 };
+  Serial.write ((const uint8_t*)&r, sizeof (r));
+}
+#else
+#define traceSend(k, a, v) do {} while (0)
+#define traceBegin() {}
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __VFD_HDR__
+#define __VFD_HDR__
+
+#include "modbus.h"
+#include "params.h"
+
+/**
+ * The vertical VFD over Modbus.
+ *
+ * The relays still start, stop and reverse the drive; the link sets its
+ * ramps before a move and reads back how fast it's going. The drive takes
+ * its frequency from the analog input, as the position loop needs (pid.h),
+ * so the frequency setpoint isn't written: the loop's top speed holds the
+ * moves to params.verticalFrequency instead. The registers are those of a
+ * Delta VFD-M, check them against the drive's manual.
+ */
+
+#define VFD_ACCEL         0x010a  // Ramp up time, 0.1 s to the max frequency
+#define VFD_DECEL         0x010b  // Ramp down time
+#define VFD_FREQUENCY     0x2001  // Frequency setpoint, 0.01 Hz, unused
+#define VFD_OUTPUT        0x2103  // Output frequency, 0.01 Hz
+
+#define VFD_POLL          100     // Milliseconds between speed reads
+#define VFD_UNSENT        MODBUS_FAILED
+
+struct {
+  uint16_t accel;         // What the drive last acknowledged
+  uint16_t decel;
+  uint16_t output;        // Its output frequency when last read
+  unsigned long polled;
+} vfd;
+
+void vfdBegin () {
+  modbusBegin (VFD_BAUD);
+  vfd.accel = VFD_UNSENT;
+  vfd.decel = VFD_UNSENT;
+}
+
+/**
+ * Queues the ramps for the next vertical move, skipping what the drive has
+ * acknowledged. A write that doesn't go through leaves VFD_UNSENT, so the
+ * next move sends it again.
+ */
+void vfdPrepare (uint16_t ramp) {
+  if (ramp != vfd.accel)
+    modbusQueue (VFD_SLAVE, MODBUS_WRITE, VFD_ACCEL, ramp, &vfd.accel);
+  if (ramp != vfd.decel)
+    modbusQueue (VFD_SLAVE, MODBUS_WRITE, VFD_DECEL, ramp, &vfd.decel);
+}
+
+/**
+ * Returns whether everything vfdPrepare asked for has been answered or
+ * given up on, whatever polls are still queued behind it.
+ */
+int vfdReady () {
+  return !modbusPending (MODBUS_WRITE);
+}
+
+/**
+ * Returns whether the drive has acknowledged the ramp.
+ */
+int vfdTook (uint16_t ramp) {
+  return vfd.accel == ramp && vfd.decel == ramp;
+}
+
+/**
+ * Keeps the link going while the carriage moves. Call this from the
+ * motion task.
+ */
+void vfdPoll () {
+  modbusPoll ();
+
+  if (millis () - vfd.polled >= VFD_POLL && modbusIdle ()) {
+    vfd.polled = millis ();
+    modbusQueue (VFD_SLAVE, MODBUS_READ, VFD_OUTPUT, 1, &vfd.output);
+  }
+}
+
+#endif